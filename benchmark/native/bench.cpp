@@ -0,0 +1,356 @@
+/*************************************************************************}
+{ bench.cpp - benchmark harness                                           }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#include "bench.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Bench {
+
+    static volatile size_t sink;
+
+    void consume(size_t value)
+    {
+        sink = sink + value;
+    }
+
+    static double percentile(const std::vector<double>& sorted, double p)
+    {
+        size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+
+    TlbCounter::TlbCounter()
+    {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    TlbCounter::~TlbCounter()
+    {
+#ifdef __linux__
+        if(fd != -1)
+            close(fd);
+#endif
+    }
+
+    void TlbCounter::start()
+    {
+#ifdef __linux__
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    uint64_t TlbCounter::stop()
+    {
+        uint64_t count = 0;
+#ifdef __linux__
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if(read(fd, &count, sizeof(count)) != sizeof(count))
+            count = 0;
+#endif
+        return count;
+    }
+
+    Runner::Runner(const Options &options):
+        options(options)
+    {
+        if(options.tlb)
+        {
+            tlb.reset(new TlbCounter());
+            if(!tlb->isValid())
+            {
+                fprintf(stderr, "the data TLB misses can't be counted: %s\n", strerror(errno));
+                tlb.reset();
+            }
+        }
+    }
+
+    void Runner::run(const std::string &name, size_t ops, const std::function<void (size_t)> &f, size_t bytes)
+    {
+        if(!options.filter.empty() && name.find(options.filter) == std::string::npos)
+            return;
+
+        for(size_t a=0; a<options.warmup; a++)
+            f(ops);
+
+        std::vector<double> samples;
+        samples.reserve(options.reps);
+        std::vector<double> tlbSamples;
+        for(size_t a=0; a<options.reps; a++)
+        {
+            if(tlb)
+                tlb->start();
+            auto start = std::chrono::steady_clock::now();
+            f(ops);
+            auto finish = std::chrono::steady_clock::now();
+            if(tlb)
+                tlbSamples.push_back(static_cast<double>(tlb->stop()) / ops);
+            samples.push_back(std::chrono::duration<double, std::nano>(finish - start).count() / ops);
+        }
+
+        Result r = calcResult(name, ops, bytes, samples);
+        if(!tlbSamples.empty())
+        {
+            std::sort(tlbSamples.begin(), tlbSamples.end());
+            r.tlbMisses = percentile(tlbSamples, 0.5);
+        }
+        r.entries = entries;
+        r.locale = locale;
+        print(r);
+    }
+
+    void Runner::setCorpus(size_t entries, const std::string &locale, size_t fileSize)
+    {
+        this->entries = entries;
+        this->locale = locale;
+        if(options.format != Format::Text)
+            return;
+        printf("\n");
+        if(entries)
+            printf("entries: %zu, locale: %s, file size: %zu bytes\n", entries, locale.c_str(), fileSize);
+        printf("%-28s %12s %12s %12s %12s %12s %12s",
+            "benchmark", "mean", "min", "p50", "p90", "p99", "max");
+        if(options.tlb)
+            printf(" %10s", "dTLB/op");
+        printf(" %10s\n", "MB/s");
+    }
+
+    Result Runner::calcResult(const std::string &name, size_t ops, size_t bytes, std::vector<double> &samples)
+    {
+        Result r;
+        r.name = name;
+        r.ops = ops;
+        r.bytes = bytes;
+        if(samples.empty())
+            return r;
+        std::sort(samples.begin(), samples.end());
+        double sum = 0;
+        for(double s : samples)
+            sum += s;
+        r.mean = sum / samples.size();
+        r.min = samples.front();
+        r.p50 = percentile(samples, 0.5);
+        r.p90 = percentile(samples, 0.9);
+        r.p99 = percentile(samples, 0.99);
+        r.max = samples.back();
+        return r;
+    }
+
+    /*!
+     * Escapes a string for JSON and CSV output.
+     */
+    static std::string quote(const std::string& s)
+    {
+        std::string result = "\"";
+        for(char c : s)
+        {
+            if(c == '"' || c == '\\')
+                result.push_back('\\');
+            result.push_back(c);
+        }
+        result.push_back('"');
+        return result;
+    }
+
+    static double throughput(const Result& r)
+    {
+        return r.bytes && r.p50 > 0 ? r.bytes / r.p50 * 1e9 / (1024 * 1024) : 0;
+    }
+
+    void Runner::printHeader() const
+    {
+        const Mix& m = options.mix;
+        switch(options.format)
+        {
+            case Format::Text:
+                printf("batch: %zu, warmup: %zu, repetitions: %zu, mix: %u/%u/%u/%u, zipf: %g, misses: %g\n",
+                    options.batch, options.warmup, options.reps, m.one, m.num, m.ctxOne, m.ctxNum,
+                    options.zipf, options.missRatio);
+                printf("all timings are in nanoseconds per operation\n");
+                break;
+
+            case Format::Json:
+                printf("{\n\"batch\": %zu, \"warmup\": %zu, \"repetitions\": %zu,\n", options.batch, options.warmup, options.reps);
+                printf("\"mix\": {\"one\": %u, \"num\": %u, \"ctx_one\": %u, \"ctx_num\": %u}, \"zipf\": %g, \"misses\": %g,\n",
+                    m.one, m.num, m.ctxOne, m.ctxNum, options.zipf, options.missRatio);
+                printf("\"results\": [");
+                break;
+
+            case Format::Csv:
+                printf("benchmark,entries,locale,ops,mean,min,p50,p90,p99,max,mb_per_s%s\n", options.tlb ? ",dtlb_misses" : "");
+                break;
+        }
+        fflush(stdout);
+    }
+
+    void Runner::printFooter() const
+    {
+        if(options.format == Format::Json)
+            printf("\n]\n}\n");
+        fflush(stdout);
+    }
+
+    void Runner::print(const Result &r) const
+    {
+        switch(options.format)
+        {
+            case Format::Text:
+                printf("%-28s %12.1f %12.1f %12.1f %12.1f %12.1f %12.1f",
+                    r.name.c_str(), r.mean, r.min, r.p50, r.p90, r.p99, r.max);
+                if(options.tlb && r.tlbMisses >= 0)
+                    printf(" %10.3f", r.tlbMisses);
+                else if(options.tlb)
+                    printf(" %10s", "-");
+                if(r.bytes && r.p50 > 0)
+                    printf(" %10.1f", throughput(r));
+                printf("\n");
+                break;
+
+            case Format::Json:
+                printf("%s\n{\"benchmark\": %s, \"entries\": %zu, \"locale\": %s, \"ops\": %zu, "
+                    "\"mean\": %.1f, \"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f, \"mb_per_s\": %.1f",
+                    printed ? "," : "", quote(r.name).c_str(), r.entries, quote(r.locale).c_str(), r.ops,
+                    r.mean, r.min, r.p50, r.p90, r.p99, r.max, throughput(r));
+                if(r.tlbMisses >= 0)
+                    printf(", \"dtlb_misses\": %.3f", r.tlbMisses);
+                printf("}");
+                break;
+
+            case Format::Csv:
+                printf("%s,%zu,%s,%zu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f",
+                    quote(r.name).c_str(), r.entries, quote(r.locale).c_str(), r.ops,
+                    r.mean, r.min, r.p50, r.p90, r.p99, r.max, throughput(r));
+                if(options.tlb && r.tlbMisses >= 0)
+                    printf(",%.3f", r.tlbMisses);
+                else if(options.tlb)
+                    printf(",");
+                printf("\n");
+                break;
+        }
+        printed++;
+        fflush(stdout);
+    }
+
+    Histogram::Histogram():
+        buckets(BUCKETS)
+    {
+    }
+
+    size_t Histogram::bucketIndex(uint64_t value)
+    {
+        if(value < (2u << SUB_BITS))
+            return value;
+        unsigned exp = 63 - __builtin_clzll(value) - SUB_BITS;
+        return (exp << SUB_BITS) + (value >> exp);
+    }
+
+    uint64_t Histogram::bucketValue(size_t index)
+    {
+        if(index < (2u << SUB_BITS))
+            return index;
+        unsigned exp = (index >> SUB_BITS) - 1;
+        uint64_t low = static_cast<uint64_t>(index - (exp << SUB_BITS)) << exp;
+        return low + (1ull << exp) / 2; // the middle of the bucket
+    }
+
+    void Histogram::add(uint64_t value)
+    {
+        buckets[bucketIndex(value)]++;
+        count++;
+        if(value > max)
+            max = value;
+    }
+
+    void Histogram::merge(const Histogram &other)
+    {
+        for(size_t a=0; a<BUCKETS; a++)
+            buckets[a] += other.buckets[a];
+        count += other.count;
+        max = std::max(max, other.max);
+    }
+
+    uint64_t Histogram::percentile(double p) const
+    {
+        if(!count)
+            return 0;
+        uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(p * count)), 1);
+        uint64_t sum = 0;
+        for(size_t a=0; a<BUCKETS; a++)
+        {
+            sum += buckets[a];
+            if(sum >= rank)
+                return std::min(bucketValue(a), max);
+        }
+        return max;
+    }
+
+    MemoryBuf::MemoryBuf(const char *data, size_t size)
+    {
+        char* p = const_cast<char*>(data); // the buffer is never written to
+        setg(p, p, p + size);
+    }
+
+    MemoryBuf::pos_type MemoryBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+    {
+        if(dir == std::ios_base::cur)
+            off += gptr() - eback();
+        else if(dir == std::ios_base::end)
+            off += egptr() - eback();
+        return seekpos(off, which);
+    }
+
+    MemoryBuf::pos_type MemoryBuf::seekpos(pos_type pos, std::ios_base::openmode which)
+    {
+        off_type off = pos;
+        if(!(which & std::ios_base::in) || off < 0 || off > egptr() - eback())
+            return pos_type(off_type(-1));
+        setg(eback(), eback() + off, egptr());
+        return pos;
+    }
+
+}
@@ -0,0 +1,213 @@
+/*************************************************************************}
+{ bench.h - benchmark harness                                             }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include "corpus.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace Bench {
+
+    /*!
+     * Output format of the results.
+     */
+    enum class Format {
+        Text,
+        Json,
+        Csv
+    };
+
+    /*!
+     * Command line options.
+     */
+    struct Options {
+        size_t warmup = 3; /*!< Repetitions to run before measuring. */
+        size_t reps = 30; /*!< Measured repetitions. */
+        std::vector<size_t> sizes {10000}; /*!< Numbers of strings in the generated files. */
+        std::vector<std::string> locales {"ru_RU"}; /*!< Locales of the generated files. */
+        Mix mix; /*!< Kinds of strings in the generated files. */
+        size_t batch = 10000; /*!< Number of operations in one repetition of fast benchmarks. */
+        double zipf = 1; /*!< Exponent of the Zipf distribution of the mixed lookups. */
+        double missRatio = 0.1; /*!< Part of the mixed lookups that are not found. */
+        size_t fanout = 30; /*!< Number of files for the fan-out benchmarks. */
+        std::string filter; /*!< Run only the benchmarks which names contain this string. */
+        Format format = Format::Text;
+        bool memory = false; /*!< Measure the memory usage instead of the time. */
+        bool tlb = false; /*!< Count the data TLB misses, see TlbCounter. */
+    };
+
+    /*!
+     * Statistics of one benchmark, in nanoseconds per operation.
+     */
+    struct Result {
+        std::string name;
+        size_t entries = 0; /*!< Number of strings in the file, zero if not applicable. */
+        std::string locale; /*!< Locale of the file, empty if not applicable. */
+        size_t ops = 0; /*!< Operations per repetition. */
+        size_t bytes = 0; /*!< Bytes processed per operation, zero if not applicable. */
+        double mean = 0;
+        double min = 0;
+        double p50 = 0;
+        double p90 = 0;
+        double p99 = 0;
+        double max = 0;
+        double tlbMisses = -1; /*!< Median number of the data TLB misses per operation, negative if not measured. */
+    };
+
+    /*!
+     * Counts the data TLB misses (load misses) of the current thread in the user space
+     * via the Linux performance counters.
+     * The counter may be unavailable (other OS, no such hardware event, restricted by perf_event_paranoid),
+     * see isValid().
+     */
+    class TlbCounter
+    {
+    public:
+        TlbCounter();
+        ~TlbCounter();
+        TlbCounter(const TlbCounter&) = delete;
+        TlbCounter& operator=(const TlbCounter&) = delete;
+
+        inline bool isValid() const {return fd != -1;}
+
+        /*!
+         * Resets the counter and starts counting.
+         */
+        void start();
+
+        /*!
+         * Stops counting and returns the number of misses since start().
+         */
+        uint64_t stop();
+
+    protected:
+        int fd = -1;
+    };
+
+    /*!
+     * Runs the benchmarks and prints the results.
+     */
+    class Runner
+    {
+    public:
+        explicit Runner(const Options& options);
+
+        /*!
+         * Measures *f*, which must perform *ops* operations per call.
+         * *f* is called Options::warmup times without measuring
+         * and then Options::reps times, each call is one sample.
+         * *bytes* is the amount of data processed by a single operation, if applicable.
+         */
+        void run(const std::string& name, size_t ops, const std::function<void(size_t ops)>& f, size_t bytes = 0);
+
+        /*!
+         * Sets the file that the following benchmarks use.
+         * *entries* = 0 means that the following benchmarks do not depend on a file.
+         */
+        void setCorpus(size_t entries, const std::string& locale, size_t fileSize);
+
+        /*!
+         * Prints the header of the output.
+         */
+        void printHeader() const;
+
+        /*!
+         * Prints the end of the output.
+         */
+        void printFooter() const;
+
+        inline const Options& getOptions() const {return options;}
+
+    protected:
+        Options options;
+        size_t entries = 0;
+        std::string locale;
+        mutable size_t printed = 0;
+        std::unique_ptr<TlbCounter> tlb; /*!< nullptr if Options::tlb is not set or the counter is unavailable. */
+
+        static Result calcResult(const std::string& name, size_t ops, size_t bytes, std::vector<double>& samples);
+        void print(const Result& r) const;
+    };
+
+    /*!
+     * Latency histogram with logarithmic buckets.
+     * Values below 32 are stored exactly, larger values with an error of at most 1/16.
+     * Adding a value does not allocate, so it can be used inside of a measured loop.
+     */
+    class Histogram
+    {
+    public:
+        Histogram();
+
+        void add(uint64_t value);
+        void merge(const Histogram& other);
+
+        /*!
+         * Returns the approximate value below which the *p* part of all values lie, *p* is in [0; 1].
+         */
+        uint64_t percentile(double p) const;
+
+        inline uint64_t getCount() const {return count;}
+        inline uint64_t getMax() const {return max;}
+
+    protected:
+        static const unsigned SUB_BITS = 4; /*!< log2 of the number of buckets per power of two */
+        static const size_t BUCKETS = (65 - SUB_BITS) << SUB_BITS;
+
+        std::vector<uint64_t> buckets;
+        uint64_t count = 0;
+        uint64_t max = 0;
+
+        static size_t bucketIndex(uint64_t value);
+        static uint64_t bucketValue(size_t index);
+    };
+
+    /*!
+     * Makes the compiler believe that the value is used.
+     */
+    void consume(size_t value);
+
+    /*!
+     * A seekable read-only stream buffer over a block of memory.
+     * Allows parsing in-memory files without copying them into a std::stringstream.
+     */
+    class MemoryBuf : public std::streambuf
+    {
+    public:
+        MemoryBuf(const char* data, size_t size);
+
+    protected:
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+        pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+    };
+
+}
@@ -0,0 +1,290 @@
+/*************************************************************************}
+{ corpus.cpp - synthetic translation files for benchmarks                 }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#include "corpus.h"
+
+#include "plural.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+namespace Bench {
+
+    static const char* EN = " qwertyuiopasdfghjklzxcvbnm,.";
+
+    /*!
+     * Letters and headers of the generated translations.
+     */
+    struct LocaleData {
+        const char* locale;
+        const char* letters; /*!< UTF-8, one character is picked at a time */
+        const char* pluralForms; /*!< Plural-Forms header, informational only */
+    };
+
+    static const LocaleData LOCALES[] = {
+        {"ru", "ёйцукенгшщзхъфывапролджэячсмитьбю ",
+            "nplurals=3; plural=(n%10==1 && n%100!=11 ? 0 : n%10>=2 && n%10<=4 && (n%100<10 || n%100>=20) ? 1 : 2);"},
+        {"ja", "あいうえおかきくけこさしすせそたちつてとなにぬねのはひふへほまみむめもやゆよらりるれろわをん、。",
+            "nplurals=1; plural=0;"},
+        {"ar", "ابتثجحخدذرزسشصضطظعغفقكلمنهوي ",
+            "nplurals=6; plural=(n==0 ? 0 : n==1 ? 1 : n==2 ? 2 : n%100>=3 && n%100<=10 ? 3 : n%100>=11 ? 4 : 5);"}
+    };
+
+    /*!
+     * Splits a UTF-8 string into characters.
+     */
+    static std::vector<std::string> splitChars(const char* s)
+    {
+        std::vector<std::string> chars;
+        while(*s)
+        {
+            size_t len = 1;
+            while((s[len] & 0xc0) == 0x80)
+                len++;
+            chars.emplace_back(s, len);
+            s += len;
+        }
+        return chars;
+    }
+
+    static std::string randomEn(std::mt19937_64& rnd)
+    {
+        std::uniform_int_distribution<size_t> len(10, 50);
+        std::uniform_int_distribution<size_t> chr(0, strlen(EN) - 1);
+        std::string s;
+        for(size_t a=len(rnd); a; a--)
+            s.push_back(EN[chr(rnd)]);
+        return s;
+    }
+
+    static std::string randomText(std::mt19937_64& rnd, const std::vector<std::string>& chars)
+    {
+        std::uniform_int_distribution<size_t> len(10, 50);
+        std::uniform_int_distribution<size_t> chr(0, chars.size() - 1);
+        std::string s;
+        for(size_t a=len(rnd); a; a--)
+            s.append(chars[chr(rnd)]);
+        return s;
+    }
+
+    static void appendInt(std::string& s, uint32_t n)
+    {
+        for(size_t a=0; a<sizeof(n); a++)
+            s.push_back(static_cast<char>((n >> (a*8)) & 0xff));
+    }
+
+    /*!
+     * Builds an MO file from the (original, translation) pairs.
+     */
+    static std::string buildMo(std::vector<std::pair<std::string, std::string>>& pairs)
+    {
+        std::sort(pairs.begin(), pairs.end());
+        uint32_t n = pairs.size();
+        uint32_t origTable = 28;
+        uint32_t trTable = origTable + n * 8;
+        uint32_t offset = trTable + n * 8;
+
+        std::string header;
+        std::string strings;
+        appendInt(header, 0x950412de);
+        appendInt(header, 0);
+        appendInt(header, n);
+        appendInt(header, origTable);
+        appendInt(header, trTable);
+        appendInt(header, 0); // no hash table
+        appendInt(header, offset);
+
+        std::string origIndex;
+        std::string trIndex;
+        for(const auto& p : pairs)
+        {
+            appendInt(origIndex, p.first.size());
+            appendInt(origIndex, offset + strings.size());
+            strings.append(p.first);
+            strings.push_back('\0');
+        }
+        for(const auto& p : pairs)
+        {
+            appendInt(trIndex, p.second.size());
+            appendInt(trIndex, offset + strings.size());
+            strings.append(p.second);
+            strings.push_back('\0');
+        }
+        return header + origIndex + trIndex + strings;
+    }
+
+    Corpus generateCorpus(size_t entries, uint64_t seed, const std::string& locale, const Mix& mix)
+    {
+        std::string lang = locale.substr(0, locale.find('_'));
+        const LocaleData* data = nullptr;
+        for(const LocaleData& d : LOCALES)
+            if(lang == d.locale)
+                data = &d;
+        std::vector<std::string> chars = splitChars(data ? data->letters : EN);
+
+        Corpus corpus;
+        corpus.locale = locale;
+        corpus.forms = std::max<size_t>(GotText::Plural::getInfo(locale).count, 1);
+
+        std::vector<std::pair<std::string, std::string>> pairs;
+        std::string header =
+            "Content-Type: text/plain; charset=UTF-8\n"
+            "Language: " + locale + "\n";
+        if(data)
+            header += std::string("Plural-Forms: ") + data->pluralForms + "\n";
+        pairs.emplace_back("", std::move(header));
+
+        std::mt19937_64 rnd(seed);
+        std::uniform_int_distribution<unsigned> kind(0, std::max(mix.total(), 1u) - 1);
+        for(size_t a=0; a<entries; a++)
+        {
+            Key key;
+            unsigned k = kind(rnd);
+            bool hasCtx = k >= mix.one + mix.num;
+            bool hasPlural = hasCtx ? k >= mix.one + mix.num + mix.ctxOne : k >= mix.one;
+            if(hasCtx)
+                key.ctx = randomEn(rnd);
+            key.msgid = randomEn(rnd) + " " + std::to_string(a); // make sure all strings are unique
+            if(hasPlural)
+                key.msgidPlural = randomEn(rnd);
+
+            std::string orig = key.ctx.empty() ? key.msgid : key.ctx + '\4' + key.msgid;
+            std::string tr = randomText(rnd, chars);
+            if(hasPlural)
+            {
+                orig.push_back('\0');
+                orig.append(key.msgidPlural);
+                for(size_t f=1; f<corpus.forms; f++)
+                {
+                    tr.push_back('\0');
+                    tr.append(randomText(rnd, chars));
+                }
+            }
+            pairs.emplace_back(std::move(orig), std::move(tr));
+
+            if(hasCtx)
+                (hasPlural ? corpus.ctxNum : corpus.ctxOne).push_back(std::move(key));
+            else
+                (hasPlural ? corpus.num : corpus.one).push_back(std::move(key));
+        }
+
+        corpus.mo = buildMo(pairs);
+        return corpus;
+    }
+
+    std::string generateTaggedMo(const Corpus &corpus, const std::string &locale, size_t forms, const std::string &tag)
+    {
+        std::vector<std::pair<std::string, std::string>> pairs;
+        pairs.emplace_back("",
+            "Content-Type: text/plain; charset=UTF-8\n"
+            "Language: " + locale + "\n");
+
+        for(const std::vector<Key>* keys : {&corpus.one, &corpus.num, &corpus.ctxOne, &corpus.ctxNum})
+        {
+            for(const Key& key : *keys)
+            {
+                std::string orig = key.ctx.empty() ? key.msgid : key.ctx + '\4' + key.msgid;
+                std::string tr = tag + "|0|" + key.msgid;
+                if(!key.msgidPlural.empty())
+                {
+                    orig.push_back('\0');
+                    orig.append(key.msgidPlural);
+                    for(size_t a=1; a<forms; a++)
+                    {
+                        tr.push_back('\0');
+                        tr.append(tag + "|" + std::to_string(a) + "|" + key.msgid);
+                    }
+                }
+                pairs.emplace_back(std::move(orig), std::move(tr));
+            }
+        }
+
+        return buildMo(pairs);
+    }
+
+    static uint32_t readInt(const std::string& s, size_t pos)
+    {
+        uint32_t n = 0;
+        for(size_t a=0; a<sizeof(n); a++)
+            n |= static_cast<uint32_t>(static_cast<unsigned char>(s[pos + a])) << (a*8);
+        return n;
+    }
+
+    std::string changeTranslations(const std::string &mo, size_t step)
+    {
+        std::string result(mo);
+        uint32_t n = readInt(mo, 8);
+        uint32_t origTable = readInt(mo, 12);
+        uint32_t trTable = readInt(mo, 16);
+        for(uint32_t a=0; a<n; a+=step)
+        {
+            if(!readInt(mo, origTable + a*8)) // keep the headers
+                continue;
+            uint32_t len = readInt(mo, trTable + a*8);
+            uint32_t offset = readInt(mo, trTable + a*8 + 4);
+            for(uint32_t b=offset; b<offset+len; b++)
+            {
+                if(result[b])
+                    result[b] = 'x';
+            }
+        }
+        return result;
+    }
+
+    std::vector<Key> makeMissing(const std::vector<Key> &keys)
+    {
+        std::vector<Key> result(keys);
+        for(Key& k : result)
+            k.msgid.push_back('_');
+        return result;
+    }
+
+    std::vector<size_t> generateZipf(size_t n, size_t length, double s, uint64_t seed)
+    {
+        std::vector<size_t> result;
+        if(!n)
+            return result;
+
+        std::vector<double> cdf(n);
+        double sum = 0;
+        for(size_t a=0; a<n; a++)
+        {
+            sum += 1 / std::pow(a + 1, s);
+            cdf[a] = sum;
+        }
+
+        std::mt19937_64 rnd(seed);
+        std::uniform_real_distribution<double> u(0, sum);
+        result.reserve(length);
+        for(size_t a=0; a<length; a++)
+        {
+            size_t i = std::upper_bound(cdf.begin(), cdf.end(), u(rnd)) - cdf.begin();
+            result.push_back(std::min(i, n - 1));
+        }
+        return result;
+    }
+
+}
@@ -0,0 +1,100 @@
+/*************************************************************************}
+{ corpus.h - synthetic translation files for benchmarks                   }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Bench {
+
+    /*!
+     * A source string of a generated translation file.
+     */
+    struct Key {
+        std::string ctx; /*!< Empty if the string has no context. */
+        std::string msgid;
+        std::string msgidPlural; /*!< Empty if the string has no plural form. */
+    };
+
+    /*!
+     * Relative amounts of the different kinds of strings in a generated file.
+     */
+    struct Mix {
+        unsigned one = 50; /*!< Singular strings. */
+        unsigned num = 25; /*!< Plural strings. */
+        unsigned ctxOne = 15; /*!< Singular strings with a context. */
+        unsigned ctxNum = 10; /*!< Plural strings with a context. */
+
+        inline unsigned total() const {return one + num + ctxOne + ctxNum;}
+    };
+
+    /*!
+     * A generated translation file and the strings it contains.
+     */
+    struct Corpus {
+        std::string locale;
+        size_t forms = 0; /*!< Number of plural forms of the locale. */
+        std::string mo; /*!< Contents of the MO file. */
+        std::vector<Key> one; /*!< Keys for GotText::_(). */
+        std::vector<Key> num; /*!< Keys for GotText::_n(). */
+        std::vector<Key> ctxOne; /*!< Keys for GotText::_p(). */
+        std::vector<Key> ctxNum; /*!< Keys for GotText::_np(). */
+    };
+
+    /*!
+     * Generates an MO file with *entries* random strings of the kinds specified by *mix*.
+     * The translations are written with the letters of the *locale* (Russian, Japanese and Arabic are supported,
+     * Latin letters are used for other locales) and have as many plural forms as the locale has.
+     * The same *seed* always produces the same file.
+     */
+    Corpus generateCorpus(size_t entries, uint64_t seed = 1, const std::string& locale = "ru_RU", const Mix& mix = Mix());
+
+    /*!
+     * Builds an MO file with the same strings as *corpus*, but for the *locale* with *forms* plural forms.
+     * Each translation is "<tag>|<plural form index>|<msgid>",
+     * which allows checking which file and which plural form a translation came from.
+     */
+    std::string generateTaggedMo(const Corpus& corpus, const std::string& locale, size_t forms, const std::string& tag);
+
+    /*!
+     * Returns a copy of the MO file *mo* with every *step*-th translation replaced
+     * by the same number of "x" characters. The plural forms and the offsets of the strings are kept.
+     */
+    std::string changeTranslations(const std::string& mo, size_t step);
+
+    /*!
+     * Returns a copy of *keys* with the strings changed so that they are not found.
+     */
+    std::vector<Key> makeMissing(const std::vector<Key>& keys);
+
+    /*!
+     * Generates *length* random indexes in [0; n) with the Zipf distribution:
+     * the frequency of the index *i* is proportional to 1/(i+1)^s,
+     * i.e. a small set of the first indexes is requested most of the time.
+     */
+    std::vector<size_t> generateZipf(size_t n, size_t length, double s, uint64_t seed = 1);
+
+}
@@ -0,0 +1,852 @@
+/*************************************************************************}
+{ main.cpp - native benchmarks of the engine                              }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#include "bench.h"
+#include "corpus.h"
+#include "memory.h"
+
+#include "gottext.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <random>
+
+#include <dirent.h>
+#include <unistd.h>
+
+using namespace Bench;
+
+static void printUsage(const char* self)
+{
+    printf(
+        "Usage: %s [options]\n"
+        "  --sizes LIST    comma-separated numbers of strings in the generated MO files (default: 10000)\n"
+        "  --entries N     the same as --sizes N\n"
+        "  --locales LIST  comma-separated locales of the generated MO files, e.g. ja,ru_RU,ar (default: ru_RU)\n"
+        "  --mix A,B,C,D   relative amounts of singular, plural, context and context plural strings (default: 50,25,15,10)\n"
+        "  --zipf S        exponent of the Zipf distribution of the mixed lookups (default: 1)\n"
+        "  --misses R      part of the mixed lookups that are not found, from 0 to 1 (default: 0.1)\n"
+        "  --fanout N      number of files for the fan-out benchmarks (default: 30)\n"
+        "  --batch N       number of operations per repetition (default: 10000)\n"
+        "  --reps N        number of measured repetitions (default: 30)\n"
+        "  --warmup N      number of repetitions before measuring (default: 3)\n"
+        "  --filter STR    run only the benchmarks which names contain STR\n"
+        "  --format FMT    output format: text, json or csv (default: text)\n"
+        "  --memory        measure the memory used by the loaded files instead of the time\n"
+        "  --tlb           count the data TLB misses per operation (Linux only)\n",
+        self);
+}
+
+static std::vector<std::string> splitList(const std::string& s)
+{
+    std::vector<std::string> items;
+    size_t pos = 0;
+    while(pos <= s.size())
+    {
+        size_t next = s.find(',', pos);
+        if(next == std::string::npos)
+            next = s.size();
+        items.push_back(s.substr(pos, next - pos));
+        pos = next + 1;
+    }
+    return items;
+}
+
+static bool parseOptions(int argc, char** argv, Options& options)
+{
+    for(int a=1; a<argc; a++)
+    {
+        std::string arg = argv[a];
+        if(arg == "--memory")
+        {
+            options.memory = true;
+            continue;
+        }
+        if(arg == "--tlb")
+        {
+            options.tlb = true;
+            continue;
+        }
+        if(arg == "--help" || arg == "-h" || a + 1 >= argc)
+            return false;
+        std::string val = argv[++a];
+        if(arg == "--sizes" || arg == "--entries")
+        {
+            options.sizes.clear();
+            for(const std::string& item : splitList(val))
+                options.sizes.push_back(std::stoul(item));
+        }
+        else if(arg == "--locales")
+        {
+            options.locales = splitList(val);
+        }
+        else if(arg == "--mix")
+        {
+            std::vector<std::string> items = splitList(val);
+            if(items.size() != 4)
+                return false;
+            options.mix.one = std::stoul(items[0]);
+            options.mix.num = std::stoul(items[1]);
+            options.mix.ctxOne = std::stoul(items[2]);
+            options.mix.ctxNum = std::stoul(items[3]);
+        }
+        else if(arg == "--zipf")
+            options.zipf = std::stod(val);
+        else if(arg == "--misses")
+            options.missRatio = std::stod(val);
+        else if(arg == "--fanout")
+            options.fanout = std::stoul(val);
+        else if(arg == "--batch")
+            options.batch = std::stoul(val);
+        else if(arg == "--reps")
+            options.reps = std::stoul(val);
+        else if(arg == "--warmup")
+            options.warmup = std::stoul(val);
+        else if(arg == "--filter")
+            options.filter = val;
+        else if(arg == "--format")
+        {
+            if(val == "text")
+                options.format = Format::Text;
+            else if(val == "json")
+                options.format = Format::Json;
+            else if(val == "csv")
+                options.format = Format::Csv;
+            else
+                return false;
+        }
+        else
+            return false;
+    }
+
+    for(size_t size : options.sizes)
+        if(!size)
+            return false;
+    for(const std::string& locale : options.locales)
+        if(!GotText::Plural::getInfo(locale).isValid())
+            return false;
+    return options.batch && options.reps && options.fanout && options.mix.total()
+        && options.missRatio >= 0 && options.missRatio <= 1;
+}
+
+/*!
+ * Returns the indexes 0..size-1 in a random order.
+ */
+static std::vector<size_t> shuffledIndexes(size_t size)
+{
+    std::vector<size_t> indexes(size);
+    for(size_t a=0; a<size; a++)
+        indexes[a] = a;
+    std::shuffle(indexes.begin(), indexes.end(), std::mt19937_64(42));
+    return indexes;
+}
+
+/*!
+ * Looks up the *keys* in a random order using *f*.
+ */
+static void lookups(
+        Runner& runner,
+        const std::string& name,
+        const std::vector<Key>& keys,
+        const std::function<size_t(const Key& key, int n)>& f)
+{
+    if(keys.empty())
+        return;
+    std::vector<size_t> order = shuffledIndexes(keys.size());
+    size_t pos = 0;
+    runner.run(name, runner.getOptions().batch, [&](size_t ops){
+        size_t sum = 0;
+        for(size_t a=0; a<ops; a++)
+        {
+            sum += f(keys[order[pos]], static_cast<int>(a % 100));
+            if(++pos == order.size())
+                pos = 0;
+        }
+        consume(sum);
+    });
+}
+
+/*!
+ * Looks up the *keys* in a random order via the prepared messages (see GotText::Message).
+ */
+static void handleLookups(
+        Runner& runner,
+        const std::string& name,
+        const std::vector<Key>& keys,
+        GotText::LookupCounters::Dict dict,
+        const GotText::GotText& g)
+{
+    std::vector<GotText::Message> messages;
+    messages.reserve(keys.size());
+    for(const Key& k : keys)
+        messages.emplace_back(dict, k.ctx, k.msgid, k.msgidPlural);
+    std::vector<size_t> order = shuffledIndexes(messages.size());
+    size_t pos = 0;
+    runner.run(name, runner.getOptions().batch, [&](size_t ops){
+        size_t sum = 0;
+        for(size_t a=0; a<ops; a++)
+        {
+            sum += g.translate(messages[order[pos]], static_cast<int>(a % 100)).size();
+            if(++pos == order.size())
+                pos = 0;
+        }
+        consume(sum);
+    });
+}
+
+/*!
+ * Generates the lookups of all kinds of strings with the Zipf distribution,
+ * the most frequent strings are picked randomly.
+ * Options::missRatio of the lookups are replaced with the strings from *missing*.
+ */
+static std::vector<std::pair<size_t, const Key*>> mixedLookups(
+        const Options& options,
+        const std::vector<const std::vector<Key>*>& found,
+        const std::vector<const std::vector<Key>*>& missing)
+{
+    std::vector<std::pair<size_t, size_t>> all;
+    for(size_t d=0; d<found.size(); d++)
+        for(size_t a=0; a<found[d]->size(); a++)
+            all.emplace_back(d, a);
+    std::shuffle(all.begin(), all.end(), std::mt19937_64(7));
+
+    std::mt19937_64 rnd(8);
+    std::bernoulli_distribution miss(options.missRatio);
+    std::vector<std::pair<size_t, const Key*>> lookups;
+    lookups.reserve(options.batch);
+    for(size_t rank : generateZipf(all.size(), options.batch, options.zipf))
+    {
+        size_t d = all[rank].first;
+        const std::vector<Key>& keys = miss(rnd) ? *missing[d] : *found[d];
+        lookups.emplace_back(d, &keys[all[rank].second]);
+    }
+    return lookups;
+}
+
+/*!
+ * Looks up the strings of all kinds with the Zipf distribution, see mixedLookups().
+ */
+static void zipfLookups(Runner& runner, const std::string& name, const Corpus& corpus, const GotText::GotText& g)
+{
+    std::vector<Key> missOne = makeMissing(corpus.one);
+    std::vector<Key> missNum = makeMissing(corpus.num);
+    std::vector<Key> missCtxOne = makeMissing(corpus.ctxOne);
+    std::vector<Key> missCtxNum = makeMissing(corpus.ctxNum);
+    std::vector<std::pair<size_t, const Key*>> mixed = mixedLookups(
+        runner.getOptions(),
+        {&corpus.one, &corpus.num, &corpus.ctxOne, &corpus.ctxNum},
+        {&missOne, &missNum, &missCtxOne, &missCtxNum});
+    runner.run(name, mixed.size(), [&](size_t ops){
+        size_t sum = 0;
+        for(size_t a=0; a<ops; a++)
+        {
+            const Key& k = *mixed[a].second;
+            int n = static_cast<int>(a % 100);
+            switch(mixed[a].first)
+            {
+                case 0: sum += g._(k.msgid).size(); break;
+                case 1: sum += g._n(k.msgid, k.msgidPlural, n).size(); break;
+                case 2: sum += g._p(k.ctx, k.msgid).size(); break;
+                default: sum += g._np(k.ctx, k.msgid, k.msgidPlural, n).size();
+            }
+        }
+        consume(sum);
+    });
+}
+
+static void lookupBenchmarks(Runner& runner, const Corpus& corpus, const GotText::GotText& g, const std::string& suffix)
+{
+    std::vector<Key> missOne = makeMissing(corpus.one);
+    std::vector<Key> missNum = makeMissing(corpus.num);
+    std::vector<Key> missCtxOne = makeMissing(corpus.ctxOne);
+    std::vector<Key> missCtxNum = makeMissing(corpus.ctxNum);
+
+    auto one = [&g](const Key& k, int){
+        return g._(k.msgid).size();
+    };
+    auto num = [&g](const Key& k, int n){
+        return g._n(k.msgid, k.msgidPlural, n).size();
+    };
+    auto ctxOne = [&g](const Key& k, int){
+        return g._p(k.ctx, k.msgid).size();
+    };
+    auto ctxNum = [&g](const Key& k, int n){
+        return g._np(k.ctx, k.msgid, k.msgidPlural, n).size();
+    };
+
+    lookups(runner, "_ hit" + suffix, corpus.one, one);
+    lookups(runner, "_ miss" + suffix, missOne, one);
+    lookups(runner, "_n hit" + suffix, corpus.num, num);
+    lookups(runner, "_n miss" + suffix, missNum, num);
+    lookups(runner, "_p hit" + suffix, corpus.ctxOne, ctxOne);
+    lookups(runner, "_p miss" + suffix, missCtxOne, ctxOne);
+    lookups(runner, "_np hit" + suffix, corpus.ctxNum, ctxNum);
+    lookups(runner, "_np miss" + suffix, missCtxNum, ctxNum);
+    if(!corpus.one.empty())
+        handleLookups(runner, "_ handle" + suffix, corpus.one, GotText::LookupCounters::One, g);
+    if(!corpus.ctxNum.empty())
+        handleLookups(runner, "_np handle" + suffix, corpus.ctxNum, GotText::LookupCounters::CtxNum, g);
+
+    zipfLookups(runner, "zipf mixed" + suffix, corpus, g);
+}
+
+/*!
+ * Records the hotness profile of the file (see GotText::setHotProfileDir()) with the Zipf lookups
+ * and then repeats the lookups in the copies of the file loaded with that profile
+ * (as usual, compiled into an image and with the compressed translations).
+ */
+static void hotBenchmarks(Runner& runner, const Corpus& corpus, const std::string& filename)
+{
+    char dir[] = "/tmp/gottext-bench-hot-XXXXXX";
+    if(!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return;
+    }
+    std::string hotFilename = filename + ".hot";
+    std::string hotImageFilename = filename + ".hot-image";
+    std::string hotCompressedFilename = filename + ".hot-compressed";
+    std::ofstream(hotFilename, std::ofstream::binary) << corpus.mo;
+    std::ofstream(hotImageFilename, std::ofstream::binary) << corpus.mo;
+    std::ofstream(hotCompressedFilename, std::ofstream::binary) << corpus.mo;
+
+    // the copies must be parsed instead of sharing the translations of the original file
+    bool dedup = GotText::GotText::isDedup();
+    GotText::GotText::setDedup(false);
+    GotText::GotText::setHotProfileDir(dir);
+    {
+        GotText::GotText profiled;
+        profiled.load(hotFilename);
+        zipfLookups(runner, "zipf mixed (profiling)", corpus, profiled);
+    }
+    GotText::GotText::saveHotProfiles();
+    GotText::GotText::unload(hotFilename);
+
+    GotText::GotText g;
+    g.load(hotFilename);
+    GotText::GotText::preload(hotImageFilename);
+    GotText::GotText image;
+    image.load(hotImageFilename);
+    GotText::GotText::setCompressValues(true);
+    GotText::GotText compressed;
+    compressed.load(hotCompressedFilename);
+    GotText::GotText::setCompressValues(false);
+    std::string profilePath = GotText::HotProfile::getPath(dir, g.getLang().fingerprint);
+    // only the layout is measured, not the profiling
+    GotText::GotText::setHotProfileDir("");
+    GotText::GotText::setDedup(dedup);
+
+    zipfLookups(runner, "zipf mixed (hot layout)", corpus, g);
+    zipfLookups(runner, "zipf mixed (image, hot layout)", corpus, image);
+    zipfLookups(runner, "zipf mixed (compressed, hot)", corpus, compressed);
+
+    GotText::GotText::unload(hotFilename);
+    GotText::GotText::unload(hotImageFilename);
+    GotText::GotText::unload(hotCompressedFilename);
+    unlink(hotFilename.c_str());
+    unlink(hotImageFilename.c_str());
+    unlink(hotCompressedFilename.c_str());
+    unlink(profilePath.c_str());
+    rmdir(dir);
+}
+
+/*!
+ * Removes the directory *dir* with all files in it.
+ */
+static void removeDir(const std::string& dir)
+{
+    DIR* d = opendir(dir.c_str());
+    if(d)
+    {
+        while(dirent* e = readdir(d))
+        {
+            std::string name = e->d_name;
+            if(name != "." && name != "..")
+                unlink((dir + "/" + name).c_str());
+        }
+        closedir(d);
+    }
+    rmdir(dir.c_str());
+}
+
+/*!
+ * Repeats the lookups in a copy of the file compiled into the huge pages (see GotText::setHugePages()),
+ * then loads the file from the shared image and looks up the strings right after that,
+ * with and without prefaulting the image (see GotText::setPrefault()).
+ */
+static void hugePageBenchmarks(Runner& runner, const Corpus& corpus, const std::string& filename)
+{
+    std::string hugeFilename = filename + ".huge";
+    std::string sharedFilename = filename + ".shared";
+    std::ofstream(hugeFilename, std::ofstream::binary) << corpus.mo;
+    std::ofstream(sharedFilename, std::ofstream::binary) << corpus.mo;
+
+    // the copies must be parsed instead of sharing the translations of the original file
+    bool dedup = GotText::GotText::isDedup();
+    GotText::GotText::setDedup(false);
+    GotText::GotText::setHugePages(true);
+    GotText::GotText huge;
+    huge.load(hugeFilename);
+    GotText::GotText::setHugePages(false);
+
+    auto one = [&huge](const Key& k, int){
+        return huge._(k.msgid).size();
+    };
+    lookups(runner, "_ hit (huge pages)", corpus.one, one);
+    zipfLookups(runner, "zipf mixed (huge pages)", corpus, huge);
+    GotText::GotText::unload(hugeFilename);
+
+    char dir[] = "/tmp/gottext-bench-shared-XXXXXX";
+    if(mkdtemp(dir))
+    {
+        GotText::GotText::setSharedDir(dir);
+        {
+            // publish the image
+            GotText::GotText shared;
+            shared.load(sharedFilename);
+        }
+        for(bool prefault : {false, true})
+        {
+            GotText::GotText::setPrefault(prefault);
+            std::string suffix = prefault ? " (prefault)" : " (shared)";
+            runner.run("load" + suffix, 1, [&](size_t){
+                GotText::GotText::unload(sharedFilename);
+                GotText::GotText shared;
+                shared.load(sharedFilename);
+            });
+            if(corpus.one.empty())
+                continue;
+            GotText::GotText::unload(sharedFilename);
+            GotText::GotText shared;
+            runner.run("load + _ hit" + suffix, runner.getOptions().batch, [&](size_t ops){
+                GotText::GotText::unload(sharedFilename);
+                shared.load(sharedFilename);
+                size_t sum = 0;
+                for(size_t a=0; a<ops; a++)
+                    sum += shared._(corpus.one[a % corpus.one.size()].msgid).size();
+                consume(sum);
+            });
+        }
+        GotText::GotText::setPrefault(false);
+        GotText::GotText::setSharedDir("");
+        GotText::GotText::unload(sharedFilename);
+        removeDir(dir);
+    }
+    else
+    {
+        perror("mkdtemp");
+    }
+    GotText::GotText::setDedup(dedup);
+
+    unlink(hugeFilename.c_str());
+    unlink(sharedFilename.c_str());
+}
+
+/*!
+ * Repeats the lookups in a copy of the file with the compressed translations (see GotText::setCompressValues()),
+ * then looks up the strings which translations are not in the cache of the decompressed blocks,
+ * so each lookup decompresses a block.
+ */
+static void compressedBenchmarks(Runner& runner, const Corpus& corpus, const std::string& filename)
+{
+    std::string compressedName = filename + ".compressed";
+    GotText::GotText::setCompressValues(true);
+    GotText::GotText g;
+    MemoryBuf buf(corpus.mo.data(), corpus.mo.size());
+    std::istream stream(&buf);
+    g.load(compressedName, stream);
+    GotText::GotText::setCompressValues(false);
+
+    lookupBenchmarks(runner, corpus, g, " (compressed)");
+    if(!corpus.one.empty())
+    {
+        // a block takes microseconds to decompress, so fewer lookups are needed
+        runner.run("_ cold hit (compressed)", std::max<size_t>(1, runner.getOptions().batch / 100), [&](size_t ops){
+            size_t sum = 0;
+            for(size_t a=0; a<ops; a++)
+            {
+                GotText::Compact::clearBlockCache();
+                sum += g._(corpus.one[a % corpus.one.size()].msgid).size();
+            }
+            consume(sum);
+        });
+    }
+    GotText::Compact::clearBlockCache();
+    GotText::GotText::unload(compressedName);
+}
+
+/*!
+ * Returns the locale of the n-th file in the fan-out benchmarks.
+ */
+static const char* fanoutLocale(size_t n)
+{
+    static const char* const locales[] = {"ru_RU", "ja", "ar", "de", "fr", "pl", "cs", "uk", "zh", "es"};
+    return locales[n % (sizeof(locales) / sizeof(*locales))];
+}
+
+/*!
+ * Loads Options::fanout files with the same strings as *corpus* but for different locales.
+ * Returns the names of the loaded files.
+ */
+static std::vector<std::string> loadFanout(const Options& options, const Corpus& corpus, const std::string& prefix, std::vector<GotText::GotText>& objects)
+{
+    std::vector<std::string> names;
+    objects.resize(options.fanout);
+    for(size_t a=0; a<options.fanout; a++)
+    {
+        std::string locale = fanoutLocale(a);
+        size_t forms = std::max<size_t>(GotText::Plural::getInfo(locale).count, 1);
+        std::string mo = generateTaggedMo(corpus, locale, forms, std::to_string(a));
+        MemoryBuf buf(mo.data(), mo.size());
+        std::istream stream(&buf);
+        names.push_back(prefix + std::to_string(a));
+        objects[a].load(names.back(), stream);
+    }
+    return names;
+}
+
+/*!
+ * Translates each plural string into Options::fanout files,
+ * one file at a time and via GotText::translateMany().
+ * One operation is a translation into all files.
+ */
+static void fanoutBenchmarks(Runner& runner, const Corpus& corpus)
+{
+    const Options& options = runner.getOptions();
+    const std::vector<Key>& keys = corpus.num.empty() ? corpus.one : corpus.num;
+    if(keys.empty())
+        return;
+    GotText::LookupCounters::Dict dict = corpus.num.empty() ? GotText::LookupCounters::One : GotText::LookupCounters::Num;
+    std::vector<GotText::Message> messages;
+    for(const Key& k : keys)
+        messages.emplace_back(dict, k.ctx, k.msgid, k.msgidPlural);
+    std::vector<size_t> order = shuffledIndexes(keys.size());
+    size_t ops = std::max<size_t>(options.batch / options.fanout, 1);
+    std::string suffix = " x" + std::to_string(options.fanout);
+
+    for(bool columnar : {false, true})
+    {
+        std::vector<GotText::GotText> objects;
+        GotText::GotText::setColumnar(columnar);
+        std::vector<std::string> names = loadFanout(options, corpus, columnar ? "fanout-columnar-" : "fanout-", objects);
+        GotText::GotText::setColumnar(false);
+        std::vector<const GotText::GotText*> pointers;
+        for(const GotText::GotText& g : objects)
+            pointers.push_back(&g);
+        std::string variant = suffix + (columnar ? " (columnar)" : "");
+
+        size_t pos = 0;
+        runner.run("fan-out loop" + variant, ops, [&](size_t ops){
+            size_t sum = 0;
+            for(size_t a=0; a<ops; a++)
+            {
+                const GotText::Message& m = messages[order[pos]];
+                int n = static_cast<int>(a % 100);
+                for(const GotText::GotText& g : objects)
+                {
+                    if(dict == GotText::LookupCounters::Num)
+                        sum += g._n(m.getMsgid(), m.getMsgidPlural(), n).size();
+                    else
+                        sum += g._(m.getMsgid()).size();
+                }
+                if(++pos == order.size())
+                    pos = 0;
+            }
+            consume(sum);
+        });
+
+        pos = 0;
+        std::vector<std::string> result;
+        runner.run("fan-out many" + variant, ops, [&](size_t ops){
+            size_t sum = 0;
+            for(size_t a=0; a<ops; a++)
+            {
+                result.clear();
+                GotText::GotText::translateMany(pointers, messages[order[pos]], static_cast<int>(a % 100), result);
+                for(const std::string& s : result)
+                    sum += s.size();
+                if(++pos == order.size())
+                    pos = 0;
+            }
+            consume(sum);
+        });
+
+        for(const std::string& name : names)
+            GotText::GotText::unload(name);
+    }
+}
+
+/*!
+ * Loads Options::fanout files from disk one by one and with GotText::loadMany().
+ * One operation is unloading and loading all files.
+ */
+static void loadManyBenchmarks(Runner& runner, const Corpus& corpus, const std::string& filename)
+{
+    const Options& options = runner.getOptions();
+    std::vector<std::string> names;
+    size_t size = 0;
+    for(size_t a=0; a<options.fanout; a++)
+    {
+        std::string locale = fanoutLocale(a);
+        size_t forms = std::max<size_t>(GotText::Plural::getInfo(locale).count, 1);
+        std::string mo = generateTaggedMo(corpus, locale, forms, std::to_string(a));
+        names.push_back(filename + ".many-" + std::to_string(a));
+        std::ofstream(names.back(), std::ofstream::binary) << mo;
+        size += mo.size();
+    }
+    std::string suffix = " x" + std::to_string(options.fanout);
+
+    runner.run("load sequential" + suffix, 1, [&](size_t ops){
+        for(size_t a=0; a<ops; a++)
+        {
+            for(const std::string& name : names)
+                GotText::GotText::unload(name);
+            for(const std::string& name : names)
+            {
+                GotText::GotText g;
+                g.load(name);
+            }
+        }
+    }, size);
+
+    runner.run("loadMany" + suffix, 1, [&](size_t ops){
+        for(size_t a=0; a<ops; a++)
+        {
+            for(const std::string& name : names)
+                GotText::GotText::unload(name);
+            GotText::GotText().loadMany(names);
+        }
+    }, size);
+
+    for(const std::string& name : names)
+    {
+        GotText::GotText::unload(name);
+        unlink(name.c_str());
+    }
+}
+
+static void loadBenchmarks(Runner& runner, const Corpus& corpus, const std::string& filename)
+{
+    size_t size = corpus.mo.size();
+
+    runner.run("load (memory)", 1, [&](size_t ops){
+        for(size_t a=0; a<ops; a++)
+        {
+            MemoryBuf buf(corpus.mo.data(), size);
+            std::istream s(&buf);
+            GotText::GotText g;
+            g.load("memory", s);
+        }
+    }, size);
+
+    GotText::GotText::setDiffReload(false);
+    runner.run("load (file)", 1, [&](size_t ops){
+        for(size_t a=0; a<ops; a++)
+        {
+            GotText::GotText g;
+            g.load(filename, true);
+        }
+    }, size);
+    GotText::GotText::setDiffReload(true);
+
+    runner.run("reload (diff, unchanged)", 1, [&](size_t ops){
+        for(size_t a=0; a<ops; a++)
+        {
+            GotText::GotText g;
+            g.load(filename, true);
+        }
+    }, size);
+
+    // each reload replaces the file with the other version, which differs in 1% of the translations
+    std::string versions[2] = {filename + ".0", filename + ".1"};
+    std::ofstream(versions[0], std::ofstream::binary) << corpus.mo;
+    std::ofstream(versions[1], std::ofstream::binary) << changeTranslations(corpus.mo, 100);
+    std::string tmpFilename = filename + ".tmp";
+    size_t version = 0;
+    for(bool diff : {true, false})
+    {
+        GotText::GotText::setDiffReload(diff);
+        runner.run(diff ? "reload (diff, 1% changed)" : "reload (full, 1% changed)", 1, [&](size_t ops){
+            for(size_t a=0; a<ops; a++)
+            {
+                version ^= 1;
+                if(link(versions[version].c_str(), tmpFilename.c_str()) || rename(tmpFilename.c_str(), filename.c_str()))
+                    perror("rename");
+                GotText::GotText g;
+                g.load(filename, true);
+            }
+        }, size);
+    }
+    GotText::GotText::setDiffReload(true);
+    rename(versions[0].c_str(), filename.c_str());
+    unlink(versions[1].c_str());
+
+    runner.run("unload + load", 1, [&](size_t ops){
+        for(size_t a=0; a<ops; a++)
+        {
+            GotText::GotText::unload(filename);
+            GotText::GotText g;
+            g.load(filename);
+        }
+    }, size);
+
+    runner.run("preload (image)", 1, [&](size_t ops){
+        for(size_t a=0; a<ops; a++)
+            GotText::GotText::preload(filename);
+    }, size);
+
+    loadManyBenchmarks(runner, corpus, filename);
+
+    GotText::GotText::unload(filename);
+    GotText::GotText loaded;
+    loaded.load(filename);
+    runner.run("load (cached)", runner.getOptions().batch, [&](size_t ops){
+        for(size_t a=0; a<ops; a++)
+        {
+            GotText::GotText g;
+            g.load(filename);
+        }
+    });
+}
+
+static void pluralBenchmarks(Runner& runner)
+{
+    static const std::vector<std::string> locales {"ru_RU", "en", "ja", "ar", "pt_BR", "sah", "xx_XX"};
+    runner.run("Plural::getInfo", runner.getOptions().batch, [&](size_t ops){
+        size_t sum = 0;
+        for(size_t a=0; a<ops; a++)
+            sum += GotText::Plural::getInfo(locales[a % locales.size()]).count;
+        consume(sum);
+    });
+
+    for(const char* locale : {"ru_RU", "ar", "ja"})
+    {
+        const GotText::Plural::Info& info = GotText::Plural::getInfo(locale);
+        runner.run(std::string("plural func (") + locale + ")", runner.getOptions().batch, [&](size_t ops){
+            size_t sum = 0;
+            for(size_t a=0; a<ops; a++)
+                sum += info.func(static_cast<int>(a));
+            consume(sum);
+        });
+    }
+}
+
+/*!
+ * Runs the benchmarks that use the file with the specified number of strings and locale.
+ */
+static bool corpusBenchmarks(Runner& runner, size_t entries, const std::string& locale)
+{
+    Corpus corpus = generateCorpus(entries, 1, locale, runner.getOptions().mix);
+    char filename[] = "/tmp/gottext-bench-XXXXXX";
+    int fd = mkstemp(filename);
+    if(fd == -1)
+    {
+        perror("mkstemp");
+        return false;
+    }
+    close(fd);
+    std::ofstream(filename, std::ofstream::binary) << corpus.mo;
+    std::string imageFilename = std::string(filename) + ".image";
+    std::ofstream(imageFilename, std::ofstream::binary) << corpus.mo;
+
+    std::string columnarName = std::string(filename) + ".columnar";
+    std::string compactName = std::string(filename) + ".compact";
+
+    runner.setCorpus(entries, locale, corpus.mo.size());
+    bool ok = true;
+    try{
+        loadBenchmarks(runner, corpus, filename);
+
+        GotText::GotText g;
+        g.load(filename);
+        lookupBenchmarks(runner, corpus, g, "");
+
+        GotText::GotText::preload(imageFilename);
+        GotText::GotText image;
+        image.load(imageFilename);
+        lookupBenchmarks(runner, corpus, image, " (image)");
+        hotBenchmarks(runner, corpus, filename);
+        hugePageBenchmarks(runner, corpus, filename);
+
+        GotText::GotText::setColumnar(true);
+        GotText::GotText columnar;
+        MemoryBuf buf(corpus.mo.data(), corpus.mo.size());
+        std::istream stream(&buf);
+        columnar.load(columnarName, stream);
+        GotText::GotText::setColumnar(false);
+        lookupBenchmarks(runner, corpus, columnar, " (columnar)");
+
+        GotText::GotText compact;
+        MemoryBuf compactBuf(corpus.mo.data(), corpus.mo.size());
+        std::istream compactStream(&compactBuf);
+        compact.load(compactName, compactStream, true);
+        lookupBenchmarks(runner, corpus, compact, " (compact)");
+        compressedBenchmarks(runner, corpus, filename);
+
+        fanoutBenchmarks(runner, corpus);
+    }catch(const GotText::Exception& e){
+        fprintf(stderr, "GotText error %d at %zu\n", static_cast<int>(e.type), e.filePos);
+        ok = false;
+    }
+
+    // free the memory before generating the next file
+    GotText::GotText::unload(filename);
+    GotText::GotText::unload(imageFilename);
+    GotText::GotText::unload(columnarName);
+    GotText::GotText::unload(compactName);
+    unlink(filename);
+    unlink(imageFilename.c_str());
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if(!parseOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if(options.memory)
+        return memoryBenchmarks(options) ? 0 : 1;
+
+    Runner runner(options);
+    runner.printHeader();
+
+    for(const std::string& locale : options.locales)
+        for(size_t entries : options.sizes)
+            if(!corpusBenchmarks(runner, entries, locale))
+                return 1;
+
+    runner.setCorpus(0, std::string(), 0);
+    pluralBenchmarks(runner);
+
+    runner.printFooter();
+    return 0;
+}
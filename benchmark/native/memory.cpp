@@ -0,0 +1,341 @@
+/*************************************************************************}
+{ memory.cpp - memory footprint benchmark                                 }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#include "memory.h"
+
+#include "gottext.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <istream>
+#include <new>
+
+#include <malloc.h>
+
+namespace Bench {
+
+    static std::atomic<bool> tracking {false};
+    static std::atomic<uint64_t> allocs {0};
+    static std::atomic<uint64_t> frees {0};
+    static std::atomic<uint64_t> allocated {0};
+    static std::atomic<int64_t> live {0};
+    static std::atomic<int64_t> peak {0};
+
+    static void onAlloc(void* p)
+    {
+        if(!p || !tracking.load(std::memory_order_relaxed))
+            return;
+        size_t size = malloc_usable_size(p);
+        allocs.fetch_add(1, std::memory_order_relaxed);
+        allocated.fetch_add(size, std::memory_order_relaxed);
+        int64_t now = live.fetch_add(size, std::memory_order_relaxed) + size;
+        int64_t prev = peak.load(std::memory_order_relaxed);
+        while(now > prev && !peak.compare_exchange_weak(prev, now, std::memory_order_relaxed));
+    }
+
+    static void onFree(void* p)
+    {
+        if(!p || !tracking.load(std::memory_order_relaxed))
+            return;
+        frees.fetch_add(1, std::memory_order_relaxed);
+        live.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+    }
+
+    void startHeapTracking()
+    {
+        allocs.store(0, std::memory_order_relaxed);
+        frees.store(0, std::memory_order_relaxed);
+        allocated.store(0, std::memory_order_relaxed);
+        live.store(0, std::memory_order_relaxed);
+        peak.store(0, std::memory_order_relaxed);
+        tracking.store(true, std::memory_order_relaxed);
+    }
+
+    HeapCounters stopHeapTracking()
+    {
+        tracking.store(false, std::memory_order_relaxed);
+        HeapCounters c;
+        c.allocs = allocs.load(std::memory_order_relaxed);
+        c.frees = frees.load(std::memory_order_relaxed);
+        c.allocated = allocated.load(std::memory_order_relaxed);
+        c.live = live.load(std::memory_order_relaxed);
+        c.peak = peak.load(std::memory_order_relaxed);
+        return c;
+    }
+
+    Rss readRss()
+    {
+        Rss rss;
+        FILE* f = fopen("/proc/self/status", "r");
+        if(!f)
+            return rss;
+        char line[256];
+        while(fgets(line, sizeof(line), f))
+        {
+            unsigned long kb;
+            if(sscanf(line, "VmRSS: %lu kB", &kb) == 1)
+                rss.current = kb * 1024;
+            else if(sscanf(line, "VmHWM: %lu kB", &kb) == 1)
+                rss.peak = kb * 1024;
+        }
+        fclose(f);
+        return rss;
+    }
+
+    bool resetPeakRss()
+    {
+        FILE* f = fopen("/proc/self/clear_refs", "w");
+        if(!f)
+            return false;
+        bool ok = fputs("5", f) >= 0;
+        return fclose(f) == 0 && ok;
+    }
+
+    /*!
+     * Memory used by one file.
+     */
+    struct MemoryResult {
+        size_t entries = 0;
+        std::string locale;
+        std::string form; /*!< "hash", "compact" (see GotText::load()) or "compressed" (see GotText::setCompressValues()). */
+        size_t moSize = 0;
+        size_t estimate = 0; /*!< Lang::calcMemoryUsage() */
+        HeapCounters load; /*!< Heap usage while loading. */
+        HeapCounters unload; /*!< Heap usage while unloading. */
+        int64_t rss = 0; /*!< RSS growth after loading. */
+        int64_t peakRss = 0; /*!< Peak RSS growth while loading. */
+        int64_t rssReturned = 0; /*!< RSS returned to the system after unloading. */
+        int64_t rssReturnedTrim = 0; /*!< RSS returned to the system after unloading and malloc_trim(). */
+    };
+
+    static MemoryResult measure(const Corpus& corpus, size_t entries, const std::string& locale, const std::string& form)
+    {
+        MemoryResult r;
+        r.entries = entries;
+        r.locale = locale;
+        r.form = form;
+        r.moSize = corpus.mo.size();
+
+        MemoryBuf buf(corpus.mo.data(), corpus.mo.size());
+        std::istream s(&buf);
+        GotText::GotText g;
+
+        malloc_trim(0);
+        resetPeakRss();
+        Rss before = readRss();
+        GotText::GotText::setCompressValues(form == "compressed");
+        startHeapTracking();
+        g.load("memory", s, form == "compact");
+        r.load = stopHeapTracking();
+        GotText::GotText::setCompressValues(false);
+        Rss loaded = readRss();
+        r.estimate = g.getLang().calcMemoryUsage();
+
+        startHeapTracking();
+        GotText::GotText::unload("memory");
+        r.unload = stopHeapTracking();
+        Rss unloaded = readRss();
+        malloc_trim(0);
+        Rss trimmed = readRss();
+
+        r.rss = static_cast<int64_t>(loaded.current) - before.current;
+        r.peakRss = static_cast<int64_t>(loaded.peak) - before.current;
+        r.rssReturned = static_cast<int64_t>(loaded.current) - unloaded.current;
+        r.rssReturnedTrim = static_cast<int64_t>(loaded.current) - trimmed.current;
+        return r;
+    }
+
+    static void printHeader(const Options& options)
+    {
+        switch(options.format)
+        {
+            case Format::Text:
+                printf("all sizes are in bytes; heap = bytes allocated by the loaded translations, "
+                    "estimate = Lang::calcMemoryUsage()\n\n");
+                printf("%10s %6s %10s %12s %10s %12s %12s %12s %12s %12s %12s %12s %12s %12s %8s %8s\n",
+                    "entries", "locale", "form", "MO size", "allocs", "allocated", "heap", "peak heap", "estimate",
+                    "RSS", "peak RSS", "RSS freed", "after trim", "heap kept", "heap/ent", "heap/MO");
+                break;
+
+            case Format::Json:
+                printf("{\n\"memory\": [");
+                break;
+
+            case Format::Csv:
+                printf("entries,locale,form,mo_size,allocs,allocated,heap,peak_heap,estimate,"
+                    "rss,peak_rss,rss_freed,rss_freed_trim,heap_kept,heap_per_entry,heap_per_mo_byte\n");
+                break;
+        }
+    }
+
+    static void print(const Options& options, const MemoryResult& r, bool first)
+    {
+        long long heapKept = r.load.live + r.unload.live;
+        double perEntry = static_cast<double>(r.load.live) / r.entries;
+        double perMo = static_cast<double>(r.load.live) / r.moSize;
+        switch(options.format)
+        {
+            case Format::Text:
+                printf("%10zu %6s %10s %12zu %10llu %12llu %12lld %12lld %12zu %12lld %12lld %12lld %12lld %12lld %8.1f %8.2f\n",
+                    r.entries, r.locale.c_str(), r.form.c_str(), r.moSize,
+                    static_cast<unsigned long long>(r.load.allocs),
+                    static_cast<unsigned long long>(r.load.allocated),
+                    static_cast<long long>(r.load.live),
+                    static_cast<long long>(r.load.peak),
+                    r.estimate,
+                    static_cast<long long>(r.rss),
+                    static_cast<long long>(r.peakRss),
+                    static_cast<long long>(r.rssReturned),
+                    static_cast<long long>(r.rssReturnedTrim),
+                    heapKept, perEntry, perMo);
+                break;
+
+            case Format::Json:
+                printf("%s\n{\"entries\": %zu, \"locale\": \"%s\", \"form\": \"%s\", \"mo_size\": %zu, \"allocs\": %llu, \"allocated\": %llu, "
+                    "\"heap\": %lld, \"peak_heap\": %lld, \"estimate\": %zu, \"rss\": %lld, \"peak_rss\": %lld, "
+                    "\"rss_freed\": %lld, \"rss_freed_trim\": %lld, \"heap_kept\": %lld, "
+                    "\"heap_per_entry\": %.1f, \"heap_per_mo_byte\": %.2f}",
+                    first ? "" : ",",
+                    r.entries, r.locale.c_str(), r.form.c_str(), r.moSize,
+                    static_cast<unsigned long long>(r.load.allocs),
+                    static_cast<unsigned long long>(r.load.allocated),
+                    static_cast<long long>(r.load.live),
+                    static_cast<long long>(r.load.peak),
+                    r.estimate,
+                    static_cast<long long>(r.rss),
+                    static_cast<long long>(r.peakRss),
+                    static_cast<long long>(r.rssReturned),
+                    static_cast<long long>(r.rssReturnedTrim),
+                    heapKept, perEntry, perMo);
+                break;
+
+            case Format::Csv:
+                printf("%zu,\"%s\",%s,%zu,%llu,%llu,%lld,%lld,%zu,%lld,%lld,%lld,%lld,%lld,%.1f,%.2f\n",
+                    r.entries, r.locale.c_str(), r.form.c_str(), r.moSize,
+                    static_cast<unsigned long long>(r.load.allocs),
+                    static_cast<unsigned long long>(r.load.allocated),
+                    static_cast<long long>(r.load.live),
+                    static_cast<long long>(r.load.peak),
+                    r.estimate,
+                    static_cast<long long>(r.rss),
+                    static_cast<long long>(r.peakRss),
+                    static_cast<long long>(r.rssReturned),
+                    static_cast<long long>(r.rssReturnedTrim),
+                    heapKept, perEntry, perMo);
+                break;
+        }
+        fflush(stdout);
+    }
+
+    bool memoryBenchmarks(const Options& options)
+    {
+        printHeader(options);
+        bool first = true;
+        for(const std::string& locale : options.locales)
+        {
+            for(size_t entries : options.sizes)
+            {
+                std::vector<MemoryResult> results;
+                {
+                    Corpus corpus = generateCorpus(entries, 1, locale, options.mix);
+                    try{
+                        for(const char* form : {"hash", "compact", "compressed"})
+                            results.push_back(measure(corpus, entries, locale, form));
+                    }catch(const GotText::Exception& e){
+                        fprintf(stderr, "GotText error %d at %zu\n", static_cast<int>(e.type), e.filePos);
+                        return false;
+                    }
+                }
+                for(const MemoryResult& r : results)
+                {
+                    print(options, r, first);
+                    first = false;
+                }
+            }
+        }
+        if(options.format == Format::Json)
+            printf("\n]\n}\n");
+        return true;
+    }
+
+}
+
+void* operator new(size_t size)
+{
+    void* p = malloc(size ? size : 1);
+    if(!p)
+        throw std::bad_alloc();
+    Bench::onAlloc(p);
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    void* p = malloc(size ? size : 1);
+    Bench::onAlloc(p);
+    return p;
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept
+{
+    Bench::onFree(p);
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    operator delete(p);
+}
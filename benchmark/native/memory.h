@@ -0,0 +1,78 @@
+/*************************************************************************}
+{ memory.h - memory footprint benchmark                                   }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include "bench.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Bench {
+
+    /*!
+     * Counters of the global operator new/delete.
+     * Sizes are the real sizes of the allocated blocks (malloc_usable_size).
+     */
+    struct HeapCounters {
+        uint64_t allocs = 0; /*!< Number of allocations. */
+        uint64_t frees = 0; /*!< Number of deallocations. */
+        uint64_t allocated = 0; /*!< Total bytes allocated. */
+        int64_t live = 0; /*!< Bytes allocated and not freed yet. */
+        int64_t peak = 0; /*!< Maximum value of *live*. */
+    };
+
+    /*!
+     * Resets the heap counters and starts counting.
+     */
+    void startHeapTracking();
+
+    /*!
+     * Stops counting and returns the counters.
+     */
+    HeapCounters stopHeapTracking();
+
+    /*!
+     * Resident set size of the process, in bytes.
+     */
+    struct Rss {
+        size_t current = 0;
+        size_t peak = 0; /*!< Since the start of the process or since the last resetPeakRss(). */
+    };
+
+    Rss readRss();
+
+    /*!
+     * Resets Rss::peak to the current RSS. Returns false if the kernel does not support it.
+     */
+    bool resetPeakRss();
+
+    /*!
+     * Loads the generated files of all sizes and locales from Options
+     * and prints the memory used by each of them.
+     * Returns false on error.
+     */
+    bool memoryBenchmarks(const Options& options);
+
+}
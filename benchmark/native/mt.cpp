@@ -0,0 +1,430 @@
+/*************************************************************************}
+{ mt.cpp - multi-threaded stress benchmark of the engine                  }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#include "bench.h"
+#include "corpus.h"
+
+#include "gottext.h"
+
+#ifdef GOTTEXT_NO_THREADSAFE
+    #error The multi-threaded benchmark needs the thread-safe build of the engine
+#endif
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace Bench;
+
+/*!
+ * Command line options.
+ */
+struct MtOptions {
+    std::vector<size_t> threads {1, 2, 4, 8, 16, 32, 64}; /*!< Numbers of reader threads to test. */
+    size_t writers = 1; /*!< Number of writer threads. */
+    size_t rate = 100; /*!< Operations per second of each writer. */
+    double duration = 1; /*!< Seconds per one number of readers. */
+    size_t entries = 10000; /*!< Number of strings in each file. */
+    size_t files = 2; /*!< Number of files the readers are spread across. */
+};
+
+static const size_t VERSIONS = 4; /*!< Number of versions of each file the writers switch between. */
+
+/*!
+ * One version of a file.
+ * The versions alternate between two locales with the same number of plural forms,
+ * but with different plural rules, so a translation picked with the plural rules
+ * of another version is detected.
+ */
+struct Version {
+    std::string mo;
+    GotText::Plural::Info plural;
+};
+
+struct Catalog {
+    std::string filename;
+    std::string tagPrefix; /*!< "<file index>." */
+    std::vector<Version> versions;
+};
+
+struct ReaderResult {
+    Histogram latency; /*!< Nanoseconds per lookup. */
+    uint64_t misses = 0; /*!< Lookups that returned the original string, i.e. while the file was unloaded. */
+    uint64_t torn = 0; /*!< Lookups that returned a string that no single version of the file has. */
+    uint64_t errors = 0;
+    std::string firstTorn;
+};
+
+struct WriterResult {
+    uint64_t reloads = 0;
+    uint64_t unloads = 0;
+    uint64_t loads = 0;
+    uint64_t errors = 0;
+};
+
+static void printUsage(const char* self)
+{
+    printf(
+        "Usage: %s [options]\n"
+        "  --threads LIST  comma-separated numbers of reader threads (default: 1,2,4,8,16,32,64)\n"
+        "  --writers N     number of writer threads (default: 1)\n"
+        "  --rate N        reloads/unloads/loads per second of each writer (default: 100)\n"
+        "  --duration S    seconds to run for each number of readers (default: 1)\n"
+        "  --entries N     number of strings in each generated MO file (default: 10000)\n"
+        "  --files N       number of MO files the readers are spread across (default: 2)\n",
+        self);
+}
+
+static bool parseOptions(int argc, char** argv, MtOptions& options)
+{
+    for(int a=1; a<argc; a++)
+    {
+        std::string arg = argv[a];
+        if(arg == "--help" || arg == "-h" || a + 1 >= argc)
+            return false;
+        std::string val = argv[++a];
+        if(arg == "--threads")
+        {
+            options.threads.clear();
+            size_t pos = 0;
+            while(pos < val.size())
+            {
+                size_t next = val.find(',', pos);
+                if(next == std::string::npos)
+                    next = val.size();
+                options.threads.push_back(std::stoul(val.substr(pos, next - pos)));
+                pos = next + 1;
+            }
+        }
+        else if(arg == "--writers")
+            options.writers = std::stoul(val);
+        else if(arg == "--rate")
+            options.rate = std::stoul(val);
+        else if(arg == "--duration")
+            options.duration = std::stod(val);
+        else if(arg == "--entries")
+            options.entries = std::stoul(val);
+        else if(arg == "--files")
+            options.files = std::stoul(val);
+        else
+            return false;
+    }
+    for(size_t n : options.threads)
+        if(!n)
+            return false;
+    return !options.threads.empty() && options.entries && options.files && options.duration > 0;
+}
+
+/*!
+ * Atomically replaces the contents of the file.
+ */
+static bool replaceFile(const std::string& filename, const std::string& data, const std::string& tmpSuffix)
+{
+    std::string tmp = filename + tmpSuffix;
+    {
+        std::ofstream f(tmp, std::ofstream::binary | std::ofstream::trunc);
+        f << data;
+        if(!f)
+            return false;
+    }
+    return rename(tmp.c_str(), filename.c_str()) == 0;
+}
+
+/*!
+ * Returns true if *s* is a translation of *key* from one of the versions of the file
+ * and the plural form matches the plural rules of that same version.
+ */
+static bool isConsistent(const std::string& s, const Catalog& cat, const Key& key, bool plural, int n)
+{
+    // "<file index>.<version>|<plural form>|<msgid>"
+    size_t p = cat.tagPrefix.size();
+    if(s.size() < p + 4 || s.compare(0, p, cat.tagPrefix) != 0 || s[p+1] != '|' || s[p+3] != '|')
+        return false;
+    size_t version = s[p] - '0';
+    if(version >= cat.versions.size())
+        return false;
+    size_t form = s[p+2] - '0';
+    size_t expected = plural ? cat.versions[version].plural.func(n) : 0;
+    return form == expected && s.compare(p + 4, std::string::npos, key.msgid) == 0;
+}
+
+static void reader(
+        const Catalog& cat,
+        const Corpus& corpus,
+        size_t seed,
+        const std::atomic<bool>& go,
+        const std::atomic<bool>& stop,
+        ReaderResult& r)
+{
+    GotText::GotText g;
+    try{
+        g.load(cat.filename);
+    }catch(const GotText::Exception& e){
+        r.errors++;
+    }
+
+    const std::vector<Key>* dicts[] = {&corpus.one, &corpus.num, &corpus.ctxOne, &corpus.ctxNum};
+    std::mt19937_64 rnd(seed);
+    while(!go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+
+    for(uint64_t a=0; !stop.load(std::memory_order_relaxed); a++)
+    {
+        size_t d = a % 4;
+        const std::vector<Key>& keys = *dicts[d];
+        if(keys.empty())
+            continue;
+        const Key& key = keys[rnd() % keys.size()];
+        int n = static_cast<int>(a % 100);
+
+        std::string s;
+        auto start = std::chrono::steady_clock::now();
+        switch(d)
+        {
+            case 0: s = g._(key.msgid); break;
+            case 1: s = g._n(key.msgid, key.msgidPlural, n); break;
+            case 2: s = g._p(key.ctx, key.msgid); break;
+            default: s = g._np(key.ctx, key.msgid, key.msgidPlural, n);
+        }
+        auto finish = std::chrono::steady_clock::now();
+        r.latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count());
+
+        if(s == key.msgid || s == key.msgidPlural)
+        {
+            // the file was unloaded, load it again like a new PHP request would do
+            r.misses++;
+            try{
+                g.load(cat.filename);
+            }catch(const GotText::Exception& e){
+                r.errors++;
+            }
+        }
+        else if(!isConsistent(s, cat, key, d % 2, n))
+        {
+            if(!r.torn++)
+                r.firstTorn = s;
+        }
+    }
+}
+
+static void writer(
+        const std::vector<Catalog>& cats,
+        size_t index,
+        const MtOptions& options,
+        const std::atomic<bool>& go,
+        const std::atomic<bool>& stop,
+        WriterResult& r)
+{
+    std::mt19937_64 rnd(1000 + index);
+    std::string tmpSuffix = ".w" + std::to_string(index);
+    auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1.0 / options.rate));
+    while(!go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+
+    auto next = std::chrono::steady_clock::now();
+    while(!stop.load(std::memory_order_relaxed))
+    {
+        next += interval;
+        std::this_thread::sleep_until(next);
+
+        const Catalog& cat = cats[rnd() % cats.size()];
+        unsigned op = rnd() % 100;
+        try{
+            if(op < 60)
+            {
+                if(!replaceFile(cat.filename, cat.versions[rnd() % cat.versions.size()].mo, tmpSuffix))
+                {
+                    r.errors++;
+                    continue;
+                }
+                GotText::GotText w;
+                w.load(cat.filename, true);
+                r.reloads++;
+            }
+            else if(op < 80)
+            {
+                GotText::GotText::unload(cat.filename);
+                r.unloads++;
+            }
+            else
+            {
+                GotText::GotText w;
+                w.load(cat.filename);
+                r.loads++;
+            }
+        }catch(const GotText::Exception& e){
+            r.errors++;
+        }
+    }
+}
+
+/*!
+ * Runs the readers and the writers for the specified time and prints the results.
+ * Returns the number of lookups per second.
+ */
+static double runPhase(
+        const std::vector<Catalog>& cats,
+        const Corpus& corpus,
+        const MtOptions& options,
+        size_t nReaders,
+        double baseline,
+        uint64_t& failures)
+{
+    for(const Catalog& cat : cats)
+    {
+        replaceFile(cat.filename, cat.versions[0].mo, ".tmp");
+        GotText::GotText::unload(cat.filename);
+        GotText::GotText g;
+        g.load(cat.filename, true);
+    }
+
+    std::atomic<bool> go {false};
+    std::atomic<bool> stop {false};
+    std::vector<ReaderResult> readerResults(nReaders);
+    std::vector<WriterResult> writerResults(options.rate ? options.writers : 0);
+    std::vector<std::thread> threads;
+    for(size_t a=0; a<readerResults.size(); a++)
+        threads.emplace_back(reader, std::cref(cats[a % cats.size()]), std::cref(corpus), a + 1,
+            std::cref(go), std::cref(stop), std::ref(readerResults[a]));
+    for(size_t a=0; a<writerResults.size(); a++)
+        threads.emplace_back(writer, std::cref(cats), a, std::cref(options),
+            std::cref(go), std::cref(stop), std::ref(writerResults[a]));
+
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+    stop.store(true, std::memory_order_relaxed);
+    auto finish = std::chrono::steady_clock::now();
+    for(std::thread& t : threads)
+        t.join();
+
+    ReaderResult readers;
+    for(const ReaderResult& r : readerResults)
+    {
+        readers.latency.merge(r.latency);
+        readers.misses += r.misses;
+        readers.errors += r.errors;
+        if(!readers.torn && r.torn)
+            readers.firstTorn = r.firstTorn;
+        readers.torn += r.torn;
+    }
+    WriterResult writers;
+    for(const WriterResult& r : writerResults)
+    {
+        writers.reloads += r.reloads;
+        writers.unloads += r.unloads;
+        writers.loads += r.loads;
+        writers.errors += r.errors;
+    }
+
+    double seconds = std::chrono::duration<double>(finish - start).count();
+    double perSecond = readers.latency.getCount() / seconds;
+    printf("%8zu %12.2f %8.2f %8llu %8llu %8llu %10llu %10llu %8llu %8llu %8llu %8llu\n",
+        nReaders,
+        perSecond / 1e6,
+        baseline > 0 ? perSecond / baseline : 1.0,
+        static_cast<unsigned long long>(readers.latency.percentile(0.5)),
+        static_cast<unsigned long long>(readers.latency.percentile(0.99)),
+        static_cast<unsigned long long>(readers.latency.percentile(0.999)),
+        static_cast<unsigned long long>(readers.latency.getMax()),
+        static_cast<unsigned long long>(readers.misses),
+        static_cast<unsigned long long>(writers.reloads),
+        static_cast<unsigned long long>(writers.unloads),
+        static_cast<unsigned long long>(writers.loads),
+        static_cast<unsigned long long>(readers.torn));
+    fflush(stdout);
+
+    if(readers.torn)
+        fprintf(stderr, "inconsistent translation: %s\n", readers.firstTorn.c_str());
+    if(readers.errors || writers.errors)
+        fprintf(stderr, "errors: %llu in readers, %llu in writers\n",
+            static_cast<unsigned long long>(readers.errors),
+            static_cast<unsigned long long>(writers.errors));
+    failures += readers.torn + readers.errors + writers.errors;
+    return perSecond;
+}
+
+int main(int argc, char** argv)
+{
+    MtOptions options;
+    if(!parseOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    Corpus corpus = generateCorpus(options.entries);
+    static const char* locales[] = {"ru_RU", "cs"};
+    std::vector<Catalog> cats(options.files);
+    for(size_t a=0; a<cats.size(); a++)
+    {
+        char filename[] = "/tmp/gottext-bench-mt-XXXXXX";
+        int fd = mkstemp(filename);
+        if(fd == -1)
+        {
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+        Catalog& cat = cats[a];
+        cat.filename = filename;
+        cat.tagPrefix = std::to_string(a) + ".";
+        for(size_t v=0; v<VERSIONS; v++)
+        {
+            const char* locale = locales[v % 2];
+            Version version;
+            version.plural = GotText::Plural::getInfo(locale);
+            version.mo = generateTaggedMo(corpus, locale, version.plural.count, cat.tagPrefix + std::to_string(v));
+            cat.versions.push_back(std::move(version));
+        }
+    }
+
+    printf("entries: %zu, files: %zu, writers: %zu x %zu ops/s, duration: %.1f s\n",
+        options.entries, options.files, options.writers, options.rate, options.duration);
+    printf("latency is in nanoseconds per lookup, including the clock overhead\n\n");
+    printf("%8s %12s %8s %8s %8s %8s %10s %10s %8s %8s %8s %8s\n",
+        "readers", "Mlookups/s", "scaling", "p50", "p99", "p999", "max", "misses", "reloads", "unloads", "loads", "torn");
+
+    uint64_t failures = 0;
+    double baseline = 0;
+    for(size_t n : options.threads)
+    {
+        double perSecond = runPhase(cats, corpus, options, n, baseline, failures);
+        if(baseline == 0)
+            baseline = perSecond;
+    }
+
+    for(const Catalog& cat : cats)
+    {
+        GotText::GotText::unload(cat.filename);
+        unlink(cat.filename.c_str());
+    }
+    return failures ? 1 : 0;
+}
@@ -36,13 +36,25 @@ class GotText {
      * then GotText will load the same file from disk twice and create two
      * different cache entries in memory.
      *
-     * GotText will never automatically reload a file from disk
+     * By default, GotText will never automatically reload a file from disk
      * even if the file is changed or even deleted.
      * To reload a file use {@see reload()}.
+     * Alternatively, set __gottext.reload_interval__ in php.ini
+     * to the number of seconds between the checks for changes.
+     * In this case the changed files will be reloaded automatically
+     * when they are loaded by a GotText constructor.
      * To unload a file from memory use {@see unload()}.
      * To see all previously loaded files use {@see getFilenames()}.
      * All these functions still only apply to a current PHP process.
      *
+     * To share the translations between PHP processes
+     * set __gottext.shared_dir__ in php.ini to a writable directory.
+     * In this case each file is compiled only once into an image inside this directory,
+     * and all processes map that image into memory read-only.
+     *
+     * Also, the files listed in __gottext.preload__ in php.ini are loaded on PHP startup,
+     * so they are shared by all forked PHP processes (e.g. PHP-FPM workers).
+     *
      * GotText can also load translations from raw binary string data.
      * Pass the data as a second parameter.
      * In this case you may specify any arbitrary string for a filename,
@@ -61,6 +73,15 @@ class GotText {
      * then __filename__ can be any arbitrary string.
      * The translations are always reloaded from this data
      * when this parameter is specified.
+     * Pass null to load the file __filename__.
+     * @param bool $compact If true, then the translations are stored in the compact form:
+     * only the strings themselves and a few bytes per translation.
+     * The lookups are binary searches, which are several times slower than the usual hash table lookups,
+     * so this is meant for the rarely used languages.
+     * The file keeps this form when it's reloaded.
+     * This parameter is ignored if the translations are already loaded,
+     * if they are shared (__gottext.shared_dir__)
+     * or if the file with the same contents is already loaded (__gottext.dedup__).
      *
      * @return void
      *
@@ -100,9 +121,12 @@ class GotText {
      *     $gotText4 = new GotText();
      * }
      * echo $gotText4->_("Hello"), "\n";
+     *
+     * // a rarely used language in the compact form
+     * $gotText5 = new GotText("./sah.mo", null, true);
      * ```
      */
-    public function __construct($filename = null, $data = null){}
+    public function __construct($filename = null, $data = null, $compact = false){}
 
     /**
      * Translates a string.
@@ -190,6 +214,83 @@ class GotText {
      */
     public function _np($msgid_ctxt, $msgid, $msgid_plural, $n){}
 
+    /**
+     * Prepares a string for repeated translation.
+     *
+     * The translation is looked up on the first call of {@see GotTextMessage::get()}
+     * and then returned by the following calls without searching the dictionaries again.
+     * The message is looked up again only after the file is reloaded or unloaded,
+     * so the result is always the same as the result of {@see _()}, {@see _n()}, {@see _p()} or {@see _np()}.
+     *
+     * @param string $msgid A string to translate.
+     * @param string|null $msgid_plural A plural form of __msgid__, null for a singular message.
+     * @param string|null $msgid_ctxt A context to look for __msgid__ in, null for no context.
+     *
+     * @return GotTextMessage The prepared message.
+     *
+     * @example
+     * ```php
+     * <?php
+     * $gotText = new GotText("./ru_RU.mo");
+     * $sites = $gotText->msg("%d site", "%d sites", "Web");
+     * foreach([1, 2, 5] as $n)
+     *     echo sprintf($sites->get($n), $n), "\n"; // "1 сайт", "2 сайта", "5 сайтов"
+     * $title = $gotText->msg("Title");
+     * echo $title; // "Название"
+     * ```
+     */
+    public function msg($msgid, $msgid_plural = null, $msgid_ctxt = null){}
+
+    /**
+     * Translates a string with several GotText objects at once.
+     *
+     * Returns the same translations as calling {@see _()}, {@see _n()}, {@see _p()} or {@see _np()}
+     * on each object, but does all lookups in a single call,
+     * which is faster when the same message is sent to the users with different languages.
+     * Each object uses the plural rules of its own language.
+     *
+     * @param GotText[] $gotTexts GotText objects.
+     * @param string $msgid A string to translate.
+     * @param string|null $msgid_plural A plural form of __msgid__, null for a singular message.
+     * @param string|null $msgid_ctxt A context to look for __msgid__ in, null for no context.
+     * @param int $n A number to choose a plural form for. Ignored for singular messages.
+     *
+     * @return string[] The translations with the same keys as in __gotTexts__.
+     *
+     * @example
+     * ```php
+     * <?php
+     * $gotTexts = ["ru" => new GotText("./ru_RU.mo"), "ja" => new GotText("./ja_JP.mo")];
+     * $texts = GotText::translateMany($gotTexts, "%d new message", "%d new messages", null, 2);
+     * // ["ru" => "%d новых сообщения", "ja" => "%d件の新着メッセージ"]
+     * ```
+     */
+    public static function translateMany($gotTexts, $msgid, $msgid_plural = null, $msgid_ctxt = null, $n = 1){}
+
+    /**
+     * Loads several MO files at once.
+     *
+     * When the extension is built with `NATIVE_FILE=1`, the files are parsed in parallel.
+     * The translations of all files become available at the same time,
+     * so other workers never see only a part of them.
+     * If any file fails to load, none of the files are loaded and an exception is thrown.
+     * The files that are already loaded are not reloaded.
+     *
+     * @param string[] $files Paths to MO files.
+     *
+     * @return GotText[] GotText objects with the same keys as in __files__.
+     *
+     * @throws Exception if any of the files cannot be loaded.
+     *
+     * @example
+     * ```php
+     * <?php
+     * $gotTexts = GotText::loadMany(["ru" => "./ru_RU.mo", "ja" => "./ja_JP.mo"]);
+     * echo $gotTexts["ru"]->_("Hello"); // "Привет"
+     * ```
+     */
+    public static function loadMany($files){}
+
     /**
      * Checks if it's a dummy GotText object.
      *
@@ -307,6 +408,10 @@ class GotText {
      * It means that each unloaded translation file will still occupy a small amount of memory
      * (less that 500 bytes)
      *
+     * However, if __gottext.memory_budget__ is set in php.ini,
+     * then the file is removed from memory completely,
+     * and the GotText objects that used it will load it again on next use.
+     *
      * This function will unload a translation file only from the current PHP process.
      * You may want to use {@see getTimeCached()} in each process
      * to check if the file needs to be unloaded in that process.
@@ -433,10 +538,89 @@ class GotText {
      */
     public function getStrings(){}
 
+    /**
+     * Returns all dictionaries as JSON.
+     *
+     * The JSON object has the same structure as the array returned by {@see getStrings()},
+     * the keys are sorted and non-ASCII characters are not escaped.
+     * The string is built on the first call and then reused by all GotText objects
+     * that refer to the same file until the file is reloaded,
+     * so it's a cheap way to pass all translations to the frontend.
+     *
+     * @return string JSON object.
+     *
+     * @example
+     * ```php
+     * <?php
+     * $gotText = new GotText("./ru_RU.mo");
+     * header("Content-Type: application/json");
+     * echo $gotText->getStringsJson();
+     * ```
+     */
+    public function getStringsJson(){}
+
+    /**
+     * Returns a part of a single dictionary.
+     *
+     * Allows reading the dictionary in pages or reading only the strings with a specific prefix or context
+     * without building the whole array like {@see getStrings()} does.
+     * The strings are sorted by the context and then by the original string,
+     * and the order does not change until the file is reloaded.
+     *
+     * @param string $dictionary Dictionary name: "singular", "plural", "singular_context" or "plural_context".
+     * @param int $offset Number of matching strings to skip.
+     * @param int $limit Maximum number of strings to return, 0 - no limit.
+     * @param string $prefix Return only the strings which original strings start with this prefix.
+     * @param string|null $context Return only the strings with this context, null - any context.
+     *                             Ignored for the dictionaries without contexts.
+     * @return array An associative array with the following fields:
+     *
+     * * __total__ - the number of all matching strings (ignoring *$offset* and *$limit*);
+     * * __strings__ - a list of the matching strings, each one is an associative array with the keys
+     *   __key__ (the original string), __value__ (the translation or an array of plural forms)
+     *   and __context__ (only for the dictionaries with contexts).
+     *
+     * @throws Exception if the dictionary name is unknown or *$offset* or *$limit* is negative.
+     *
+     * @example
+     * ```php
+     * <?php
+     * $gotText = new GotText("./ru_RU.mo");
+     * $offset = 0;
+     * do{
+     *     $page = $gotText->getStringsSlice("singular", $offset, 1000);
+     *     foreach($page["strings"] as $s)
+     *         echo "{$s['key']} => {$s['value']}\n";
+     *     $offset += 1000;
+     * }while($offset < $page["total"]);
+     *
+     * var_export($gotText->getStringsSlice("plural_context", 0, 0, "%d", "Web"));
+     * // array (
+     * //   'total' => 1,
+     * //   'strings' =>
+     * //   array (
+     * //     0 =>
+     * //     array (
+     * //       'context' => 'Web',
+     * //       'key' => '%d site',
+     * //       'value' =>
+     * //       array (
+     * //         0 => '%d сайт',
+     * //         1 => '%d сайта',
+     * //         2 => '%d сайтов',
+     * //       ),
+     * //     ),
+     * //   ),
+     * // )
+     * ```
+     */
+    public function getStringsSlice($dictionary, $offset = 0, $limit = 0, $prefix = "", $context = null){}
+
     /**
      * Return a list of filenames of all previously loaded files.
      *
-     * This list will also include filenames of all files that are currently unloaded by {@see unload()}.
+     * This list will also include filenames of all files that are currently unloaded by {@see unload()},
+     * unless __gottext.memory_budget__ is set in php.ini.
      * To check if the file is actually loaded into memory use {@see get()}.
      *
      * @return array An array of filenames. The returned filenames will be exactly the same strings that were passed to {@see __construct()}.
@@ -469,6 +653,104 @@ class GotText {
      */
     public static function getFilenames(){}
 
+    /**
+     * Returns statistics for all previously loaded files.
+     *
+     * The statistics are collected for the current PHP process only.
+     * The lookup counters are only available if GotText is built without __NO_STATS__ build flag
+     * (see {@see getInfo()}), otherwise they are always zero.
+     * In a thread-safe build the lookup counters are approximate.
+     *
+     * @return array An associative array where keys are filenames (the same as in {@see getFilenames()})
+     * and values are associative arrays with the following fields:
+     *
+     * * __locale__ - the locale code (see {@see getLocaleCode()});
+     * * __loaded__ - __FALSE__ if the file is unloaded (see {@see unload()});
+     * * __preloaded__ - __TRUE__ if the file was loaded via __gottext.preload__ setting;
+     * * __loads__ - how many times the file was loaded (including reloads);
+     * * __load_time__ - total time spent on loading the file, in seconds;
+     * * __last_load_time__ - time spent on the last load of the file, in seconds;
+     * * __bytes_read__ - total size of the loaded data, in bytes;
+     * * __memory_usage__ - approximate size of the translations in memory, in bytes;
+     * * __entries__ - the number of translations in each dictionary;
+     * * __hits__ - the number of found translations in each dictionary;
+     * * __misses__ - the number of not found translations in each dictionary.
+     *
+     * The dictionaries are the same as in {@see getStrings()}:
+     * __singular__ ({@see _()}), __plural__ ({@see _n()}),
+     * __singular_context__ ({@see _p()}) and __plural_context__ ({@see _np()}).
+     *
+     * @example
+     * ```php
+     * <?php
+     * $gotText = new GotText("./ru_RU.mo");
+     * $gotText->_("Title");
+     * $gotText->_("Unknown string");
+     * $stats = GotText::getStats();
+     * echo $stats["./ru_RU.mo"]["hits"]["singular"]; // 1
+     * echo $stats["./ru_RU.mo"]["misses"]["singular"]; // 1
+     * ```
+     */
+    public static function getStats(){}
+
+    /**
+     * Starts or stops collecting the strings that were not found.
+     *
+     * When enabled, each distinct string that was not found by {@see _()}, {@see _n()}, {@see _p()} or {@see _np()}
+     * is remembered together with its context and plural form, regardless of the file it was looked up in.
+     * Use {@see getMissing()} to retrieve the collected strings.
+     * At most 8192 distinct strings are collected, the rest are ignored.
+     * The collected strings are kept in the current PHP process only.
+     *
+     * The collecting can also be enabled on PHP startup with __gottext.collect_missing__ setting in php.ini.
+     *
+     * @param bool $enable __TRUE__ to start collecting, __FALSE__ to stop.
+     *
+     * @return void
+     */
+    public static function collectMissing($enable = true){}
+
+    /**
+     * Returns the strings that were not found.
+     *
+     * See {@see collectMissing()}.
+     *
+     * @param bool $clear If __TRUE__, then the collected strings are forgotten afterwards.
+     *
+     * @return string The strings in gettext template (POT) format, without the header.
+     * The strings are sorted by context and msgid.
+     *
+     * @example
+     * ```php
+     * <?php
+     * GotText::collectMissing();
+     * $gotText = new GotText("./ru_RU.mo");
+     * $gotText->_n("%d new message", "%d new messages", 5);
+     * echo GotText::getMissing();
+     *
+     * // the output will be
+     * // msgid "%d new message"
+     * // msgid_plural "%d new messages"
+     * // msgstr[0] ""
+     * // msgstr[1] ""
+     * ```
+     */
+    public static function getMissing($clear = false){}
+
+    /**
+     * Saves the hotness profiles of all loaded files.
+     *
+     * When __gottext.hot_profile_dir__ is set in php.ini, GotText counts a random sample
+     * of the successful lookups of each translation.
+     * This function adds the counted lookups to the profiles in that directory and resets the counters.
+     * When a file with the same contents is loaded next time (e.g. by a new PHP process),
+     * its most used translations are placed together in memory, which makes their lookups faster.
+     * Call it periodically or at the end of some requests, e.g. via register_shutdown_function().
+     *
+     * @return int The number of saved profiles. Zero if the profiling is disabled.
+     */
+    public static function saveHotProfiles(){}
+
     /**
      * Retrieves the plural form index for a given number.
      *
@@ -496,10 +778,51 @@ class GotText {
      */
     public function pluralFunc($n){}
 
+    /**
+     * Returns the time spent on each phase of loading the current file.
+     *
+     * The profile is recorded when the file is parsed, so it describes the last (re)load of the file.
+     * All values are zero for a dummy GotText object (see {@see isDummy()}),
+     * and also if the file was not parsed by the current process
+     * (e.g. it was taken from __gottext.shared_dir__).
+     *
+     * @return array An associative array with the following fields (all values are in seconds):
+     *
+     * * __header__ - reading the file header;
+     * * __tables__ - reading the string tables;
+     * * __strings__ - extracting the strings;
+     * * __plural__ - parsing the translation headers and choosing the plural rules;
+     * * __charset__ - validating the translations and converting them to UTF-8;
+     * * __dictionaries__ - building the dictionaries;
+     * * __total__ - the whole loading including the time to open the file.
+     */
+    public function getLoadProfile(){}
+
+    /**
+     * Returns the memory occupied by the current translations.
+     *
+     * The numbers are calculated from the sizes of strings and containers
+     * and do not include the overhead of the memory allocator.
+     * The __total__ value is the one used for __gottext.memory_budget__.
+     * All values are zero for a dummy GotText object (see {@see isDummy()}).
+     *
+     * @return array An associative array with the following fields (all values are in bytes):
+     *
+     * * __keys__ - the original strings;
+     * * __values__ - the translations;
+     * * __tables__ - the hash tables of the dictionaries;
+     * * __contexts__ - the context strings and their hash tables;
+     * * __image__ - the compiled translations (see __gottext.shared_dir__ and __gottext.preload__);
+     * * __other__ - everything else;
+     * * __total__ - the sum of all values above.
+     */
+    public function getMemoryUsage(){}
+
     /**
      * Returns the time the current file was cached in memory.
      *
      * Returns the timestamp the translations in the current file were last reloaded and put in memory cache.
+     * This includes the automatic reloading (see __gottext.reload_interval__ setting).
      *
      * This function will always return zero for a dummy GotText object (see {@see isDummy()}).
      *
@@ -601,7 +924,9 @@ class GotText {
      * * __boost_regex__ - __TRUE__ if Boost.Regex is used instead of built-in GCC regular expression library
      *   (__BOOST_REGEX__ build flag).
      * * __standalone__ - __TRUE__ if GotText is compiled as a standalone library
-     *   (__STANDALONE__ build flag).
+     *   (__STANDALONE__ build flag);
+     * * __stats__ - __TRUE__ if the lookup counters are available in {@see getStats()}
+     *   (__NO_STATS__ build flag turns them off).
      *
      * @example
      * ```php
@@ -619,8 +944,62 @@ class GotText {
      *   'debug' => false,
      *   'boost_regex' => true,
      *   'standalone' => true,
+     *   'stats' => true,
      * )
      * ```
      */
     public static function getInfo(){}
 }
+
+/**
+ * A string prepared for repeated translation, see {@see GotText::msg()}.
+ */
+class GotTextMessage {
+    /**
+     * Returns the translation.
+     *
+     * @param int $n A number to choose a plural form for. Ignored for singular messages.
+     *
+     * @return string The translation or the original string if no translation found.
+     */
+    public function get($n = 1){}
+
+    /**
+     * Returns the translation, same as {@see get()} without parameters.
+     *
+     * @return string The translation or the original string if no translation found.
+     */
+    public function __toString(){}
+}
+
+/**
+ * Sets the GotText object for the global translation functions of the current request.
+ *
+ * The global translation functions are only available if the extension is built with `FUNCTIONS=1`.
+ * By default they are named `__()`, `_n()`, `_p()` and `_np()`
+ * and have the same parameters as {@see GotText::_()}, {@see GotText::_n()}, {@see GotText::_p()} and {@see GotText::_np()}.
+ * They call the C++ code directly, so they are faster than a userland wrapper function.
+ * If no object is set then the functions return the original strings.
+ *
+ * The object is reset at the end of each request.
+ *
+ * @param GotText|null $gotText GotText object or null to reset it.
+ *
+ * @example
+ * ```php
+ * <?php
+ * gottext_set_default(new GotText("./ru_RU.mo"));
+ * echo __("Hello"); // "Привет"
+ * echo sprintf(_n("%d site", "%d sites", 22), 22); // "22 сайта"
+ * ```
+ */
+function gottext_set_default($gotText){}
+
+/**
+ * Returns the GotText object set by {@see gottext_set_default()}.
+ *
+ * The returned object is a new object that refers to the same translations.
+ *
+ * @return GotText|null GotText object or null if it was not set in the current request.
+ */
+function gottext_get_default(){}
@@ -0,0 +1,84 @@
+/*************************************************************************}
+{ charset.h - conversion of the translations to UTF-8                     }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace GotText {
+
+    /*!
+     * A charset of the translations in MO files (see the Content-Type header).
+     * All translations are converted to UTF-8 when a file is loaded.
+     */
+    struct Charset {
+        const char* name; /*!< The canonical name. */
+        const uint16_t* table; /*!<
+            Unicode code points of the bytes 0x80-0xFF, zero for undefined bytes.
+            nullptr for UTF-8.
+            The bytes 0x00-0x7F are always ASCII.
+        */
+
+        /*!
+         * Returns true if the strings in this charset need no conversion.
+         */
+        inline bool isUtf8() const {return !table;}
+
+        /*!
+         * Converts *s* from this charset to UTF-8 in place.
+         * For UTF-8 the string is only validated.
+         * Returns the offset of the first invalid byte (or sequence) in the original string
+         * or std::string::npos if the string is valid.
+         * On error the string is left unchanged.
+         */
+        size_t toUtf8(std::string& s) const;
+
+        /*!
+         * Returns the charset by its name or one of its aliases (case-insensitive), e.g. "KOI8-R", "cp1251".
+         * Returns nullptr if the charset is not supported.
+         */
+        static const Charset* find(const std::string& name);
+
+        /*!
+         * Returns UTF-8.
+         */
+        static const Charset& utf8();
+    };
+
+    /*!
+     * Returns the offset of the first invalid UTF-8 sequence in *len* bytes at *data*
+     * or std::string::npos if all bytes are valid UTF-8.
+     * Overlong encodings, surrogates and code points above U+10FFFF are invalid.
+     * ASCII runs are skipped 16 bytes at a time with SSE2 if available.
+     */
+    size_t findInvalidUtf8(const char* data, size_t len);
+
+    /*!
+     * Returns the length of the initial part of *len* bytes at *data* that consists of ASCII characters only.
+     */
+    size_t asciiPrefix(const char* data, size_t len);
+
+}
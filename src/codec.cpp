@@ -0,0 +1,468 @@
+/*************************************************************************}
+{ codec - compression of the translations in blocks                       }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#include "codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <queue>
+
+namespace GotText {
+
+    static const unsigned SHORT_LENS = 16; // the match lengths that are encoded without the extra bits
+    static const unsigned NUM_LIT_LENS = 256 + SHORT_LENS + 12; // literals, short lengths, lengths up to 2^16
+    static const unsigned NUM_DISTS = 32;
+    static const unsigned HASH_BITS = 15;
+    static const size_t WINDOW = 1 << 16; // the farthest match
+    static const unsigned MAX_CHAIN = 32; // the match candidates to check at each position
+
+    static inline unsigned log2(uint32_t v)
+    {
+        return 31 - __builtin_clz(v);
+    }
+
+    static inline uint32_t read32(const char* p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static inline uint32_t reverseBits(uint32_t v, unsigned len)
+    {
+        uint32_t r = 0;
+        for(unsigned a=0; a<len; a++, v >>= 1)
+            r = (r << 1) | (v & 1);
+        return r;
+    }
+
+    /*!
+     * Finds the repeated sequences in the blocks (LZ77 with hash chains).
+     */
+    class Matcher
+    {
+    public:
+        Matcher():
+            head(1 << HASH_BITS, -1),
+            prev(WINDOW, -1)
+        {
+        }
+
+        /*!
+         * Calls emit(byte, 0) for each literal and emit(length, distance) for each match
+         * found in *raw* between *start* and *end*.
+         * The matches never refer to the bytes before *start*.
+         */
+        template<typename F>
+        void parse(const std::string& raw, size_t start, size_t end, F emit)
+        {
+            const char* s = raw.data();
+            size_t pos = start;
+            while(pos < end)
+            {
+                size_t bestLen = 0;
+                size_t bestDist = 0;
+                if(pos + Codec::MIN_MATCH <= end)
+                {
+                    size_t maxLen = end - pos;
+                    if(maxLen > Codec::MAX_MATCH)
+                        maxLen = Codec::MAX_MATCH;
+                    int64_t cand = head[hash(s + pos)];
+                    for(unsigned chain=0; chain<MAX_CHAIN && cand >= static_cast<int64_t>(start); chain++)
+                    {
+                        size_t c = static_cast<size_t>(cand);
+                        if(c >= pos || pos - c >= WINDOW)
+                            break;
+                        if(s[c + bestLen] == s[pos + bestLen] && read32(s + c) == read32(s + pos))
+                        {
+                            size_t len = Codec::MIN_MATCH;
+                            while(len < maxLen && s[c + len] == s[pos + len])
+                                len++;
+                            if(len > bestLen)
+                            {
+                                bestLen = len;
+                                bestDist = pos - c;
+                                if(len == maxLen)
+                                    break;
+                            }
+                        }
+                        cand = prev[c & (WINDOW - 1)];
+                    }
+                }
+
+                if(bestLen >= Codec::MIN_MATCH)
+                {
+                    emit(bestLen, bestDist);
+                    for(size_t a=0; a<bestLen; a++, pos++)
+                        insert(s, pos, end);
+                }
+                else
+                {
+                    emit(static_cast<unsigned char>(s[pos]), 0);
+                    insert(s, pos, end);
+                    pos++;
+                }
+            }
+        }
+
+    protected:
+        std::vector<int32_t> head; // the last position with the hash
+        std::vector<int32_t> prev; // the previous position with the same hash, indexed by the position modulo WINDOW
+
+        static inline uint32_t hash(const char* p)
+        {
+            return (read32(p) * 2654435761u) >> (32 - HASH_BITS);
+        }
+
+        inline void insert(const char* s, size_t pos, size_t end)
+        {
+            if(pos + Codec::MIN_MATCH > end)
+                return;
+            uint32_t h = hash(s + pos);
+            prev[pos & (WINDOW - 1)] = head[h];
+            head[h] = static_cast<int32_t>(pos);
+        }
+    };
+
+    /*!
+     * Symbol of the match length *len*, the value of the extra bits goes to *extra* and their number to *nExtra*.
+     */
+    static inline unsigned lengthSymbol(size_t len, uint32_t& extra, unsigned& nExtra)
+    {
+        uint32_t v = static_cast<uint32_t>(len - Codec::MIN_MATCH);
+        if(v < SHORT_LENS)
+        {
+            nExtra = 0;
+            return 256 + v;
+        }
+        nExtra = log2(v);
+        extra = v - (1u << nExtra);
+        return 256 + SHORT_LENS + nExtra - 4;
+    }
+
+    /*!
+     * Symbol of the match distance *dist*, see lengthSymbol().
+     */
+    static inline unsigned distSymbol(size_t dist, uint32_t& extra, unsigned& nExtra)
+    {
+        nExtra = log2(static_cast<uint32_t>(dist));
+        extra = static_cast<uint32_t>(dist) - (1u << nExtra);
+        return nExtra;
+    }
+
+    /*!
+     * Returns the lengths of the Huffman codes (at most *limit* bits) of the symbols with the frequencies *freqs*.
+     * The unused symbols get zero length.
+     */
+    static std::vector<uint8_t> buildLengths(const std::vector<uint32_t>& freqs, unsigned limit)
+    {
+        std::vector<uint8_t> lens(freqs.size(), 0);
+        std::vector<unsigned> used;
+        for(unsigned a=0; a<freqs.size(); a++)
+            if(freqs[a])
+                used.push_back(a);
+        if(used.empty())
+            return lens;
+        if(used.size() == 1)
+        {
+            lens[used[0]] = 1;
+            return lens;
+        }
+
+        // the regular Huffman tree, the leaves are 0..n-1
+        size_t n = used.size();
+        std::vector<uint64_t> weights;
+        std::vector<size_t> parents(2*n - 1, 0);
+        for(unsigned s : used)
+            weights.push_back(freqs[s]);
+        typedef std::pair<uint64_t, size_t> Node;
+        std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+        for(size_t a=0; a<n; a++)
+            queue.emplace(weights[a], a);
+        for(size_t next=n; queue.size() > 1; next++)
+        {
+            Node x = queue.top();
+            queue.pop();
+            Node y = queue.top();
+            queue.pop();
+            parents[x.second] = next;
+            parents[y.second] = next;
+            queue.emplace(x.first + y.first, next);
+        }
+        size_t root = 2*n - 2;
+        std::vector<unsigned> depths(2*n - 1, 0);
+        for(size_t a=root; a--;)
+            depths[a] = depths[parents[a]] + 1;
+
+        // the codes longer than the limit are shortened,
+        // then the shorter codes are made longer until the lengths are valid again
+        std::vector<size_t> counts(limit + 1, 0);
+        for(size_t a=0; a<n; a++)
+            counts[std::min(depths[a], limit)]++;
+        uint64_t total = 0;
+        for(unsigned len=1; len<=limit; len++)
+            total += static_cast<uint64_t>(counts[len]) << (limit - len);
+        while(total > (1ull << limit))
+        {
+            counts[limit]--;
+            for(unsigned len=limit-1; len>0; len--)
+            {
+                if(counts[len])
+                {
+                    counts[len]--;
+                    counts[len + 1] += 2;
+                    break;
+                }
+            }
+            total--;
+        }
+
+        // the most frequent symbols get the shortest codes
+        std::stable_sort(used.begin(), used.end(), [&freqs](unsigned a, unsigned b){
+            return freqs[a] > freqs[b];
+        });
+        size_t i = 0;
+        for(unsigned len=1; len<=limit; len++)
+            for(size_t a=0; a<counts[len]; a++)
+                lens[used[i++]] = static_cast<uint8_t>(len);
+        return lens;
+    }
+
+    /*!
+     * Returns the canonical codes for the code lengths *lens*, with the bits reversed,
+     * because the bits are written starting from the lowest one.
+     */
+    static std::vector<uint16_t> buildCodes(const std::vector<uint8_t>& lens)
+    {
+        uint32_t counts[Codec::MAX_CODE_LEN + 1] {};
+        for(uint8_t len : lens)
+            counts[len]++;
+        counts[0] = 0;
+        uint32_t next[Codec::MAX_CODE_LEN + 1] {};
+        uint32_t code = 0;
+        for(unsigned len=1; len<=Codec::MAX_CODE_LEN; len++)
+        {
+            code = (code + counts[len - 1]) << 1;
+            next[len] = code;
+        }
+        std::vector<uint16_t> codes(lens.size(), 0);
+        for(size_t a=0; a<lens.size(); a++)
+            if(lens[a])
+                codes[a] = static_cast<uint16_t>(reverseBits(next[lens[a]]++, lens[a]));
+        return codes;
+    }
+
+    static std::vector<uint16_t> buildTable(const std::vector<uint8_t>& lens, const std::vector<uint16_t>& codes)
+    {
+        std::vector<uint16_t> table(1 << Codec::MAX_CODE_LEN, 0);
+        for(size_t a=0; a<lens.size(); a++)
+        {
+            if(!lens[a])
+                continue;
+            uint16_t entry = static_cast<uint16_t>((a << 4) | lens[a]);
+            for(size_t i=codes[a]; i<table.size(); i += static_cast<size_t>(1) << lens[a])
+                table[i] = entry;
+        }
+        return table;
+    }
+
+    /*!
+     * Writes the bits starting from the lowest one.
+     */
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::string& out): out(out) {}
+
+        inline void put(uint32_t value, unsigned len)
+        {
+            bits |= static_cast<uint64_t>(value) << n;
+            n += len;
+            while(n >= 8)
+            {
+                out.push_back(static_cast<char>(bits & 0xff));
+                bits >>= 8;
+                n -= 8;
+            }
+        }
+
+        inline void flush()
+        {
+            if(n)
+                out.push_back(static_cast<char>(bits & 0xff));
+            bits = 0;
+            n = 0;
+        }
+
+    protected:
+        std::string& out;
+        uint64_t bits = 0;
+        unsigned n = 0;
+    };
+
+    void Codec::compress(const std::string &raw, const std::vector<uint32_t> &starts, std::string &packed, std::vector<uint32_t> &packedStarts)
+    {
+        auto blockEnd = [&](size_t n) -> size_t {
+            return n + 1 < starts.size() ? starts[n + 1] : raw.size();
+        };
+
+        // the blocks are parsed twice instead of keeping all matches in memory:
+        // first to count the symbols, then to write them
+        std::vector<uint32_t> litLenFreqs(NUM_LIT_LENS, 0);
+        std::vector<uint32_t> distFreqs(NUM_DISTS, 0);
+        {
+            Matcher matcher;
+            for(size_t n=0; n<starts.size(); n++)
+            {
+                matcher.parse(raw, starts[n], blockEnd(n), [&](size_t len, size_t dist){
+                    uint32_t extra;
+                    unsigned nExtra;
+                    if(!dist)
+                    {
+                        litLenFreqs[len]++;
+                        return;
+                    }
+                    litLenFreqs[lengthSymbol(len, extra, nExtra)]++;
+                    distFreqs[distSymbol(dist, extra, nExtra)]++;
+                });
+            }
+        }
+
+        std::vector<uint8_t> litLenLens = buildLengths(litLenFreqs, MAX_CODE_LEN);
+        std::vector<uint8_t> distLens = buildLengths(distFreqs, MAX_CODE_LEN);
+        std::vector<uint16_t> litLenCodes = buildCodes(litLenLens);
+        std::vector<uint16_t> distCodes = buildCodes(distLens);
+        litLens = buildTable(litLenLens, litLenCodes);
+        dists = buildTable(distLens, distCodes);
+
+        Matcher matcher;
+        BitWriter writer(packed);
+        for(size_t n=0; n<starts.size(); n++)
+        {
+            packedStarts.push_back(static_cast<uint32_t>(packed.size()));
+            matcher.parse(raw, starts[n], blockEnd(n), [&](size_t len, size_t dist){
+                uint32_t extra;
+                unsigned nExtra;
+                if(!dist)
+                {
+                    writer.put(litLenCodes[len], litLenLens[len]);
+                    return;
+                }
+                unsigned s = lengthSymbol(len, extra, nExtra);
+                writer.put(litLenCodes[s], litLenLens[s]);
+                if(nExtra)
+                    writer.put(extra, nExtra);
+                s = distSymbol(dist, extra, nExtra);
+                writer.put(distCodes[s], distLens[s]);
+                if(nExtra)
+                    writer.put(extra, nExtra);
+            });
+            writer.flush();
+        }
+    }
+
+    void Codec::decompress(const char *src, size_t srcSize, char *dst, size_t rawSize) const
+    {
+        const char* p = src;
+        const char* end = src + srcSize;
+        uint64_t bits = 0;
+        unsigned n = 0;
+        // at least 56 bits are available after this, which is enough for a match
+        auto refill = [&]{
+            if(end - p >= 8)
+            {
+                uint64_t v;
+                memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                v = __builtin_bswap64(v);
+#endif
+                bits |= v << n;
+                p += (63 - n) >> 3;
+                n |= 56;
+                return;
+            }
+            while(n <= 56)
+            {
+                bits |= static_cast<uint64_t>(p < end ? static_cast<unsigned char>(*p++) : 0) << n;
+                n += 8;
+            }
+        };
+        auto take = [&](unsigned len) -> uint32_t {
+            uint32_t v = static_cast<uint32_t>(bits & ((1ull << len) - 1));
+            bits >>= len;
+            n -= len;
+            return v;
+        };
+        const uint32_t mask = (1u << MAX_CODE_LEN) - 1;
+        const uint16_t* litLenTable = litLens.data();
+        const uint16_t* distTable = dists.data();
+
+        char* out = dst;
+        char* outEnd = dst + rawSize;
+        while(out < outEnd)
+        {
+            // a few literals are decoded after each refill
+            if(n < 2*MAX_CODE_LEN)
+                refill();
+            uint16_t e = litLenTable[bits & mask];
+            take(e & 15);
+            unsigned s = e >> 4;
+            if(s < 256)
+            {
+                *out++ = static_cast<char>(s);
+                continue;
+            }
+
+            refill();
+            size_t len = MIN_MATCH;
+            if(s < 256 + SHORT_LENS)
+            {
+                len += s - 256;
+            }
+            else
+            {
+                unsigned nExtra = s - 256 - SHORT_LENS + 4;
+                len += (1u << nExtra) + take(nExtra);
+            }
+            e = distTable[bits & mask];
+            take(e & 15);
+            unsigned nExtra = e >> 4;
+            size_t dist = (1u << nExtra) + take(nExtra);
+
+            len = std::min<size_t>(len, outEnd - out);
+            // the match may overlap the bytes that are being written
+            const char* from = out - dist;
+            for(size_t a=0; a<len; a++)
+                out[a] = from[a];
+            out += len;
+        }
+    }
+
+    size_t Codec::calcMemoryUsage() const
+    {
+        return (litLens.capacity() + dists.capacity()) * sizeof(Table::value_type);
+    }
+
+}
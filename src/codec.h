@@ -0,0 +1,79 @@
+/*************************************************************************}
+{ codec - compression of the translations in blocks                       }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace GotText {
+
+    /*!
+     * Compresses the blocks of text with LZ77 and Huffman codes (like Deflate).
+     * The blocks are small so they can be decompressed quickly one at a time,
+     * therefore all blocks share the same code tables instead of storing their own.
+     * The compressed data is always produced by this class itself, so it's not validated.
+     */
+    class Codec
+    {
+    public:
+        static const size_t MIN_MATCH = 4; /*!< The shortest repeated sequence that is encoded as a match. */
+        static const size_t MAX_MATCH = 0xffff + MIN_MATCH; /*!< The longest match. */
+        static const unsigned MAX_CODE_LEN = 11; /*!< The longest Huffman code, also the number of bits of the lookup tables. */
+
+        /*!
+         * Compresses the blocks of *raw*, the block n takes the bytes from *starts[n]* to *starts[n+1]*
+         * (or to the end of *raw* for the last block).
+         * Appends the compressed blocks to *packed*, and their starting offsets in *packed* to *packedStarts*.
+         * The code tables of this object are built for these blocks,
+         * so this function MUST be called only once.
+         */
+        void compress(const std::string& raw, const std::vector<uint32_t>& starts,
+                      std::string& packed, std::vector<uint32_t>& packedStarts);
+
+        /*!
+         * Decompresses the block *src* (*srcSize* bytes) that was compressed by compress()
+         * into *dst*, which must have the room for exactly *rawSize* bytes.
+         */
+        void decompress(const char* src, size_t srcSize, char* dst, size_t rawSize) const;
+
+        /*!
+         * Returns the number of bytes occupied by the code tables.
+         */
+        size_t calcMemoryUsage() const;
+
+    protected:
+        /*!
+         * A decoding table of a Huffman code.
+         * The index is the next MAX_CODE_LEN bits of the input (the first bit is the lowest),
+         * the value is the symbol in the higher bits and the code length in the lowest four bits.
+         */
+        typedef std::vector<uint16_t> Table;
+
+        Table litLens; /*!< The literal bytes and the lengths of the matches. */
+        Table dists; /*!< The distances of the matches. */
+    };
+
+}
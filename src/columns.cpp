@@ -0,0 +1,261 @@
+/*************************************************************************}
+{ columns.cpp - translations indexed by global message ids                }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#include "columns.h"
+#include "gottext.h"
+#include "memusage.h"
+
+namespace GotText {
+
+    uint32_t MessageIds::find(LookupCounters::Dict d, const std::string &ctx, const std::string &key) const
+    {
+        const Ids* ids;
+        switch(d)
+        {
+            case LookupCounters::One:
+                ids = &one;
+                break;
+
+            case LookupCounters::Num:
+                ids = &num;
+                break;
+
+            case LookupCounters::CtxOne:
+            case LookupCounters::CtxNum:
+            {
+                const CtxIds& ctxIds = d == LookupCounters::CtxOne ? ctxOne : ctxNum;
+                auto ic = ctxIds.find(ctx);
+                if(ic == ctxIds.end())
+                    return NONE;
+                ids = &(*ic).second;
+                break;
+            }
+
+            default:
+                return NONE;
+        }
+        auto i = ids->find(key);
+        return i == ids->end() ? NONE : (*i).second;
+    }
+
+    uint32_t MessageIds::add(LookupCounters::Dict d, const std::string &ctx, const std::string &key)
+    {
+        Ids* ids;
+        const std::string* ctxPtr = nullptr;
+        switch(d)
+        {
+            case LookupCounters::One:
+                ids = &one;
+                break;
+
+            case LookupCounters::Num:
+                ids = &num;
+                break;
+
+            default:
+            {
+                CtxIds& ctxIds = d == LookupCounters::CtxOne ? ctxOne : ctxNum;
+                auto ic = ctxIds.emplace(ctx, Ids()).first;
+                ctxPtr = &(*ic).first;
+                ids = &(*ic).second;
+                break;
+            }
+        }
+        uint32_t id = freeIds.empty() ? static_cast<uint32_t>(keys.size()) : freeIds.back();
+        auto r = ids->emplace(key, id);
+        if(r.second)
+        {
+            Key k {d, ctxPtr, &(*r.first).first};
+            if(id == keys.size())
+            {
+                keys.push_back(k);
+                refs.push_back(0);
+            }
+            else
+            {
+                keys[id] = k;
+                freeIds.pop_back();
+            }
+        }
+        id = (*r.first).second;
+        refs[id]++;
+        return id;
+    }
+
+    void MessageIds::release(uint32_t id)
+    {
+        if(--refs[id])
+            return;
+        const Key& k = keys[id];
+        if(k.dict == LookupCounters::One || k.dict == LookupCounters::Num)
+        {
+            Ids& ids = k.dict == LookupCounters::One ? one : num;
+            ids.erase(ids.find(*k.key));
+        }
+        else
+        {
+            CtxIds& ctxIds = k.dict == LookupCounters::CtxOne ? ctxOne : ctxNum;
+            auto ic = ctxIds.find(*k.ctx);
+            (*ic).second.erase((*ic).second.find(*k.key));
+            if((*ic).second.empty())
+                ctxIds.erase(ic);
+        }
+        keys[id] = Key {LookupCounters::One, nullptr, nullptr};
+        freeIds.push_back(id);
+    }
+
+    template<typename T>
+    static void idsMemoryUsage(const std::unordered_map<std::string, T>& ids, MemoryUsage& m)
+    {
+        m.tables += tableMemoryUsage(ids) + ids.size() * sizeof(T);
+        for(const auto& i : ids)
+            m.keys += strMemoryUsage(i.first);
+    }
+
+    MemoryUsage MessageIds::calcMemoryBreakdown() const
+    {
+        MemoryUsage m;
+        m.other = sizeof(*this);
+        m.tables += keys.capacity() * sizeof(Key)
+            + (refs.capacity() + freeIds.capacity()) * sizeof(uint32_t);
+        idsMemoryUsage(one, m);
+        idsMemoryUsage(num, m);
+        for(const CtxIds* ctxIds : {&ctxOne, &ctxNum})
+        {
+            m.contexts += tableMemoryUsage(*ctxIds);
+            for(const auto& i : *ctxIds)
+            {
+                m.contexts += strMemoryUsage(i.first) + sizeof(i.second);
+                idsMemoryUsage(i.second, m);
+            }
+        }
+        return m;
+    }
+
+    std::shared_ptr<const Columns> Columns::build(Lang &lang, MessageIds &ids)
+    {
+        std::shared_ptr<Columns> columns = std::make_shared<Columns>();
+        columns->ids = &ids;
+        auto put = [&](uint32_t id, const Slot& slot){
+            if(id >= columns->slots.size())
+                columns->slots.resize(id + 1);
+            columns->slots[id] = slot;
+        };
+
+        auto addOne = [&](LookupCounters::Dict d, const std::string& ctx, DictOne& dict){
+            for(auto& i : dict)
+            {
+                Slot slot;
+                slot.first = static_cast<uint32_t>(columns->values.size());
+                slot.count = 1;
+                columns->values.push_back(std::move(i.second));
+                put(ids.add(d, ctx, i.first), slot);
+            }
+            columns->counts[d] += dict.size();
+        };
+
+        auto addNum = [&](LookupCounters::Dict d, const std::string& ctx, DictNum& dict){
+            for(auto& i : dict)
+            {
+                // an empty slot means no translation, so its id would never be released
+                if(i.second.empty())
+                    continue;
+                Slot slot;
+                slot.first = static_cast<uint32_t>(columns->values.size());
+                slot.count = static_cast<uint32_t>(i.second.size());
+                for(std::string& form : i.second)
+                    columns->values.push_back(std::move(form));
+                put(ids.add(d, ctx, i.first), slot);
+            }
+            columns->counts[d] += dict.size();
+        };
+
+        addOne(LookupCounters::One, std::string(), lang.dictOne);
+        addNum(LookupCounters::Num, std::string(), lang.dictNum);
+        for(auto& i : lang.dictCtxOne)
+            addOne(LookupCounters::CtxOne, i.first, i.second);
+        for(auto& i : lang.dictCtxNum)
+            addNum(LookupCounters::CtxNum, i.first, i.second);
+
+        columns->slots.shrink_to_fit();
+        columns->values.shrink_to_fit();
+
+        DictOne().swap(lang.dictOne);
+        DictNum().swap(lang.dictNum);
+        DictCtxOne().swap(lang.dictCtxOne);
+        DictCtxNum().swap(lang.dictCtxNum);
+        return columns;
+    }
+
+    void Columns::release(MessageIds &ids) const
+    {
+        for(uint32_t id=0; id<slots.size(); id++)
+        {
+            if(slots[id].count)
+                ids.release(id);
+        }
+    }
+
+    void Columns::unpack(Lang &lang) const
+    {
+        for(uint32_t id=0; id<slots.size(); id++)
+        {
+            const Slot& slot = slots[id];
+            if(!slot.count)
+                continue;
+            const MessageIds::Key& k = ids->getKey(id);
+            switch(k.dict)
+            {
+                case LookupCounters::One:
+                    lang.dictOne.emplace(*k.key, getValue(slot));
+                    break;
+
+                case LookupCounters::Num:
+                    lang.dictNum.emplace(*k.key, std::vector<std::string>(
+                        values.begin() + slot.first, values.begin() + slot.first + slot.count));
+                    break;
+
+                case LookupCounters::CtxOne:
+                    lang.dictCtxOne[*k.ctx].emplace(*k.key, getValue(slot));
+                    break;
+
+                case LookupCounters::CtxNum:
+                    lang.dictCtxNum[*k.ctx].emplace(*k.key, std::vector<std::string>(
+                        values.begin() + slot.first, values.begin() + slot.first + slot.count));
+                    break;
+
+                default:
+                    break;
+            }
+        }
+    }
+
+    void Columns::calcMemoryBreakdown(MemoryUsage &m) const
+    {
+        m.values += strMemoryUsage(values);
+        m.tables += sizeof(slots) + slots.capacity() * sizeof(Slot);
+        m.other += sizeof(*this);
+    }
+
+}
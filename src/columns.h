@@ -0,0 +1,186 @@
+/*************************************************************************}
+{ columns.h - translations indexed by global message ids                  }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "stats.h"
+
+namespace GotText {
+
+    struct Lang;
+    struct MemoryUsage;
+
+    /*!
+     * Global ids of the original strings of all translations stored in the columnar form
+     * (see GotText::setColumnar()).
+     * Each original string (with its context and dictionary) is stored once
+     * no matter how many files translate it.
+     * Each id is referenced by the Columns that translate the string.
+     * When the last of them is released (see Columns::release()), the string is removed
+     * and its id is reused by the next new string, so the ids stay as dense as the live strings.
+     * Modified under GOTTEXT_WRITE_LOCK, read under GOTTEXT_READ_LOCK.
+     */
+    class MessageIds
+    {
+    public:
+        static const uint32_t NONE = UINT32_MAX; /*!< Returned by find() if there's no such string. */
+
+        /*!
+         * An original string.
+         */
+        struct Key {
+            LookupCounters::Dict dict;
+            const std::string* ctx; /*!< nullptr for LookupCounters::One and LookupCounters::Num. */
+            const std::string* key;
+        };
+
+        /*!
+         * Returns the id of the original string *key* with the context *ctx* in the dictionary *d*
+         * or NONE if there's no such string.
+         * The context is ignored for LookupCounters::One and LookupCounters::Num.
+         */
+        uint32_t find(LookupCounters::Dict d, const std::string& ctx, const std::string& key) const;
+
+        /*!
+         * Same as find(), but assigns a new id if there's no such string.
+         * Adds a reference to the id, see release().
+         */
+        uint32_t add(LookupCounters::Dict d, const std::string& ctx, const std::string& key);
+
+        /*!
+         * Removes a reference added by add().
+         * The string is removed when no references are left, and its id becomes free.
+         */
+        void release(uint32_t id);
+
+        inline const Key& getKey(uint32_t id) const {return keys[id];}
+
+        /*!
+         * Returns the number of ids including the free ones.
+         */
+        inline size_t size() const {return keys.size();}
+
+        /*!
+         * Returns the number of bytes occupied by the ids and the original strings.
+         */
+        MemoryUsage calcMemoryBreakdown() const;
+
+    protected:
+        using Ids = std::unordered_map<std::string, uint32_t>;
+        using CtxIds = std::unordered_map<std::string, Ids>;
+
+        Ids one;
+        Ids num;
+        CtxIds ctxOne;
+        CtxIds ctxNum;
+        std::vector<Key> keys; /*!< Points to the keys of the maps above. */
+        std::vector<uint32_t> refs; /*!< Number of references to each id, zero for the free ids. */
+        std::vector<uint32_t> freeIds; /*!< The ids to reuse. */
+    };
+
+    /*!
+     * Translations of a single file indexed by MessageIds.
+     * The original strings are not stored here,
+     * so the memory for them is shared by all files.
+     */
+    class Columns
+    {
+    public:
+        /*!
+         * The translations of a single original string.
+         */
+        struct Slot {
+            uint32_t first = 0; /*!< Index of the first translation in *values*. */
+            uint32_t count = 0; /*!< Number of plural forms, 1 for singular strings, 0 if there's no translation. */
+        };
+
+        /*!
+         * Moves all translations from the dictionaries of *lang* into the columns
+         * and assigns the ids to the original strings.
+         * The dictionaries of *lang* are emptied.
+         * MUST be called under GOTTEXT_WRITE_LOCK.
+         */
+        static std::shared_ptr<const Columns> build(Lang& lang, MessageIds& ids);
+
+        /*!
+         * Releases the ids of all translated strings, see MessageIds::release().
+         * MUST be called under GOTTEXT_WRITE_LOCK when no translations use the columns anymore,
+         * the columns must not be used after that, since their ids may be given to other strings.
+         */
+        void release(MessageIds& ids) const;
+
+        /*!
+         * Returns the translations of the string with the *id*
+         * or nullptr if this file has no translation for it.
+         */
+        inline const Slot* get(uint32_t id) const {
+            return id < slots.size() && slots[id].count ? &slots[id] : nullptr;
+        }
+
+        /*!
+         * Finds the translations of the original string *key* with the context *ctx*.
+         * See MessageIds::find().
+         */
+        inline const Slot* find(LookupCounters::Dict d, const std::string& ctx, const std::string& key) const {
+            return get(ids->find(d, ctx, key));
+        }
+
+        /*!
+         * Returns the translation from the *slot*.
+         * *form* is a plural form index for LookupCounters::Num and LookupCounters::CtxNum strings.
+         */
+        inline const std::string& getValue(const Slot& slot, size_t form = 0) const {
+            return values[slot.first + form];
+        }
+
+        /*!
+         * Returns the number of translations in the dictionary *d*.
+         */
+        inline size_t countEntries(LookupCounters::Dict d) const {return counts[d];}
+
+        /*!
+         * Fills the dictionaries of *lang* with all translations.
+         */
+        void unpack(Lang& lang) const;
+
+        /*!
+         * Adds the number of bytes occupied by the translations and the slots to *m*.
+         * The memory of MessageIds is not included.
+         */
+        void calcMemoryBreakdown(MemoryUsage& m) const;
+
+    protected:
+        const MessageIds* ids = nullptr;
+        std::vector<Slot> slots; /*!< Indexed by MessageIds ids. */
+        std::vector<std::string> values; /*!< All translations, plural forms go one after another. */
+        size_t counts[LookupCounters::DictCount] {}; /*!< see countEntries() */
+    };
+
+}
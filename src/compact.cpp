@@ -0,0 +1,403 @@
+/*************************************************************************}
+{ compact.cpp - translations in the sorted MO string tables               }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#include "compact.h"
+#include "gottext.h"
+#include "memusage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <unordered_map>
+
+namespace GotText {
+
+    static const std::string ctxSeparator(1, '\4');
+    static thread_local bool requested = false;
+    static std::atomic<bool> compressValues(false);
+    static std::atomic<size_t> blockCacheSize(64);
+    static std::atomic<uint64_t> nextId(1);
+
+    /*!
+     * The decompressed blocks of the current thread, see Compact::setBlockCacheSize().
+     */
+    struct BlockCache {
+        struct Block {
+            uint64_t owner = 0; /*!< Compact::id */
+            size_t n = 0; /*!< Index of the block in Compact::blocks. */
+            uint64_t used = 0; /*!< The value of *clock* at the last access. */
+            std::string data;
+        };
+
+        std::vector<Block> blocks;
+        uint64_t clock = 0;
+
+        static BlockCache& get()
+        {
+            static thread_local BlockCache cache;
+            return cache;
+        }
+    };
+
+    bool Compact::isRequested()
+    {
+        return requested || compressValues.load(std::memory_order_relaxed);
+    }
+
+    void Compact::setCompressValues(bool compress)
+    {
+        compressValues.store(compress, std::memory_order_relaxed);
+    }
+
+    bool Compact::isCompressValues()
+    {
+        return compressValues.load(std::memory_order_relaxed);
+    }
+
+    void Compact::setBlockCacheSize(size_t blocks)
+    {
+        blockCacheSize.store(blocks, std::memory_order_relaxed);
+    }
+
+    size_t Compact::getBlockCacheSize()
+    {
+        return blockCacheSize.load(std::memory_order_relaxed);
+    }
+
+    void Compact::clearBlockCache()
+    {
+        std::vector<BlockCache::Block>().swap(BlockCache::get().blocks);
+    }
+
+    Compact::Use::Use(bool compact):
+        prev(requested)
+    {
+        requested = compact;
+    }
+
+    Compact::Use::~Use()
+    {
+        requested = prev;
+    }
+
+    void Compact::add(const std::string &key, bool plural, const std::vector<std::string> &forms, uint64_t hits)
+    {
+        Entry e;
+        e.offset = static_cast<uint32_t>(data.size());
+        if(hits)
+            hot.emplace_back(e.offset, hits);
+        e.keyLen = static_cast<uint32_t>(key.size()) | (plural ? PLURAL : 0);
+        data.append(key);
+        for(size_t a=0; a<forms.size(); a++)
+        {
+            if(a)
+                data.push_back('\0');
+            data.append(forms[a]);
+        }
+        e.valueLen = static_cast<uint32_t>(data.size() - e.offset - key.size());
+        entries.push_back(e);
+    }
+
+    /*!
+     * Puts the *sorted* entries into *result* in the Eytzinger order,
+     * starting from the entry *k* of the tree.
+     * *next* is the index of the next sorted entry.
+     */
+    template<typename T>
+    static void layOut(const std::vector<T>& sorted, std::vector<T>& result, size_t k, size_t& next)
+    {
+        if(k >= result.size())
+            return;
+        layOut(sorted, result, 2*k + 1, next);
+        result[k] = sorted[next++];
+        layOut(sorted, result, 2*k + 2, next);
+    }
+
+    void Compact::finish(bool compress)
+    {
+        auto less = [this](const Entry& a, const Entry& b){
+            int c = data.compare(a.offset, a.getKeyLen(), data, b.offset, b.getKeyLen());
+            return c ? c < 0 : a.isPlural() < b.isPlural();
+        };
+        auto same = [this](const Entry& a, const Entry& b){
+            return a.keyLen == b.keyLen && !data.compare(a.offset, a.getKeyLen(), data, b.offset, b.getKeyLen());
+        };
+        // the entries are added in the file order, so the first translation of the same string stays first
+        std::stable_sort(entries.begin(), entries.end(), less);
+        entries.erase(std::unique(entries.begin(), entries.end(), same), entries.end());
+
+        for(const Entry& e : entries)
+        {
+            bool hasCtx = memchr(data.data() + e.offset, '\4', e.getKeyLen()) != nullptr;
+            if(hasCtx)
+                counts[e.isPlural() ? LookupCounters::CtxNum : LookupCounters::CtxOne]++;
+            else
+                counts[e.isPlural() ? LookupCounters::Num : LookupCounters::One]++;
+        }
+
+        if(compress)
+            this->compress();
+        std::vector<std::pair<uint32_t, uint64_t>>().swap(hot);
+
+        std::vector<Entry> tree(entries.size());
+        size_t next = 0;
+        layOut(entries, tree, 0, next);
+        entries.swap(tree);
+        if(!values.empty())
+        {
+            std::vector<uint32_t> valueTree(values.size());
+            next = 0;
+            layOut(values, valueTree, 0, next);
+            values.swap(valueTree);
+        }
+        data.shrink_to_fit();
+    }
+
+    void Compact::compress()
+    {
+        // the hot translations go first, the most used first;
+        // the rest are in the sorted order, because the neighbouring entries often have similar translations
+        // (e.g. the same context)
+        std::unordered_map<uint32_t, uint64_t> hits(hot.begin(), hot.end());
+        std::vector<std::pair<uint64_t, size_t>> order;
+        order.reserve(entries.size());
+        for(size_t a=0; a<entries.size(); a++)
+        {
+            auto i = hits.find(entries[a].offset);
+            order.emplace_back(i == hits.end() ? 0 : i->second, a);
+        }
+        std::stable_sort(order.begin(), order.end(), [](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b){
+            return a.first > b.first;
+        });
+
+        std::string raw;
+        std::vector<uint32_t> starts;
+        std::vector<uint32_t> offsets(entries.size());
+        for(const auto& o : order)
+        {
+            const Entry& e = entries[o.second];
+            if(starts.empty() || raw.size() - starts.back() >= BLOCK_SIZE)
+                starts.push_back(static_cast<uint32_t>(raw.size()));
+            offsets[o.second] = static_cast<uint32_t>(raw.size());
+            raw.append(data, e.offset + e.getKeyLen(), e.valueLen);
+        }
+        if(raw.empty())
+            return;
+
+        Codec c;
+        std::string p;
+        std::vector<uint32_t> packedStarts;
+        c.compress(raw, starts, p, packedStarts);
+        size_t overhead = c.calcMemoryUsage() + offsets.size() * sizeof(uint32_t) + (starts.size() + 1) * sizeof(Block);
+        if(p.size() + overhead >= raw.size())
+            return;
+
+        std::string keys;
+        keys.reserve(data.size() - raw.size());
+        for(Entry& e : entries)
+        {
+            uint32_t offset = static_cast<uint32_t>(keys.size());
+            keys.append(data, e.offset, e.getKeyLen());
+            e.offset = offset;
+        }
+        data.swap(keys);
+
+        for(size_t a=0; a<starts.size(); a++)
+            blocks.push_back({starts[a], packedStarts[a]});
+        blocks.push_back({static_cast<uint32_t>(raw.size()), static_cast<uint32_t>(p.size())});
+        values.swap(offsets);
+        packed.swap(p);
+        packed.shrink_to_fit();
+        codec = std::move(c);
+        id = nextId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const char* Compact::getValueData(const Entry &entry) const
+    {
+        if(blocks.empty())
+            return data.data() + entry.offset + entry.getKeyLen();
+
+        uint32_t raw = values[&entry - entries.data()];
+        auto it = std::upper_bound(blocks.begin(), blocks.end() - 1, raw, [](uint32_t r, const Block& b){
+            return r < b.raw;
+        });
+        size_t n = static_cast<size_t>(it - blocks.begin()) - 1;
+
+        BlockCache& cache = BlockCache::get();
+        size_t limit = std::max<size_t>(1, getBlockCacheSize());
+        if(cache.blocks.size() > limit)
+            cache.blocks.resize(limit);
+        BlockCache::Block* found = nullptr;
+        BlockCache::Block* oldest = nullptr;
+        for(BlockCache::Block& b : cache.blocks)
+        {
+            if(b.owner == id && b.n == n)
+            {
+                found = &b;
+                break;
+            }
+            if(!oldest || b.used < oldest->used)
+                oldest = &b;
+        }
+        if(!found)
+        {
+            if(cache.blocks.size() < limit)
+            {
+                cache.blocks.emplace_back();
+                found = &cache.blocks.back();
+            }
+            else
+            {
+                found = oldest;
+            }
+            found->owner = id;
+            found->n = n;
+            found->data.resize(blocks[n + 1].raw - blocks[n].raw);
+            codec.decompress(packed.data() + blocks[n].packed, blocks[n + 1].packed - blocks[n].packed,
+                             &found->data[0], found->data.size());
+        }
+        found->used = ++cache.clock;
+        return found->data.data() + (raw - blocks[n].raw);
+    }
+
+    int Compact::compare(const Entry &entry, const std::string* const* parts, size_t nParts, bool plural) const
+    {
+        const char* s = data.data() + entry.offset;
+        size_t len = entry.getKeyLen();
+        for(size_t a=0; a<nParts; a++)
+        {
+            const std::string& part = *parts[a];
+            int c = memcmp(s, part.data(), std::min(len, part.size()));
+            if(c)
+                return c;
+            if(len < part.size())
+                return -1;
+            s += part.size();
+            len -= part.size();
+        }
+        if(len)
+            return 1;
+        return static_cast<int>(entry.isPlural()) - static_cast<int>(plural);
+    }
+
+    const Compact::Entry* Compact::find(LookupCounters::Dict d, const std::string &ctx, const std::string &key) const
+    {
+        const std::string* parts[3];
+        size_t nParts;
+        if(d == LookupCounters::CtxOne || d == LookupCounters::CtxNum)
+        {
+            parts[0] = &ctx;
+            parts[1] = &ctxSeparator;
+            parts[2] = &key;
+            nParts = 3;
+        }
+        else
+        {
+            // such strings can only be found with the context
+            if(key.find('\4') != std::string::npos)
+                return nullptr;
+            parts[0] = &key;
+            nParts = 1;
+        }
+        bool plural = d == LookupCounters::Num || d == LookupCounters::CtxNum;
+
+        size_t k = 0;
+        while(k < entries.size())
+        {
+            int c = compare(entries[k], parts, nParts, plural);
+            if(!c)
+                return &entries[k];
+            k = c < 0 ? 2*k + 2 : 2*k + 1;
+        }
+        return nullptr;
+    }
+
+    std::string Compact::getValue(const Entry &entry, size_t form) const
+    {
+        const char* p = getValueData(entry);
+        const char* end = p + entry.valueLen;
+        for(; form; form--)
+        {
+            const char* next = static_cast<const char*>(memchr(p, '\0', end - p));
+            if(!next)
+                return std::string();
+            p = next + 1;
+        }
+        const char* next = static_cast<const char*>(memchr(p, '\0', end - p));
+        return std::string(p, next ? next : end);
+    }
+
+    size_t Compact::countForms(const Entry &entry) const
+    {
+        const char* p = getValueData(entry);
+        return 1 + std::count(p, p + entry.valueLen, '\0');
+    }
+
+    void Compact::unpack(Lang &lang) const
+    {
+        for(const Entry& e : entries)
+        {
+            std::string key = data.substr(e.offset, e.getKeyLen());
+            size_t p = key.find('\4');
+            size_t nForms = e.isPlural() ? countForms(e) : 1;
+            std::vector<std::string> forms;
+            for(size_t f=0; f<nForms; f++)
+                forms.push_back(getValue(e, f));
+
+            if(p == std::string::npos)
+            {
+                if(e.isPlural())
+                    lang.dictNum.emplace(std::move(key), std::move(forms));
+                else
+                    lang.dictOne.emplace(std::move(key), std::move(forms[0]));
+            }
+            else
+            {
+                std::string ctx = key.substr(0, p);
+                key.erase(0, p + 1);
+                if(e.isPlural())
+                    lang.dictCtxNum[ctx].emplace(std::move(key), std::move(forms));
+                else
+                    lang.dictCtxOne[ctx].emplace(std::move(key), std::move(forms[0]));
+            }
+        }
+    }
+
+    void Compact::calcMemoryBreakdown(MemoryUsage &m) const
+    {
+        for(const Entry& e : entries)
+        {
+            m.keys += e.getKeyLen();
+            if(!isCompressed())
+                m.values += e.valueLen;
+        }
+        m.values += packed.capacity();
+        m.other += data.capacity() - data.size() + sizeof(*this);
+        m.tables += entries.capacity() * sizeof(Entry)
+                    + values.capacity() * sizeof(uint32_t)
+                    + blocks.capacity() * sizeof(Block)
+                    + codec.calcMemoryUsage();
+    }
+
+}
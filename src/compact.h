@@ -0,0 +1,229 @@
+/*************************************************************************}
+{ compact.h - translations in the sorted MO string tables                 }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "codec.h"
+#include "stats.h"
+
+namespace GotText {
+
+    struct Lang;
+    struct MemoryUsage;
+
+    /*!
+     * Translations of a single file in the compact form (see GotText::load()).
+     * Only the strings from the MO file are stored,
+     * each original string (with the context joined by "\4", like in the MO file)
+     * followed by its translation (with the plural forms separated by zero bytes),
+     * and one small Entry per translation.
+     * The entries are sorted by the original strings
+     * and laid out in the Eytzinger order (the children of the entry k are 2k+1 and 2k+2),
+     * so a lookup is a binary search that touches the same top entries every time,
+     * and they stay in the CPU cache.
+     * The strings with the same context go one after another,
+     * because the context is the prefix of the stored original string.
+     * The lookups take O(log n) string comparisons and do not allocate memory.
+     *
+     * The translations may also be compressed (see setCompressValues()).
+     * Then they are stored separately from the original strings,
+     * in the blocks of about BLOCK_SIZE bytes (in the same order as the entries before the Eytzinger layout),
+     * and a block is decompressed into the cache of the current thread when one of its translations is needed.
+     * The original strings are never compressed, so the missing strings are detected without decompressing anything.
+     */
+    class Compact
+    {
+    public:
+        static const uint32_t PLURAL = 0x80000000; /*!< The flag of the plural strings in Entry::keyLen. */
+        static const size_t BLOCK_SIZE = 2048; /*!< The minimum size of the decompressed block, unless it's the last one. */
+
+        /*!
+         * A single translation.
+         */
+        struct Entry {
+            uint32_t offset; /*!< Offset of the original string in *data*, the translation follows it unless it's compressed. */
+            uint32_t keyLen; /*!< Length of the original string with the context, the PLURAL flag for the plural strings. */
+            uint32_t valueLen; /*!< Length of the translation, the plural forms are separated by zero bytes. */
+
+            inline bool isPlural() const {return keyLen & PLURAL;}
+            inline uint32_t getKeyLen() const {return keyLen & ~PLURAL;}
+        };
+
+        /*!
+         * Adds the translation *forms* of the original string *key*
+         * (the context and the original string joined by "\4", like in the MO file).
+         * *plural* is true for the plural strings.
+         * *hits* is the number of the lookups of the translation in the hotness profile (see HotProfile),
+         * the hot translations are compressed together, so they need fewer blocks in the cache.
+         * If the same string is added twice, the first translation is used.
+         * MUST NOT be called after finish().
+         */
+        void add(const std::string& key, bool plural, const std::vector<std::string>& forms, uint64_t hits = 0);
+
+        /*!
+         * Sorts the entries added via add(), so the lookups can be performed.
+         * If *compress* == true, then the translations are compressed,
+         * unless it doesn't make them smaller.
+         */
+        void finish(bool compress = false);
+
+        /*!
+         * Returns true if the translations are compressed, see finish().
+         */
+        inline bool isCompressed() const {return !blocks.empty();}
+
+        /*!
+         * Finds the translation of the original string *key* with the context *ctx* in the dictionary *d*.
+         * The context is ignored for LookupCounters::One and LookupCounters::Num.
+         * Returns nullptr if there's no such translation.
+         */
+        const Entry* find(LookupCounters::Dict d, const std::string& ctx, const std::string& key) const;
+
+        /*!
+         * Returns the translation from the *entry*.
+         * *form* is a plural form index for the plural strings.
+         */
+        std::string getValue(const Entry& entry, size_t form = 0) const;
+
+        /*!
+         * Returns the number of the plural forms of the *entry*, 1 for the singular strings.
+         */
+        size_t countForms(const Entry& entry) const;
+
+        /*!
+         * Returns the number of translations in the dictionary *d*.
+         */
+        inline size_t countEntries(LookupCounters::Dict d) const {return counts[d];}
+
+        /*!
+         * Fills the dictionaries of *lang* with all translations.
+         */
+        void unpack(Lang& lang) const;
+
+        /*!
+         * Adds the number of bytes occupied by the strings and the entries to *m*.
+         * The translations are counted in the compressed form,
+         * the decompressed blocks in the caches of the threads are not counted.
+         */
+        void calcMemoryBreakdown(MemoryUsage& m) const;
+
+        /*!
+         * Enables or disables the compression of the translations.
+         * If enabled, then all translations are loaded in the compact form (see isRequested()),
+         * and the translations are compressed.
+         * Disabled by default.
+         */
+        static void setCompressValues(bool compress);
+
+        /*!
+         * see setCompressValues()
+         */
+        static bool isCompressValues();
+
+        /*!
+         * Sets the maximum number of the decompressed blocks kept by each thread.
+         * The least recently used block is dropped when a new one is needed.
+         * At least one block is always kept.
+         * Default: 64.
+         */
+        static void setBlockCacheSize(size_t blocks);
+
+        /*!
+         * see setBlockCacheSize()
+         */
+        static size_t getBlockCacheSize();
+
+        /*!
+         * Drops the decompressed blocks kept by the current thread.
+         */
+        static void clearBlockCache();
+
+        /*!
+         * Returns true if the translations that are being loaded in the current thread
+         * must be stored in the compact form, see Use and setCompressValues().
+         */
+        static bool isRequested();
+
+        /*!
+         * Requests the compact form for the translations loaded in the current thread
+         * until this object is destroyed.
+         * GotText::loadFromStream() can't receive the flag as an argument,
+         * because it can be reimplemented.
+         */
+        class Use
+        {
+        public:
+            explicit Use(bool compact);
+            ~Use();
+            Use(const Use&) = delete;
+            Use& operator=(const Use&) = delete;
+
+        protected:
+            bool prev;
+        };
+
+    protected:
+        /*!
+         * A compressed block of translations.
+         */
+        struct Block {
+            uint32_t raw; /*!< Offset of the first translation in the decompressed translations. */
+            uint32_t packed; /*!< Offset of the block in *packed*. */
+        };
+
+        std::string data; /*!< All strings, or only the original strings if the translations are compressed. */
+        std::vector<Entry> entries; /*!< In the Eytzinger order after finish(). */
+        size_t counts[LookupCounters::DictCount] {}; /*!< see countEntries() */
+        std::vector<uint32_t> values; /*!< Offsets of the compressed translations (see Block::raw), in the same order as *entries*. */
+        std::vector<Block> blocks; /*!< Empty if the translations are not compressed, the last one marks the end. */
+        std::string packed; /*!< The compressed blocks. */
+        Codec codec;
+        uint64_t id = 0; /*!< Unique among all objects of this class, identifies the blocks in the caches. */
+        std::vector<std::pair<uint32_t, uint64_t>> hot; /*!< (Entry::offset, hits) of the hot translations, until finish(). */
+
+        /*!
+         * Compresses the translations of the sorted *entries*,
+         * the hot ones go first.
+         */
+        void compress();
+
+        /*!
+         * Returns the translation of the *entry*, Entry::valueLen bytes.
+         * The pointer is valid until the next call in the same thread.
+         */
+        const char* getValueData(const Entry& entry) const;
+
+        /*!
+         * Compares the original string of the *entry* with the concatenation of *parts*,
+         * then compares the plural flags.
+         * Returns a negative number, zero or a positive number, like memcmp().
+         */
+        int compare(const Entry& entry, const std::string* const* parts, size_t nParts, bool plural) const;
+    };
+
+}
@@ -75,6 +75,16 @@ namespace GotText {
                 Exception::strParam will contain the source string.
             */
             ReadError, /*!< Stream read error. */
+            UnsupportedCharset, /*!<
+                The charset from the Content-Type header is not supported, see Charset::find().
+                Exception::strParam will contain the charset name.
+            */
+            InvalidEncoding, /*!<
+                A translation contains a byte sequence that is invalid in the file's charset.
+                Exception::filePos will contain the position of the first invalid byte.
+                Exception::intParam will contain that byte.
+                Exception::strParam will contain the charset name.
+            */
 
             CustomError = 100 /*!< An anchor for custom error types. DO NOT use as an actual exception type. */
         };
@@ -0,0 +1,249 @@
+/*************************************************************************}
+{ export.cpp - exporting translations                                     }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#include <algorithm>
+#include <cstdio>
+
+#include "export.h"
+#include "image.h"
+#include "columns.h"
+
+namespace GotText {
+
+    static bool lessItem(const ExportItem& a, const ExportItem& b)
+    {
+        if(a.ctx && b.ctx && *a.ctx != *b.ctx)
+            return *a.ctx < *b.ctx;
+        return *a.key < *b.key;
+    }
+
+    LangExport::LangExport(const Lang &lang)
+    {
+        const Lang* l = &lang;
+        if(lang.image)
+        {
+            lang.image->unpack(unpacked);
+            l = &unpacked;
+        }
+        else if(lang.columns)
+        {
+            lang.columns->unpack(unpacked);
+            l = &unpacked;
+        }
+        else if(lang.compact)
+        {
+            lang.compact->unpack(unpacked);
+            l = &unpacked;
+        }
+
+        items[LookupCounters::One].reserve(l->dictOne.size());
+        for(const auto& i : l->dictOne)
+            items[LookupCounters::One].push_back({nullptr, &i.first, &i.second, 1});
+
+        items[LookupCounters::Num].reserve(l->dictNum.size());
+        for(const auto& i : l->dictNum)
+            items[LookupCounters::Num].push_back({nullptr, &i.first, i.second.data(), i.second.size()});
+
+        for(const auto& c : l->dictCtxOne)
+            for(const auto& i : c.second)
+                items[LookupCounters::CtxOne].push_back({&c.first, &i.first, &i.second, 1});
+
+        for(const auto& c : l->dictCtxNum)
+            for(const auto& i : c.second)
+                items[LookupCounters::CtxNum].push_back({&c.first, &i.first, i.second.data(), i.second.size()});
+
+        for(std::vector<ExportItem>& v : items)
+            std::sort(v.begin(), v.end(), lessItem);
+    }
+
+    const std::string& LangExport::getJson() const
+    {
+        std::call_once(jsonFlag, &LangExport::buildJson, this);
+        return json;
+    }
+
+    static void appendJsonString(std::string& json, const std::string& s)
+    {
+        json.push_back('"');
+        for(char c : s)
+        {
+            switch(c)
+            {
+                case '"': json.append("\\\""); break;
+                case '\\': json.append("\\\\"); break;
+                case '\n': json.append("\\n"); break;
+                case '\r': json.append("\\r"); break;
+                case '\t': json.append("\\t"); break;
+                default:
+                    if(static_cast<unsigned char>(c) < 0x20)
+                    {
+                        char buf[8];
+                        snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned>(c));
+                        json.append(buf);
+                    }
+                    else
+                    {
+                        json.push_back(c);
+                    }
+            }
+        }
+        json.push_back('"');
+    }
+
+    static void appendJsonValue(std::string& json, const ExportItem& item, bool plural)
+    {
+        if(!plural)
+        {
+            appendJsonString(json, *item.values);
+            return;
+        }
+        json.push_back('[');
+        for(size_t a=0; a<item.count; a++)
+        {
+            if(a)
+                json.push_back(',');
+            appendJsonString(json, item.values[a]);
+        }
+        json.push_back(']');
+    }
+
+    /*!
+     * Appends {"key":value,...} for the items without a context
+     * or {"ctx":{"key":value,...},...} for the items with a context.
+     */
+    static void appendJsonDict(std::string& json, const std::vector<ExportItem>& items, bool plural)
+    {
+        json.push_back('{');
+        const std::string* ctx = nullptr;
+        for(size_t a=0; a<items.size(); a++)
+        {
+            const ExportItem& item = items[a];
+            if(item.ctx && (!ctx || *ctx != *item.ctx))
+            {
+                if(ctx)
+                    json.append("},");
+                ctx = item.ctx;
+                appendJsonString(json, *ctx);
+                json.append(":{");
+            }
+            else if(a)
+            {
+                json.push_back(',');
+            }
+            appendJsonString(json, *item.key);
+            json.push_back(':');
+            appendJsonValue(json, item, plural);
+        }
+        if(ctx)
+            json.push_back('}');
+        json.push_back('}');
+    }
+
+    std::shared_ptr<const LangExport> Lang::getExport() const
+    {
+        std::shared_ptr<const LangExport> e = std::atomic_load(&exportCache.ptr);
+        if(!e)
+        {
+            // several threads may build it at the same time, only one result is kept
+            e = std::make_shared<LangExport>(*this);
+            std::atomic_store(&exportCache.ptr, e);
+        }
+        return e;
+    }
+
+    void LangExport::buildJson() const
+    {
+        json.append("{\"singular\":");
+        appendJsonDict(json, items[LookupCounters::One], false);
+        json.append(",\"plural\":");
+        appendJsonDict(json, items[LookupCounters::Num], true);
+        json.append(",\"singular_context\":");
+        appendJsonDict(json, items[LookupCounters::CtxOne], false);
+        json.append(",\"plural_context\":");
+        appendJsonDict(json, items[LookupCounters::CtxNum], true);
+        json.push_back('}');
+    }
+
+    size_t LangExport::find(
+            LookupCounters::Dict d,
+            const std::string* ctx,
+            const std::string& prefix,
+            size_t offset,
+            size_t limit,
+            std::vector<const ExportItem*>& result) const
+    {
+        const std::vector<ExportItem>& v = items[d];
+        auto from = v.begin();
+        auto to = v.end();
+        bool hasCtx = d == LookupCounters::CtxOne || d == LookupCounters::CtxNum;
+
+        if(hasCtx && ctx)
+        {
+            from = std::lower_bound(v.begin(), v.end(), *ctx, [](const ExportItem& i, const std::string& c){
+                return *i.ctx < c;
+            });
+            to = std::upper_bound(from, v.end(), *ctx, [](const std::string& c, const ExportItem& i){
+                return c < *i.ctx;
+            });
+        }
+
+        if(!hasCtx || ctx)
+        {
+            // the range is sorted by the key, so the matching keys are adjacent
+            from = std::lower_bound(from, to, prefix, [](const ExportItem& i, const std::string& p){
+                return *i.key < p;
+            });
+            if(!prefix.empty())
+            {
+                auto last = from;
+                while(last != to && last->key->compare(0, prefix.size(), prefix) == 0)
+                    ++last;
+                to = last;
+            }
+
+            size_t total = to - from;
+            if(offset >= total)
+                return total;
+            from += offset;
+            if(limit && static_cast<size_t>(to - from) > limit)
+                to = from + limit;
+            for(; from != to; ++from)
+                result.push_back(&*from);
+            return total;
+        }
+
+        // all contexts: the keys are sorted only within each context
+        size_t total = 0;
+        for(; from != to; ++from)
+        {
+            if(from->key->compare(0, prefix.size(), prefix) != 0)
+                continue;
+            if(total >= offset && (!limit || total - offset < limit))
+                result.push_back(&*from);
+            total++;
+        }
+        return total;
+    }
+
+}
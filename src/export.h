@@ -0,0 +1,101 @@
+/*************************************************************************}
+{ export.h - exporting translations                                       }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "gottext.h"
+
+namespace GotText {
+
+    /*!
+     * A single translation in LangExport.
+     * The pointers refer to the strings of the exported Lang.
+     */
+    struct ExportItem {
+        const std::string* ctx; /*!< The context, nullptr for Lang::dictOne and Lang::dictNum. */
+        const std::string* key; /*!< The original string. */
+        const std::string* values; /*!< The translation or an array of plural forms. */
+        size_t count; /*!< Number of strings in *values*. */
+    };
+
+    /*!
+     * Read-only data for exporting all translations of a Lang:
+     * the translations sorted by the context and the original string,
+     * and their JSON representation.
+     * The object is built on the first request and then cached in the Lang
+     * until the translations are replaced (see Lang::getExport()),
+     * so repeated exports of the same translations cost nothing.
+     */
+    class LangExport
+    {
+    public:
+        /*!
+         * Builds the sorted index of *lang*.
+         * If *lang* refers to an image, the image is unpacked into this object first.
+         * Otherwise, *lang* must outlive this object.
+         */
+        explicit LangExport(const Lang& lang);
+
+        /*!
+         * Returns all dictionaries as a JSON object with the same structure
+         * as the array returned by GotText::getStrings() in PHP, keys are sorted.
+         * The strings are not validated, non-ASCII characters are not escaped.
+         * The string is built on the first call.
+         */
+        const std::string& getJson() const;
+
+        /*!
+         * Returns the sorted translations of the dictionary *d*.
+         */
+        inline const std::vector<ExportItem>& getItems(LookupCounters::Dict d) const {return items[d];}
+
+        /*!
+         * Finds the translations of the dictionary *d*
+         * which original strings start with *prefix*.
+         * If *ctx* is not nullptr, then only the translations with this context are searched.
+         * Skips the first *offset* found translations and puts at most *limit* (0 - no limit) of the rest into *result*.
+         * Returns the total number of found translations.
+         */
+        size_t find(
+            LookupCounters::Dict d,
+            const std::string* ctx,
+            const std::string& prefix,
+            size_t offset,
+            size_t limit,
+            std::vector<const ExportItem*>& result) const;
+
+    protected:
+        Lang unpacked; /*!< The translations from the image, if any. */
+        std::vector<ExportItem> items[LookupCounters::DictCount]; /*!< Sorted by the context and the key. */
+        mutable std::string json;
+        mutable std::once_flag jsonFlag;
+
+        void buildJson() const;
+    };
+
+}
@@ -25,9 +25,13 @@
 #include <iomanip>
 #include <sstream>
 
+#include <glob.h>
+
 #include <phpcpp.h>
 
+#include "export.h"
 #include "gottext.h"
+#include "image.h"
 
 // Specify the following directive to instruct GotText extension
 // to use std::ifstream for reading files.
@@ -45,13 +49,18 @@
 class GotTextCustom : public GotText::GotText {
 protected:
 #ifndef GOTTEXT_EXT_NATIVE_FILE
-    ::GotText::Lang loadFromFile(const std::string& filename) override
+    /*!
+     * Opens the file with PHP functions and calls *read* for the opened stream.
+     * Converts the stream errors to Exception.
+     */
+    template<typename F>
+    static auto readPhpFile(const std::string& filename, F read) -> decltype(read(std::declval<PhpReadStream&>()))
     {
         try{
             PhpReadStream f(filename);
             f.exceptions(std::ifstream::failbit | std::ifstream::badbit | std::ifstream::eofbit);
             try{
-                return loadFromStream(f, filename);
+                return read(f);
             }catch(std::ios_base::failure &e){
                 throw ::GotText::Exception(::GotText::Exception::ReadError, f);
             }
@@ -59,12 +68,277 @@ protected:
             throw ::GotText::Exception(::GotText::Exception::ReadError, 0, e.what());
         }
     }
+
+    ::GotText::Lang loadFromFile(const std::string& filename) override
+    {
+        return readPhpFile(filename, [&](PhpReadStream& f){
+            return loadFromStream(f, filename);
+        });
+    }
+
+    bool diffFromFile(const std::string& filename, const ::GotText::LangDigest& base, ::GotText::LangDiff& diff) override
+    {
+        return readPhpFile(filename, [&](PhpReadStream& f){
+            return diffFromStream(f, base, diff);
+        });
+    }
+
+    ::GotText::Fingerprint fingerprintFile(const std::string& filename) override
+    {
+        return readPhpFile(filename, [](PhpReadStream& f){
+            return fingerprintStream(f);
+        });
+    }
+
+    // PHP functions can only be called from the PHP thread
+    bool canLoadInBackground() const override
+    {
+        return false;
+    }
+
+    // the changed files are parsed at the end of the request, see onIdle()
+    bool isReloadDeferred() const override
+    {
+        return true;
+    }
 #endif
 
     time_t getTimestamp() const override
     {
         return Php::call("time");
     }
+
+public:
+    /*!
+     * Translates a message like GotText::_(), GotText::_n(), GotText::_p() or GotText::_np() (see *d*)
+     * using the LookupCache of the current thread.
+     * *ctx* and *msgidPlural* are nullptr if the lookup does not use them.
+     */
+    Php::Value translateCached(
+        ::GotText::LookupCounters::Dict d,
+        const Php::Value* ctx,
+        const Php::Value& msgid,
+        const Php::Value* msgidPlural,
+        int n) const;
+};
+
+/*!
+ * A small direct-mapped cache of the translations looked up with interned PHP strings,
+ * e.g. string literals.
+ * An interned string keeps its address at least until the end of the request,
+ * so the address identifies the string,
+ * and a repeated lookup skips hashing, the global lock and comparing the keys.
+ * The cache keeps its own copies of the translations as PHP values
+ * and revalidates them with LangEntry::generation and LangEntry::version,
+ * so reloading or unloading the translations invalidates them.
+ * Each thread (ZTS) has its own cache, which is cleared at the end of each request,
+ * because neither the request-interned strings nor the PHP values outlive the request.
+ */
+class LookupCache
+{
+public:
+    static const size_t SIZE = 1024; /*!< Number of slots. MUST be a power of two. */
+
+    /*!
+     * A single cached lookup.
+     */
+    struct Slot {
+        const GotText::LangEntry* entry = nullptr; /*!< nullptr if the slot is empty. */
+        uint32_t generation = 0; /*!< LangEntry::generation at the moment of the lookup. */
+        uint32_t version = 0; /*!< LangEntry::version at the moment of the lookup. */
+        GotText::LookupCounters::Dict dict = GotText::LookupCounters::One;
+        const char* ctx = nullptr; /*!< The address of the interned string, nullptr if the lookup does not use it. */
+        const char* msgid = nullptr; /*!< The address of the interned string. */
+        const char* msgidPlural = nullptr; /*!< The address of the interned string, nullptr if the lookup does not use it. */
+        bool found = false;
+        std::vector<Php::Value> values; /*!< The translation or all plural forms. */
+        GotText::Plural::Info pluralInfo; /*!< Lang::pluralInfo at the moment of the lookup. */
+    };
+
+    /*!
+     * Returns the cache of the current thread.
+     */
+    static LookupCache& get()
+    {
+        static thread_local LookupCache cache;
+        return cache;
+    }
+
+    /*!
+     * Returns true if *v* is an interned string.
+     * Only the interned strings are not reference-counted.
+     */
+    static inline bool isInterned(const Php::Value& v)
+    {
+        return v.isString() && !v.refcount();
+    }
+
+    /*!
+     * Returns the slot for the lookup.
+     * The slot may contain another lookup.
+     */
+    inline Slot& getSlot(const GotText::LangEntry* entry, const char* ctx, const char* msgid)
+    {
+        uint64_t key = reinterpret_cast<uintptr_t>(msgid)
+            ^ (reinterpret_cast<uintptr_t>(ctx) << 1)
+            ^ (reinterpret_cast<uintptr_t>(entry) << 2);
+        return slots[(key * 0x9e3779b97f4a7c15ull) >> (64 - SIZE_BITS)];
+    }
+
+    /*!
+     * Removes all cached lookups.
+     */
+    void clear()
+    {
+        for(Slot& slot : slots)
+            slot = Slot();
+    }
+
+protected:
+    static const unsigned SIZE_BITS = 10; /*!< log2(SIZE) */
+
+    Slot slots[SIZE];
+};
+
+/*!
+ * The arrays returned by GotTextExtension::getStrings() in the current request.
+ * The array is built once from the cached GotText::LangExport and returned again
+ * until the translations are reloaded or unloaded (LangEntry::version, LangEntry::generation);
+ * PHP separates it before any modification, so the cached array stays unchanged.
+ * Each thread (ZTS) has its own cache, which is cleared at the end of each request,
+ * because the PHP values do not outlive the request.
+ */
+class StringsCache
+{
+public:
+    /*!
+     * A cached array.
+     */
+    struct Item {
+        uint32_t generation = 0; /*!< LangEntry::generation at the moment of building. */
+        uint32_t version = 0; /*!< LangEntry::version at the moment of building. */
+        Php::Value strings; /*!< The array, null if it is not built yet. */
+    };
+
+    /*!
+     * Returns the cache of the current thread.
+     */
+    static StringsCache& get()
+    {
+        static thread_local StringsCache cache;
+        return cache;
+    }
+
+    /*!
+     * Returns the cached array of the entry.
+     * The array is outdated if Item::generation or Item::version differs from the entry.
+     */
+    inline Item& getItem(const GotText::LangEntry* entry) {return items[entry];}
+
+    /*!
+     * Removes all cached arrays.
+     */
+    void clear() {items.clear();}
+
+protected:
+    std::unordered_map<const GotText::LangEntry*, Item> items;
+};
+
+Php::Value GotTextCustom::translateCached(
+        ::GotText::LookupCounters::Dict d,
+        const Php::Value* ctx,
+        const Php::Value& msgid,
+        const Php::Value* msgidPlural,
+        int n) const
+{
+    bool interned = LookupCache::isInterned(msgid)
+        && (!ctx || LookupCache::isInterned(*ctx))
+        && (!msgidPlural || LookupCache::isInterned(*msgidPlural));
+    const char* ctxPtr = ctx ? ctx->rawValue() : nullptr;
+    const char* msgidPtr = msgid.rawValue();
+    const char* msgidPluralPtr = msgidPlural ? msgidPlural->rawValue() : nullptr;
+
+    // the evicted translations must be revived by the regular lookup
+    if(interned && entry->generation.load(std::memory_order_relaxed) == generation)
+    {
+        const LookupCache::Slot& slot = LookupCache::get().getSlot(entry, ctxPtr, msgidPtr);
+        if(slot.entry == entry
+            && slot.generation == generation
+            && slot.version == entry->version.load(std::memory_order_relaxed)
+            && slot.dict == d
+            && slot.msgid == msgidPtr
+            && slot.ctx == ctxPtr
+            && slot.msgidPlural == msgidPluralPtr)
+        {
+            if(slot.found)
+            {
+                hit(*entry, d, ctxPtr, ctx ? ctx->size() : 0, msgidPtr, msgid.size());
+                return slot.values[msgidPlural ? slot.pluralInfo.func(n) : 0];
+            }
+            // the regular lookup collects the missing string
+            if(!::GotText::MissingCollector::isEnabled())
+            {
+                entry->counters.miss(d);
+                ::GotText::LangStorage::touch(*entry);
+                return msgidPlural && ::GotText::Plural::origFunc(n) ? *msgidPlural : msgid;
+            }
+        }
+    }
+
+    ::GotText::Message m(
+        d,
+        ctx ? ctx->stringValue() : std::string(),
+        msgid.stringValue(),
+        msgidPlural ? msgidPlural->stringValue() : std::string());
+    std::string result = translate(m, n);
+    if(!interned || m.getEntry() != entry)
+        return result;
+
+    LookupCache::Slot& slot = LookupCache::get().getSlot(entry, ctxPtr, msgidPtr);
+    slot.entry = entry;
+    slot.generation = generation;
+    slot.version = m.getVersion();
+    slot.dict = d;
+    slot.ctx = ctxPtr;
+    slot.msgid = msgidPtr;
+    slot.msgidPlural = msgidPluralPtr;
+    slot.found = m.isFound();
+    slot.values.clear();
+    for(const std::string& v : m.getValues())
+        slot.values.emplace_back(v);
+    slot.pluralInfo = m.getPluralInfo();
+    return result;
+}
+
+/*!
+ * PHP interface for GotText::Message, see GotTextExtension::msg().
+ */
+class GotTextMessage : public Php::Base
+{
+protected:
+    GotTextCustom gotText; /*!< Refers to the same translations as the GotText object that created the message. */
+    GotText::Message message;
+
+public:
+    GotTextMessage(const GotTextCustom& gotText, GotText::Message&& message):
+        gotText(gotText),
+        message(std::move(message))
+    {
+    }
+
+    /*!
+     * See GotText::translate().
+     */
+    Php::Value get(Php::Parameters &params) const
+    {
+        // the read lock is inside this function
+        return gotText.translate(message, params.empty() ? 1 : params[0].numericValue());
+    }
+
+    Php::Value __toString() const
+    {
+        return gotText.translate(message);
+    }
 };
 
 /*!
@@ -79,13 +353,25 @@ protected:
     */
 
 public:
+    GotTextExtension() = default;
+
+    /*!
+     * Creates an object that refers to the same translations as *gotText*.
+     */
+    explicit GotTextExtension(const GotTextCustom& gotText):
+        gotText(gotText)
+    {
+    }
+
+    inline const GotTextCustom& getGotText() const {return gotText;}
+
     /*!
      * See GotText::_().
      */
     Php::Value _(Php::Parameters &params) const
     {
         // the read lock is inside this function
-        return gotText._(params[0]);
+        return gotText.translateCached(GotText::LookupCounters::One, nullptr, params[0], nullptr, 1);
     }
 
     /*!
@@ -94,7 +380,7 @@ public:
     Php::Value _n(Php::Parameters &params) const
     {
         // the read lock is inside this function
-        return gotText._n(params[0], params[1], params[2]);
+        return gotText.translateCached(GotText::LookupCounters::Num, nullptr, params[0], &params[1], params[2].numericValue());
     }
 
     /*!
@@ -103,7 +389,7 @@ public:
     Php::Value _p(Php::Parameters &params) const
     {
         // the read lock is inside this function
-        return gotText._p(params[0], params[1]);
+        return gotText.translateCached(GotText::LookupCounters::CtxOne, &params[0], params[1], nullptr, 1);
     }
 
     /*!
@@ -112,7 +398,74 @@ public:
     Php::Value _np(Php::Parameters &params) const
     {
         // the read lock is inside this function
-        return gotText._np(params[0], params[1], params[2], params[3]);
+        return gotText.translateCached(GotText::LookupCounters::CtxNum, &params[0], params[1], &params[2], params[3].numericValue());
+    }
+
+    /*!
+     * Returns a GotTextMessage object for repeated lookups of the same string.
+     * Parameters: msgid, msgid_plural (null - singular), msgid_ctxt (null - no context).
+     */
+    Php::Value msg(Php::Parameters &params) const
+    {
+        return Php::Object("GotTextMessage", new GotTextMessage(gotText, makeMessage(params, 0)));
+    }
+
+    /*!
+     * Translates a single string with all GotText objects from an array.
+     * Parameters: array of GotText objects, msgid, msgid_plural (null - singular),
+     * msgid_ctxt (null - no context), n.
+     * Returns an array with the same keys. See GotText::translateMany().
+     */
+    static Php::Value translateMany(Php::Parameters &params)
+    {
+        std::vector<Php::Value> keys;
+        std::vector<const GotText::GotText*> objects;
+        for(const auto& i : params[0])
+        {
+            GotTextExtension* ext = i.second.instanceOf("GotText") ? i.second.implementation<GotTextExtension>() : nullptr;
+            if(!ext)
+                throw Php::Exception("Not a GotText object at key " + i.first.stringValue());
+            keys.push_back(i.first);
+            objects.push_back(&ext->gotText);
+        }
+        GotText::Message m = makeMessage(params, 1);
+        int n = params.size() > 4 ? params[4].numericValue() : 1;
+
+        std::vector<std::string> translations;
+        GotText::GotText::translateMany(objects, m, n, translations);
+        Php::Value result(Php::Type::Array);
+        for(size_t a=0; a<keys.size(); a++)
+            result[keys[a]] = translations[a];
+        return result;
+    }
+
+    /*!
+     * Loads all files from an array and publishes them at once.
+     * Returns an array of GotText objects with the same keys.
+     * See GotText::loadMany().
+     */
+    static Php::Value loadMany(Php::Parameters &params)
+    {
+        std::vector<Php::Value> keys;
+        std::vector<std::string> filenames;
+        for(const auto& i : params[0])
+        {
+            keys.push_back(i.first);
+            filenames.push_back(i.second.stringValue());
+        }
+
+        GotTextCustom loader;
+        size_t failed = 0;
+        try{
+            loader.loadMany(filenames, &failed);
+        }catch(const GotText::Exception &e){
+            throw Php::Exception(filenames[failed] + ": " + errorMessage(e));
+        }
+
+        Php::Value result(Php::Type::Array);
+        for(size_t a=0; a<keys.size(); a++)
+            result[keys[a]] = Php::Object("GotText", filenames[a]);
+        return result;
     }
 
     /*!
@@ -120,29 +473,152 @@ public:
      */
     Php::Value pluralFunc(Php::Parameters &params) const
     {
+        gotText.revive();
         GOTTEXT_READ_LOCK
         return gotText.getLang().pluralInfo.func(params[0]);
     }
 
     /*!
-     * Builds an associative array containing all dictionaries from GotText::getLang().
+     * Returns an associative array containing all dictionaries from GotText::getLang().
+     * The array is built from GotText::Lang::getExport() once per request
+     * and reused until the translations are reloaded, see StringsCache.
      */
     Php::Value getStrings() const
     {
+        gotText.revive();
+        GOTTEXT_READ_LOCK
+        const GotText::LangEntry& entry = gotText.getEntry();
+        uint32_t generation = entry.generation.load(std::memory_order_relaxed);
+        uint32_t version = entry.version.load(std::memory_order_relaxed);
+        StringsCache::Item& item = StringsCache::get().getItem(&entry);
+        if(item.strings.isNull() || item.generation != generation || item.version != version)
+        {
+            std::shared_ptr<const GotText::LangExport> e = entry.lang.getExport();
+            Php::Value dicts;
+            dicts["singular"] = exportToVal(*e, GotText::LookupCounters::One);
+            dicts["plural"] = exportToVal(*e, GotText::LookupCounters::Num);
+            dicts["singular_context"] = exportToVal(*e, GotText::LookupCounters::CtxOne);
+            dicts["plural_context"] = exportToVal(*e, GotText::LookupCounters::CtxNum);
+            item.generation = generation;
+            item.version = version;
+            item.strings = dicts;
+        }
+        return item.strings;
+    }
+
+    /*!
+     * Returns the JSON representation of getStrings().
+     * The JSON string is built once for the loaded translations
+     * and reused until they are reloaded. See GotText::LangExport::getJson().
+     */
+    Php::Value getStringsJson() const
+    {
+        gotText.revive();
+        GOTTEXT_READ_LOCK
+        return gotText.getLang().getExport()->getJson();
+    }
+
+    /*!
+     * Returns a part of a single dictionary.
+     * Parameters: dictionary name (a key of getStrings()), offset, limit (0 - no limit),
+     * prefix of the original strings, context (null - all contexts).
+     * Returns ["total" => number of all matching strings, "strings" => [["context" => ..., "key" => ..., "value" => ...], ...]],
+     * the strings are sorted by the context and then by the key.
+     * See GotText::LangExport::find().
+     */
+    Php::Value getStringsSlice(Php::Parameters &params) const
+    {
+        std::string name = params[0];
+        GotText::LookupCounters::Dict d;
+        if(name == "singular")
+            d = GotText::LookupCounters::One;
+        else if(name == "plural")
+            d = GotText::LookupCounters::Num;
+        else if(name == "singular_context")
+            d = GotText::LookupCounters::CtxOne;
+        else if(name == "plural_context")
+            d = GotText::LookupCounters::CtxNum;
+        else
+            throw Php::Exception("Unknown dictionary: " + name);
+
+        int64_t offset = params.size() > 1 ? params[1].numericValue() : 0;
+        int64_t limit = params.size() > 2 ? params[2].numericValue() : 0;
+        if(offset < 0 || limit < 0)
+            throw Php::Exception("Offset and limit must not be negative");
+        std::string prefix = params.size() > 3 ? params[3].stringValue() : std::string();
+        bool hasCtx = params.size() > 4 && !params[4].isNull();
+        std::string ctx = hasCtx ? params[4].stringValue() : std::string();
+        bool plural = d == GotText::LookupCounters::Num || d == GotText::LookupCounters::CtxNum;
+
+        gotText.revive();
+        GOTTEXT_READ_LOCK
+        std::shared_ptr<const GotText::LangExport> e = gotText.getLang().getExport();
+        std::vector<const GotText::ExportItem*> items;
+        size_t total = e->find(d, hasCtx ? &ctx : nullptr, prefix, offset, limit, items);
+
+        Php::Value strings(Php::Type::Array);
+        int index = 0;
+        for(const GotText::ExportItem* i : items)
+        {
+            Php::Value item;
+            if(i->ctx)
+                item["context"] = *i->ctx;
+            item["key"] = *i->key;
+            if(plural)
+                item["value"] = std::vector<std::string>(i->values, i->values + i->count);
+            else
+                item["value"] = *i->values;
+            strings[index++] = item;
+        }
+        Php::Value result;
+        result["total"] = static_cast<int64_t>(total);
+        result["strings"] = strings;
+        return result;
+    }
+
+    /*!
+     * Returns the time spent on each phase of loading the current translations.
+     * See GotText::LoadProfile.
+     */
+    Php::Value getLoadProfile() const
+    {
+        gotText.revive();
         GOTTEXT_READ_LOCK
         const GotText::Lang& thisLang = gotText.getLang();
-        Php::Value dicts;
-        dicts["singular"] = umapToVal(thisLang.dictOne);
-        dicts["plural"] = umapToVal(thisLang.dictNum);
-        Php::Value dict(Php::Type::Array);
-        for(auto& i : thisLang.dictCtxOne)
-            dict[i.first] = umapToVal(i.second);
-        dicts["singular_context"] = dict;
-        dict = Php::Value(Php::Type::Array);
-        for(auto& i : thisLang.dictCtxNum)
-            dict[i.first] = umapToVal(i.second);
-        dicts["plural_context"] = dict;
-        return dicts;
+        const GotText::LoadProfile& p = thisLang.profile;
+        Php::Value profile;
+        profile["header"] = p.header / 1e9;
+        profile["tables"] = p.tables / 1e9;
+        profile["strings"] = p.strings / 1e9;
+        profile["plural"] = p.plural / 1e9;
+        profile["charset"] = p.charset / 1e9;
+        profile["dictionaries"] = p.dicts / 1e9;
+        profile["total"] = thisLang.loadTime / 1e9;
+        return profile;
+    }
+
+    /*!
+     * Returns the memory occupied by the current translations.
+     * See GotText::Lang::calcMemoryBreakdown().
+     * All numbers are zero for a dummy object.
+     */
+    Php::Value getMemoryUsage() const
+    {
+        gotText.revive();
+        GOTTEXT_READ_LOCK
+        const GotText::Lang& thisLang = gotText.getLang();
+        GotText::MemoryUsage m;
+        if(!thisLang.isDummy())
+            m = thisLang.calcMemoryBreakdown();
+        Php::Value usage;
+        usage["keys"] = static_cast<int64_t>(m.keys);
+        usage["values"] = static_cast<int64_t>(m.values);
+        usage["tables"] = static_cast<int64_t>(m.tables);
+        usage["contexts"] = static_cast<int64_t>(m.contexts);
+        usage["image"] = static_cast<int64_t>(m.image);
+        usage["other"] = static_cast<int64_t>(m.other);
+        usage["total"] = static_cast<int64_t>(m.total());
+        return usage;
     }
 
     /*!
@@ -150,6 +626,7 @@ public:
      */
     Php::Value getTimeCached() const
     {
+        gotText.revive();
         GOTTEXT_READ_LOCK
         return static_cast<int64_t>(gotText.getLang().time);
     }
@@ -169,6 +646,7 @@ public:
      */
     Php::Value getLocaleCode() const
     {
+        gotText.revive();
         GOTTEXT_READ_LOCK
         return gotText.getLang().locale;
     }
@@ -178,24 +656,88 @@ public:
      */
     Php::Value getPluralsCount() const
     {
+        gotText.revive();
         GOTTEXT_READ_LOCK
         return static_cast<int>(gotText.getLang().pluralInfo.count);
     }
 
     /*!
      * Return a list of filenames of loaded files
-     * including files that were unloaded later.
+     * including files that were unloaded later
+     * (unless the memory budget is set).
      */
     static Php::Value getFilenames()
     {
         GOTTEXT_READ_LOCK
         std::vector<std::string> filenames;
         const GotText::LangStorage& storage = GotText::GotText::getStorage();
-        for(const auto& i : storage)
+        for(const auto& i : storage.getIndex())
             filenames.emplace_back(i.first);
         return filenames;
     }
 
+    /*!
+     * Returns statistics for all files in memory.
+     * See GotText::getStats().
+     */
+    static Php::Value getStats()
+    {
+        static const char* dictNames[GotText::LookupCounters::DictCount] = {
+            "singular", "plural", "singular_context", "plural_context"
+        };
+        Php::Value result(Php::Type::Array);
+        for(const GotText::LangStats& s : GotText::GotText::getStats()) // the read lock is inside this function
+        {
+            Php::Value stats;
+            stats["locale"] = s.locale;
+            stats["loaded"] = s.loaded;
+            stats["preloaded"] = s.preloaded;
+            stats["loads"] = static_cast<int64_t>(s.loads);
+            stats["load_time"] = s.loadTime / 1e9;
+            stats["last_load_time"] = s.lastLoadTime / 1e9;
+            stats["bytes_read"] = static_cast<int64_t>(s.bytesRead);
+            stats["memory_usage"] = static_cast<int64_t>(s.memoryUsage);
+            Php::Value entries, hits, misses;
+            for(size_t d=0; d<GotText::LookupCounters::DictCount; d++)
+            {
+                entries[dictNames[d]] = static_cast<int64_t>(s.entries[d]);
+                hits[dictNames[d]] = static_cast<int64_t>(s.hits[d]);
+                misses[dictNames[d]] = static_cast<int64_t>(s.misses[d]);
+            }
+            stats["entries"] = entries;
+            stats["hits"] = hits;
+            stats["misses"] = misses;
+            result[s.filename] = stats;
+        }
+        return result;
+    }
+
+    /*!
+     * See GotText::collectMissing().
+     */
+    static void collectMissing(Php::Parameters &params)
+    {
+        GotText::GotText::collectMissing(params.empty() || params[0].boolValue());
+    }
+
+    /*!
+     * See GotText::getMissing().
+     */
+    static Php::Value getMissing(Php::Parameters &params)
+    {
+        // the lock is inside this function
+        return GotText::GotText::getMissing(!params.empty() && params[0].boolValue());
+    }
+
+    /*!
+     * See GotText::saveHotProfiles().
+     */
+    static Php::Value saveHotProfiles()
+    {
+        // the lock is inside this function
+        return static_cast<int64_t>(GotText::GotText::saveHotProfiles());
+    }
+
     /*!
      * Reloads a particular translation.
      */
@@ -221,10 +763,14 @@ public:
      */
     static Php::Value get(Php::Parameters &params)
     {
-        GOTTEXT_READ_LOCK
-        if(!GotText::GotText::isLoaded(params[0]))
-            return false;
-        return Php::Object("GotText", params[0]); // nested read locks are ok
+        {
+            GOTTEXT_READ_LOCK
+            if(!GotText::GotText::isLoaded(params[0]))
+                return false;
+        }
+        // the constructor may need the write lock (see GotText::load()),
+        // so the read lock must be released before
+        return Php::Object("GotText", params[0]);
     }
 
     /*!
@@ -232,6 +778,7 @@ public:
      */
     Php::Value isDummy() const
     {
+        gotText.revive();
         GOTTEXT_READ_LOCK
         return gotText.isDummy();
     }
@@ -275,6 +822,12 @@ public:
                 true;
 #else
                 false;
+#endif
+        info["stats"] =
+#ifndef GOTTEXT_NO_STATS
+                true;
+#else
+                false;
 #endif
         return info;
     }
@@ -295,8 +848,16 @@ public:
                     break;
 
                 default:
-                    std::stringstream s(params[1].stringValue(), std::ios_base::in);
-                    gotText.load(params[0], s);
+                    bool compact = params.size() > 2 && params[2].boolValue();
+                    if(params[1].isNull())
+                    {
+                        gotText.load(params[0], false, compact);
+                    }
+                    else
+                    {
+                        std::stringstream s(params[1].stringValue(), std::ios_base::in);
+                        gotText.load(params[0], s, compact);
+                    }
             }
         }catch(const GotText::Exception &e){
             throwPhpException(e);
@@ -308,7 +869,7 @@ protected:
      * Returns a hexadecimal string representation of an integer.
      */
     template<typename T>
-    std::string hex(T n)
+    static std::string hex(T n)
     {
         std::stringstream str;
         str << std::showbase
@@ -324,6 +885,15 @@ protected:
      * Converts GotText::Exception to a human readable Php::Exception.
      */
     void throwPhpException(const GotText::Exception &e)
+    {
+        throw Php::Exception(errorMessage(e));
+    }
+
+public:
+    /*!
+     * Returns a human readable description of GotText::Exception.
+     */
+    static std::string errorMessage(const GotText::Exception &e)
     {
         std::string s("GotText ERROR ");
         s.append(std::to_string(e.type));
@@ -392,6 +962,18 @@ protected:
                 }
                 break;
 
+            case GotText::Exception::UnsupportedCharset:
+                s.append("Unsupported charset: ");
+                s.append(e.strParam);
+                break;
+
+            case GotText::Exception::InvalidEncoding:
+                s.append("Invalid ");
+                s.append(e.strParam);
+                s.append(" byte: ");
+                s.append(hex(static_cast<uint16_t>(e.intParam)));
+                break;
+
             default:
                 s.append("Unknown error.");
                 break;
@@ -412,22 +994,154 @@ protected:
             s.append(".");
         }
 
-        throw Php::Exception(s);
+        return s;
     }
 
+protected:
     /*!
-     * Helper function that converts unordered_map to associated PHP array.
+     * Creates a message from the parameters starting at *first*:
+     * msgid, msgid_plural (null - singular), msgid_ctxt (null - no context).
      */
-    template<typename T>
-    Php::Value umapToVal(const std::unordered_map<std::string, T>& map) const
+    static GotText::Message makeMessage(Php::Parameters &params, size_t first)
     {
-        Php::Value v(Php::Type::Array);
-        for(auto& i : map)
-            v[i.first] = Php::Value(i.second);
-        return v;
+        bool plural = params.size() > first + 1 && !params[first + 1].isNull();
+        bool hasCtx = params.size() > first + 2 && !params[first + 2].isNull();
+        GotText::LookupCounters::Dict d;
+        if(hasCtx)
+            d = plural ? GotText::LookupCounters::CtxNum : GotText::LookupCounters::CtxOne;
+        else
+            d = plural ? GotText::LookupCounters::Num : GotText::LookupCounters::One;
+        return GotText::Message(
+            d,
+            hasCtx ? params[first + 2].stringValue() : std::string(),
+            params[first].stringValue(),
+            plural ? params[first + 1].stringValue() : std::string());
+    }
+
+    /*!
+     * Helper function that converts a dictionary of LangExport to associated PHP array.
+     * The dictionaries with contexts become arrays of arrays keyed by the context.
+     */
+    static Php::Value exportToVal(const GotText::LangExport& e, GotText::LookupCounters::Dict d)
+    {
+        bool plural = d == GotText::LookupCounters::Num || d == GotText::LookupCounters::CtxNum;
+        Php::Value contexts(Php::Type::Array);
+        Php::Value dict(Php::Type::Array);
+        const std::string* ctx = nullptr;
+        // the items are sorted by the context, so each context is a single run
+        for(const GotText::ExportItem& i : e.getItems(d))
+        {
+            if(i.ctx && (!ctx || *ctx != *i.ctx))
+            {
+                if(ctx)
+                    contexts[*ctx] = dict;
+                dict = Php::Value(Php::Type::Array);
+                ctx = i.ctx;
+            }
+            if(plural)
+                dict[*i.key] = std::vector<std::string>(i.values, i.values + i.count);
+            else
+                dict[*i.key] = *i.values;
+        }
+        if(d == GotText::LookupCounters::One || d == GotText::LookupCounters::Num)
+            return dict;
+        if(ctx)
+            contexts[*ctx] = dict;
+        return contexts;
     }
 };
 
+/*!
+ * The GotText object used by the global translation functions in the current request.
+ * A dummy object unless gottext_set_default() is called.
+ * Each thread (ZTS) has its own object.
+ */
+static GotTextCustom& defaultGotText()
+{
+    static thread_local GotTextCustom gotText;
+    return gotText;
+}
+
+/*!
+ * Sets the GotText object for the global translation functions.
+ * Accepts a GotText object or null to reset it.
+ */
+static void setDefault(Php::Parameters &params)
+{
+    GotTextExtension* ext = params[0].isNull() ? nullptr : params[0].implementation<GotTextExtension>();
+    if(ext)
+        defaultGotText() = ext->getGotText();
+    else
+        defaultGotText() = GotTextCustom();
+}
+
+/*!
+ * Returns a new GotText object that refers to the same translations
+ * as the object passed to gottext_set_default() or null if it was not called.
+ */
+static Php::Value getDefault()
+{
+    const GotTextCustom& g = defaultGotText();
+    if(g.getFilename().empty())
+        return nullptr;
+    return Php::Object("GotText", new GotTextExtension(g));
+}
+
+#ifdef GOTTEXT_EXT_FUNCTIONS
+/*!
+ * Global translation functions, see GotTextExtension::_() etc.
+ * They skip the PHP method call and use defaultGotText().
+ */
+static Php::Value funcOne(Php::Parameters &params)
+{
+    return defaultGotText().translateCached(GotText::LookupCounters::One, nullptr, params[0], nullptr, 1);
+}
+
+static Php::Value funcNum(Php::Parameters &params)
+{
+    return defaultGotText().translateCached(GotText::LookupCounters::Num, nullptr, params[0], &params[1], params[2].numericValue());
+}
+
+static Php::Value funcCtxOne(Php::Parameters &params)
+{
+    return defaultGotText().translateCached(GotText::LookupCounters::CtxOne, &params[0], params[1], nullptr, 1);
+}
+
+static Php::Value funcCtxNum(Php::Parameters &params)
+{
+    return defaultGotText().translateCached(GotText::LookupCounters::CtxNum, &params[0], params[1], &params[2], params[3].numericValue());
+}
+#endif
+
+/*!
+ * Preloads all files that match the glob patterns from *list* (separated by ':').
+ * See GotText::preload().
+ */
+static void preloadFiles(const std::string& list)
+{
+    std::stringstream patterns(list);
+    std::string pattern;
+    while(std::getline(patterns, pattern, ':'))
+    {
+        if(pattern.empty())
+            continue;
+        glob_t paths;
+        if(!glob(pattern.c_str(), 0, nullptr, &paths))
+        {
+            for(size_t a=0; a<paths.gl_pathc; a++)
+            {
+                try{
+                    GotText::GotText::preload(paths.gl_pathv[a]);
+                }catch(const GotText::Exception &e){
+                    Php::warning << "Cannot preload " << paths.gl_pathv[a] << ": "
+                        << GotTextExtension::errorMessage(e) << std::flush;
+                }
+            }
+        }
+        globfree(&paths);
+    }
+}
+
 /*!
  * The only exported function, which returns PHP bindings to C++ code.
  */
@@ -435,11 +1149,80 @@ extern "C" PHPCPP_EXPORT void *get_module()
 {
     static Php::Extension extension("gottext", VERSION_STR);
 
+    extension.add(Php::Ini("gottext.reload_interval", "0", Php::Ini::System));
+    extension.add(Php::Ini("gottext.memory_budget", "0", Php::Ini::System));
+    extension.add(Php::Ini("gottext.shared_dir", "", Php::Ini::System));
+    extension.add(Php::Ini("gottext.preload", "", Php::Ini::System));
+    extension.add(Php::Ini("gottext.collect_missing", "0", Php::Ini::System));
+    extension.add(Php::Ini("gottext.columnar", "0", Php::Ini::System));
+    extension.add(Php::Ini("gottext.diff_reload", "1", Php::Ini::System));
+    extension.add(Php::Ini("gottext.dedup", "0", Php::Ini::System));
+    extension.add(Php::Ini("gottext.hot_profile_dir", "", Php::Ini::System));
+    extension.add(Php::Ini("gottext.huge_pages", "0", Php::Ini::System));
+    extension.add(Php::Ini("gottext.prefault", "0", Php::Ini::System));
+    extension.add(Php::Ini("gottext.compress_values", "0", Php::Ini::System));
+    extension.add(Php::Ini("gottext.block_cache", "64", Php::Ini::System));
+    extension.onStartup([]{
+        GotText::GotText::setReloadInterval(Php::ini_get("gottext.reload_interval").numericValue());
+        GotText::GotText::setMemoryBudget(Php::ini_get("gottext.memory_budget").numericValue());
+        GotText::GotText::setSharedDir(Php::ini_get("gottext.shared_dir").stringValue());
+        GotText::GotText::collectMissing(Php::ini_get("gottext.collect_missing").boolValue());
+        GotText::GotText::setColumnar(Php::ini_get("gottext.columnar").boolValue());
+        GotText::GotText::setDiffReload(Php::ini_get("gottext.diff_reload").boolValue());
+        GotText::GotText::setDedup(Php::ini_get("gottext.dedup").boolValue());
+        GotText::GotText::setHotProfileDir(Php::ini_get("gottext.hot_profile_dir").stringValue());
+        GotText::GotText::setHugePages(Php::ini_get("gottext.huge_pages").boolValue());
+        GotText::GotText::setPrefault(Php::ini_get("gottext.prefault").boolValue());
+        GotText::GotText::setCompressValues(Php::ini_get("gottext.compress_values").boolValue());
+        GotText::GotText::setBlockCacheSize(Php::ini_get("gottext.block_cache").numericValue());
+        preloadFiles(Php::ini_get("gottext.preload").stringValue());
+    });
+    extension.onShutdown([]{
+        // the reloading threads must not outlive the module
+        GotText::GotText::joinReloads();
+    });
+    extension.onIdle([]{
+        // the changed files noticed by this request are parsed after the script has finished
+        GotTextCustom().reloadDeferred();
+        // the default object is set per request
+        defaultGotText() = GotTextCustom();
+        // the request-interned strings are released
+        LookupCache::get().clear();
+        StringsCache::get().clear();
+    });
+
+    extension.add<setDefault>("gottext_set_default", {
+        Php::ByVal("gottext", "GotText", true, true)
+    });
+    extension.add<getDefault>("gottext_get_default");
+
+#ifdef GOTTEXT_EXT_FUNCTIONS
+    extension.add<funcOne>(GOTTEXT_EXT_FUNC_ONE, {
+        Php::ByVal("msgid", Php::Type::String, true)
+    });
+    extension.add<funcNum>(GOTTEXT_EXT_FUNC_NUM, {
+        Php::ByVal("msgid", Php::Type::String, true),
+        Php::ByVal("msgid_plural", Php::Type::String, true),
+        Php::ByVal("n", Php::Type::Numeric, true)
+    });
+    extension.add<funcCtxOne>(GOTTEXT_EXT_FUNC_CTX_ONE, {
+        Php::ByVal("msgid_ctxt", Php::Type::String, true),
+        Php::ByVal("msgid", Php::Type::String, true)
+    });
+    extension.add<funcCtxNum>(GOTTEXT_EXT_FUNC_CTX_NUM, {
+        Php::ByVal("msgid_ctxt", Php::Type::String, true),
+        Php::ByVal("msgid", Php::Type::String, true),
+        Php::ByVal("msgid_plural", Php::Type::String, true),
+        Php::ByVal("n", Php::Type::Numeric, true)
+    });
+#endif
+
     Php::Class<GotTextExtension> gotTextClass("GotText");
     gotTextClass.method<&GotTextExtension::getInfo>("getInfo");
     gotTextClass.method<&GotTextExtension::__construct>("__construct", {
         Php::ByVal("filename", Php::Type::String, false),
-        Php::ByVal("data", Php::Type::String, false)
+        Php::ByVal("data", Php::Type::Null, false),
+        Php::ByVal("compact", Php::Type::Bool, false)
     });
     gotTextClass.method<&GotTextExtension::reload>("reload", {
         Php::ByVal("filename", Php::Type::String, true)
@@ -469,17 +1252,57 @@ extern "C" PHPCPP_EXPORT void *get_module()
         Php::ByVal("msgid_plural", Php::Type::String, true),
         Php::ByVal("n", Php::Type::Numeric, true)
     });
+    gotTextClass.method<&GotTextExtension::msg>("msg", {
+        Php::ByVal("msgid", Php::Type::String, true),
+        Php::ByVal("msgid_plural", Php::Type::Null, false),
+        Php::ByVal("msgid_ctxt", Php::Type::Null, false)
+    });
+    gotTextClass.method<&GotTextExtension::translateMany>("translateMany", {
+        Php::ByVal("gottexts", Php::Type::Array, true),
+        Php::ByVal("msgid", Php::Type::String, true),
+        Php::ByVal("msgid_plural", Php::Type::Null, false),
+        Php::ByVal("msgid_ctxt", Php::Type::Null, false),
+        Php::ByVal("n", Php::Type::Numeric, false)
+    });
+    gotTextClass.method<&GotTextExtension::loadMany>("loadMany", {
+        Php::ByVal("files", Php::Type::Array, true)
+    });
     gotTextClass.method<&GotTextExtension::getTimeCached>("getTimeCached");
     gotTextClass.method<&GotTextExtension::getFilename>("getFilename");
     gotTextClass.method<&GotTextExtension::getLocaleCode>("getLocaleCode");
     gotTextClass.method<&GotTextExtension::getPluralsCount>("getPluralsCount");
     gotTextClass.method<&GotTextExtension::getStrings>("getStrings");
+    gotTextClass.method<&GotTextExtension::getStringsJson>("getStringsJson");
+    gotTextClass.method<&GotTextExtension::getStringsSlice>("getStringsSlice", {
+        Php::ByVal("dictionary", Php::Type::String, true),
+        Php::ByVal("offset", Php::Type::Numeric, false),
+        Php::ByVal("limit", Php::Type::Numeric, false),
+        Php::ByVal("prefix", Php::Type::String, false),
+        Php::ByVal("context", Php::Type::Null, false)
+    });
     gotTextClass.method<&GotTextExtension::getFilenames>("getFilenames");
+    gotTextClass.method<&GotTextExtension::getStats>("getStats");
+    gotTextClass.method<&GotTextExtension::getLoadProfile>("getLoadProfile");
+    gotTextClass.method<&GotTextExtension::getMemoryUsage>("getMemoryUsage");
+    gotTextClass.method<&GotTextExtension::collectMissing>("collectMissing", {
+        Php::ByVal("enable", Php::Type::Bool, false)
+    });
+    gotTextClass.method<&GotTextExtension::getMissing>("getMissing", {
+        Php::ByVal("clear", Php::Type::Bool, false)
+    });
+    gotTextClass.method<&GotTextExtension::saveHotProfiles>("saveHotProfiles");
     gotTextClass.method<&GotTextExtension::pluralFunc>("pluralFunc", {
         Php::ByVal("n", Php::Type::Numeric, true)
     });
 
     extension.add(std::move(gotTextClass));
 
+    Php::Class<GotTextMessage> messageClass("GotTextMessage");
+    messageClass.method<&GotTextMessage::get>("get", {
+        Php::ByVal("n", Php::Type::Numeric, false)
+    });
+    messageClass.method<&GotTextMessage::__toString>("__toString");
+    extension.add(std::move(messageClass));
+
     return extension;
 }
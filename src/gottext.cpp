@@ -23,13 +23,26 @@
 {*************************************************************************/
 
 #include "gottext.h"
+#include "image.h"
+#include "columns.h"
+#include "charset.h"
+#include "memusage.h"
 
 #include <fstream>
 #include <cstdint>
 #include <algorithm>
 
 #include <cstdio>
+#include <cstring>
+#include <exception>
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <system_error>
+#include <thread>
+
+#include <sys/stat.h>
 
 // Specify the following directive to use boost::regex instead of std::regex.
 #ifdef GOTTEXT_BOOST_REGEX
@@ -38,8 +51,6 @@
     #include <regex>
 #endif
 
-#include <phpcpp.h>
-
 namespace GotText {
 
 #ifndef GOTTEXT_NO_THREADSAFE
@@ -65,10 +76,12 @@ namespace GotText {
 
     struct StrData {
         int index;
+        uint32_t offset; // position of the first string in the file
         std::vector<std::string> strings;
 
-        StrData(int index, std::vector<std::string> &&strings):
+        StrData(int index, uint32_t offset, std::vector<std::string> &&strings):
             index(index),
+            offset(offset),
             strings(std::move(strings)){
         }
 
@@ -78,18 +91,148 @@ namespace GotText {
     };
     using StrDataArr = std::vector<StrData>;
 
-    static LangStorage emptyLangStorage = {{"", Lang()}};
+    const LangEntry GotText::dummyEntry;
     static LangStorage langStorage;
 
+    static std::atomic<time_t> reloadInterval {0};
+    static std::atomic<size_t> memoryBudget {0};
+    static std::atomic<bool> diffReload {true};
+    static std::atomic<bool> dedup {false};
+
+    static std::mutex sharedDirMutex;
+    static std::string sharedDir; // guarded by sharedDirMutex
+    static std::mutex hotProfileDirMutex;
+    static std::string hotProfileDir; // guarded by hotProfileDirMutex
+
+    /*!
+     * Translations that are being reloaded in background.
+     */
+    struct PendingReloads {
+        std::mutex mutex;
+        std::set<std::string> inProgress; /*!< files that are being parsed right now */
+        std::vector<std::pair<std::string, LangDiff>> ready; /*!< parsed files waiting to be put into the storage */
+        std::atomic<bool> hasReady {false};
+        std::map<std::thread::id, std::thread> threads; /*!< the threads that haven't been joined yet */
+        std::vector<std::thread::id> finished; /*!< the threads that have done their work and can be joined */
+        bool stopped = false; /*!< no threads are started after GotText::joinReloads() */
+
+        /*!
+         * Joins the finished threads, so they don't hold their resources until the shutdown.
+         * MUST be called with *mutex* locked.
+         */
+        void joinFinished()
+        {
+            for(std::thread::id id : finished)
+            {
+                auto i = threads.find(id);
+                i->second.join(); // it doesn't lock the mutex anymore
+                threads.erase(i);
+            }
+            finished.clear();
+        }
+    };
+
+    static PendingReloads& pendingReloads()
+    {
+        // never destroyed, because background threads may outlive static objects if joinReloads() is not called
+        static PendingReloads* reloads = new PendingReloads();
+        return *reloads;
+    }
+
+    /*!
+     * Changed files waiting for GotText::reloadDeferred() in the current thread,
+     * and whether they're stored in the compact form.
+     */
+    static std::map<std::string, bool>& deferredReloads()
+    {
+        static thread_local std::map<std::string, bool> reloads;
+        return reloads;
+    }
+
+    /*!
+     * Returns the hotness profile of the translations with the *fingerprint*,
+     * empty if there's none, see GotText::setHotProfileDir().
+     */
+    static HotProfile readHotProfile(const Fingerprint& fingerprint)
+    {
+        std::string dir = GotText::getHotProfileDir();
+        if(dir.empty() || fingerprint.isEmpty())
+            return HotProfile();
+        return HotProfile::read(HotProfile::getPath(dir, fingerprint));
+    }
+
+    /*!
+     * Compiles the translations *l* of the file *filename* into a private image (see Image::create())
+     * and makes *l* refer to this image.
+     * The translations that do not fit into an image (see Image::build()) are left as is.
+     * Throws Exception on error.
+     */
+    static void compile(Lang& l, const std::string& filename, const HotProfile* hot)
+    {
+        std::string data = Image::build(l, filename, l.mtime, l.sourceSize, hot);
+        if(data.empty())
+            return;
+        std::shared_ptr<const Image> image = Image::create(data);
+        if(!image)
+            throw Exception(Exception::UnknownError, 0, filename);
+        Lang compiled = Image::makeLang(image);
+        compiled.mtime = l.mtime;
+        compiled.checked = l.checked;
+        compiled.loadTime = l.loadTime;
+        compiled.profile = l.profile;
+        compiled.fingerprint = l.fingerprint;
+        l = std::move(compiled);
+    }
+
 
     std::string GotText::_(
             const std::string& msgid
             ) const
     {
+        revive();
         GOTTEXT_READ_LOCK
-        auto i = getLang().dictOne.find(msgid);
-        if(i == getLang().dictOne.end())
+        const LangEntry& le = getEntry();
+        const Lang& l = le.lang;
+        if(l.image)
+        {
+            const Image::Entry* e = l.image->find(Image::One, std::string(), msgid);
+            if(!e)
+            {
+                missed(le, LookupCounters::One, nullptr, msgid, nullptr);
+                return msgid;
+            }
+            hit(le, LookupCounters::One, nullptr, msgid);
+            return l.image->getValue(*e);
+        }
+        if(l.columns)
+        {
+            const Columns::Slot* c = l.columns->find(LookupCounters::One, std::string(), msgid);
+            if(!c)
+            {
+                missed(le, LookupCounters::One, nullptr, msgid, nullptr);
+                return msgid;
+            }
+            hit(le, LookupCounters::One, nullptr, msgid);
+            return l.columns->getValue(*c);
+        }
+        if(l.compact)
+        {
+            const Compact::Entry* c = l.compact->find(LookupCounters::One, std::string(), msgid);
+            if(!c)
+            {
+                missed(le, LookupCounters::One, nullptr, msgid, nullptr);
+                return msgid;
+            }
+            hit(le, LookupCounters::One, nullptr, msgid);
+            return l.compact->getValue(*c);
+        }
+        auto i = l.dictOne.find(msgid);
+        if(i == l.dictOne.end())
+        {
+            missed(le, LookupCounters::One, nullptr, msgid, nullptr);
             return msgid;
+        }
+        hit(le, LookupCounters::One, nullptr, msgid);
         return (*i).second;
     }
 
@@ -99,11 +242,51 @@ namespace GotText {
             int n
             ) const
     {
+        revive();
         GOTTEXT_READ_LOCK
-        auto i = getLang().dictNum.find(msgid);
-        if(i == getLang().dictNum.end())
+        const LangEntry& le = getEntry();
+        const Lang& l = le.lang;
+        if(l.image)
+        {
+            const Image::Entry* e = l.image->find(Image::Num, std::string(), msgid);
+            if(!e)
+            {
+                missed(le, LookupCounters::Num, nullptr, msgid, &msgid_plural);
+                return Plural::origFunc(n) ? msgid_plural : msgid;
+            }
+            hit(le, LookupCounters::Num, nullptr, msgid);
+            return l.image->getValue(*e, l.pluralInfo.func(n));
+        }
+        if(l.columns)
+        {
+            const Columns::Slot* c = l.columns->find(LookupCounters::Num, std::string(), msgid);
+            if(!c)
+            {
+                missed(le, LookupCounters::Num, nullptr, msgid, &msgid_plural);
+                return Plural::origFunc(n) ? msgid_plural : msgid;
+            }
+            hit(le, LookupCounters::Num, nullptr, msgid);
+            return l.columns->getValue(*c, l.pluralInfo.func(n));
+        }
+        if(l.compact)
+        {
+            const Compact::Entry* c = l.compact->find(LookupCounters::Num, std::string(), msgid);
+            if(!c)
+            {
+                missed(le, LookupCounters::Num, nullptr, msgid, &msgid_plural);
+                return Plural::origFunc(n) ? msgid_plural : msgid;
+            }
+            hit(le, LookupCounters::Num, nullptr, msgid);
+            return l.compact->getValue(*c, l.pluralInfo.func(n));
+        }
+        auto i = l.dictNum.find(msgid);
+        if(i == l.dictNum.end())
+        {
+            missed(le, LookupCounters::Num, nullptr, msgid, &msgid_plural);
             return Plural::origFunc(n) ? msgid_plural : msgid;
-        return (*i).second[getLang().pluralInfo.func(n)];
+        }
+        hit(le, LookupCounters::Num, nullptr, msgid);
+        return (*i).second[l.pluralInfo.func(n)];
     }
 
     std::string GotText::_p(
@@ -111,13 +294,56 @@ namespace GotText {
             const std::string& msgid
             ) const
     {
+        revive();
         GOTTEXT_READ_LOCK
-        auto ic = getLang().dictCtxOne.find(msgid_ctxt);
-        if(ic == getLang().dictCtxOne.end())
+        const LangEntry& le = getEntry();
+        const Lang& l = le.lang;
+        if(l.image)
+        {
+            const Image::Entry* e = l.image->find(Image::CtxOne, msgid_ctxt, msgid);
+            if(!e)
+            {
+                missed(le, LookupCounters::CtxOne, &msgid_ctxt, msgid, nullptr);
+                return msgid;
+            }
+            hit(le, LookupCounters::CtxOne, &msgid_ctxt, msgid);
+            return l.image->getValue(*e);
+        }
+        if(l.columns)
+        {
+            const Columns::Slot* c = l.columns->find(LookupCounters::CtxOne, msgid_ctxt, msgid);
+            if(!c)
+            {
+                missed(le, LookupCounters::CtxOne, &msgid_ctxt, msgid, nullptr);
+                return msgid;
+            }
+            hit(le, LookupCounters::CtxOne, &msgid_ctxt, msgid);
+            return l.columns->getValue(*c);
+        }
+        if(l.compact)
+        {
+            const Compact::Entry* c = l.compact->find(LookupCounters::CtxOne, msgid_ctxt, msgid);
+            if(!c)
+            {
+                missed(le, LookupCounters::CtxOne, &msgid_ctxt, msgid, nullptr);
+                return msgid;
+            }
+            hit(le, LookupCounters::CtxOne, &msgid_ctxt, msgid);
+            return l.compact->getValue(*c);
+        }
+        auto ic = l.dictCtxOne.find(msgid_ctxt);
+        if(ic == l.dictCtxOne.end())
+        {
+            missed(le, LookupCounters::CtxOne, &msgid_ctxt, msgid, nullptr);
             return msgid;
+        }
         auto i = (*ic).second.find(msgid);
         if(i == (*ic).second.end())
+        {
+            missed(le, LookupCounters::CtxOne, &msgid_ctxt, msgid, nullptr);
             return msgid;
+        }
+        hit(le, LookupCounters::CtxOne, &msgid_ctxt, msgid);
         return (*i).second;
     }
 
@@ -128,176 +354,1204 @@ namespace GotText {
             int n
             ) const
     {
+        revive();
         GOTTEXT_READ_LOCK
-        auto ic = getLang().dictCtxNum.find(msgid_ctxt);
-        if(ic == getLang().dictCtxNum.end())
+        const LangEntry& le = getEntry();
+        const Lang& l = le.lang;
+        if(l.image)
+        {
+            const Image::Entry* e = l.image->find(Image::CtxNum, msgid_ctxt, msgid);
+            if(!e)
+            {
+                missed(le, LookupCounters::CtxNum, &msgid_ctxt, msgid, &msgid_plural);
+                return Plural::origFunc(n) ? msgid_plural : msgid;
+            }
+            hit(le, LookupCounters::CtxNum, &msgid_ctxt, msgid);
+            return l.image->getValue(*e, l.pluralInfo.func(n));
+        }
+        if(l.columns)
+        {
+            const Columns::Slot* c = l.columns->find(LookupCounters::CtxNum, msgid_ctxt, msgid);
+            if(!c)
+            {
+                missed(le, LookupCounters::CtxNum, &msgid_ctxt, msgid, &msgid_plural);
+                return Plural::origFunc(n) ? msgid_plural : msgid;
+            }
+            hit(le, LookupCounters::CtxNum, &msgid_ctxt, msgid);
+            return l.columns->getValue(*c, l.pluralInfo.func(n));
+        }
+        if(l.compact)
+        {
+            const Compact::Entry* c = l.compact->find(LookupCounters::CtxNum, msgid_ctxt, msgid);
+            if(!c)
+            {
+                missed(le, LookupCounters::CtxNum, &msgid_ctxt, msgid, &msgid_plural);
+                return Plural::origFunc(n) ? msgid_plural : msgid;
+            }
+            hit(le, LookupCounters::CtxNum, &msgid_ctxt, msgid);
+            return l.compact->getValue(*c, l.pluralInfo.func(n));
+        }
+        auto ic = l.dictCtxNum.find(msgid_ctxt);
+        if(ic == l.dictCtxNum.end())
+        {
+            missed(le, LookupCounters::CtxNum, &msgid_ctxt, msgid, &msgid_plural);
             return Plural::origFunc(n) ? msgid_plural : msgid;
+        }
         auto i = (*ic).second.find(msgid);
         if(i == (*ic).second.end())
+        {
+            missed(le, LookupCounters::CtxNum, &msgid_ctxt, msgid, &msgid_plural);
             return Plural::origFunc(n) ? msgid_plural : msgid;
-        return (*i).second[getLang().pluralInfo.func(n)];
+        }
+        hit(le, LookupCounters::CtxNum, &msgid_ctxt, msgid);
+        return (*i).second[l.pluralInfo.func(n)];
     }
 
-    time_t GotText::getTimestamp() const
+    Message::Message(
+            LookupCounters::Dict d,
+            const std::string& ctx,
+            const std::string& msgid,
+            const std::string& msgidPlural)
+        : dict(d), msgid(msgid)
     {
-        return std::chrono::seconds(std::time(nullptr)).count();
+        if(hasCtx())
+            this->ctx = ctx;
+        if(isPlural())
+            this->msgidPlural = msgidPlural;
     }
 
-    GotText::GotText():
-        lang(emptyLangStorage.begin()) // this allows not to check for iterator validity every request
+    std::string GotText::translate(const Message &m, int n) const
     {
+        revive();
+        GOTTEXT_READ_LOCK
+        const LangEntry& le = getEntry();
+        if(m.entry != &le || m.version != le.version)
+            resolve(m, le);
+        if(!m.found)
+        {
+            missed(le, m.dict,
+                   m.hasCtx() ? &m.ctx : nullptr,
+                   m.msgid,
+                   m.isPlural() ? &m.msgidPlural : nullptr);
+            if(m.isPlural() && Plural::origFunc(n))
+                return m.msgidPlural;
+            return m.msgid;
+        }
+        hit(le, m.dict, m.hasCtx() ? &m.ctx : nullptr, m.msgid);
+        if(!m.isPlural())
+            return m.values[0];
+        return m.values[m.pluralInfo.func(n)];
     }
 
-    GotText::GotText(const GotText &that)
+    void GotText::resolve(const Message &m, const LangEntry &le)
     {
-        GOTTEXT_WRITE_LOCK
-        lang = that.lang;
-    }
+        const Lang& l = le.lang;
+        m.entry = &le;
+        m.version = le.version;
+        m.found = false;
+        m.values.clear();
+        m.pluralInfo = l.pluralInfo;
 
-    void GotText::load(const std::string& filename, bool forceReload)
-    {
-        if(forceReload)
+        if(l.image)
         {
-            GOTTEXT_WRITE_LOCK
-            loadFile(filename);
+            const Image::Entry* e = l.image->find(static_cast<Image::Kind>(m.dict), m.ctx, m.msgid);
+            if(!e)
+                return;
+            if(m.isPlural())
+            {
+                for(uint32_t f=0; f<e->value.len; f++)
+                    m.values.push_back(l.image->getValue(*e, f));
+            }
+            else
+            {
+                m.values.push_back(l.image->getValue(*e));
+            }
+            m.found = true;
+            return;
         }
-        else
+
+        if(l.columns)
         {
-            GOTTEXT_READ_UPGRADE_LOCK
-            auto i = langStorage.find(filename);
-            if(i == langStorage.end() || (*i).second.isDummy())
-            {
-                GOTTEXT_UPGRADE_LOCK_TO_WRITE
-#ifndef GOTTEXT_NO_THREADSAFE
-                // check again to mitigate a race condition from the previous comparison
-                LangStorage::iterator i = langStorage.find(filename);
-                if(i == langStorage.end() || (*i).second.isDummy())
-                {
-                    loadFile(filename);
-                    return;
-                }
-#else
-                loadFile(filename);
+            const Columns::Slot* c = l.columns->find(m.dict, m.ctx, m.msgid);
+            if(!c)
                 return;
-#endif
-            }
-            lang = i;
+            for(uint32_t f=0; f<c->count; f++)
+                m.values.push_back(l.columns->getValue(*c, f));
+            m.found = true;
+            return;
         }
-    }
 
-    void GotText::load(const std::string &filename, std::istream &stream)
-    {
-        GOTTEXT_WRITE_LOCK
-        loadStream(stream, filename);
-    }
+        if(l.compact)
+        {
+            const Compact::Entry* c = l.compact->find(m.dict, m.ctx, m.msgid);
+            if(!c)
+                return;
+            size_t count = l.compact->countForms(*c);
+            for(size_t f=0; f<count; f++)
+                m.values.push_back(l.compact->getValue(*c, f));
+            m.found = true;
+            return;
+        }
 
-    void GotText::unload(const std::string &filename)
-    {
-        GOTTEXT_WRITE_LOCK
-        auto i = langStorage.find(filename);
-        if(i == langStorage.end())
+        size_t count;
+        const std::string* forms = findInDicts(l, m, count);
+        if(!forms)
             return;
-        (*i).second.swap(Lang());
+        m.values.assign(forms, forms + count);
+        m.found = true;
     }
 
-    bool GotText::isLoaded(const std::string& filename)
+    void GotText::translateMany(
+            const std::vector<const GotText*>& objects,
+            const Message &m,
+            int n,
+            std::vector<std::string> &result)
     {
-        auto i = langStorage.find(filename);
-        return i != langStorage.end() && !(*i).second.isDummy();
-    }
+        for(const GotText* g : objects)
+            g->revive();
+        result.reserve(result.size() + objects.size());
 
-    const LangStorage &GotText::getStorage()
-    {
-        return langStorage;
-    }
+        Image::Kind kind = static_cast<Image::Kind>(m.dict);
+        bool hasImageHash = false;
+        uint64_t imageHash = 0;
+        bool hasId = false;
+        uint32_t id = MessageIds::NONE;
 
-    static uint32_t readInt(std::istream& f)
-    {
-        uint32_t result = 0;
-        for(size_t a=0; a<sizeof(result); a++)
-            result += f.get() << (a*8);
-        return result;
+        GOTTEXT_READ_LOCK
+        for(const GotText* g : objects)
+        {
+            const LangEntry& le = g->getEntry();
+            const Lang& l = le.lang;
+            size_t form = m.isPlural() ? l.pluralInfo.func(n) : 0;
+            if(l.image)
+            {
+                if(!hasImageHash)
+                {
+                    imageHash = Image::hashKey(kind, m.ctx, m.msgid);
+                    hasImageHash = true;
+                }
+                const Image::Entry* e = l.image->find(kind, m.ctx, m.msgid, imageHash);
+                if(e)
+                {
+                    hit(le, m.dict, m.hasCtx() ? &m.ctx : nullptr, m.msgid);
+                    result.push_back(l.image->getValue(*e, form));
+                    continue;
+                }
+            }
+            else if(l.columns)
+            {
+                if(!hasId)
+                {
+                    id = langStorage.getIds().find(m.dict, m.ctx, m.msgid);
+                    hasId = true;
+                }
+                const Columns::Slot* c = l.columns->get(id);
+                if(c)
+                {
+                    hit(le, m.dict, m.hasCtx() ? &m.ctx : nullptr, m.msgid);
+                    result.push_back(l.columns->getValue(*c, form));
+                    continue;
+                }
+            }
+            else if(l.compact)
+            {
+                const Compact::Entry* c = l.compact->find(m.dict, m.ctx, m.msgid);
+                if(c)
+                {
+                    hit(le, m.dict, m.hasCtx() ? &m.ctx : nullptr, m.msgid);
+                    result.push_back(l.compact->getValue(*c, form));
+                    continue;
+                }
+            }
+            else
+            {
+                size_t count;
+                const std::string* forms = findInDicts(l, m, count);
+                if(forms)
+                {
+                    hit(le, m.dict, m.hasCtx() ? &m.ctx : nullptr, m.msgid);
+                    result.push_back(forms[form]);
+                    continue;
+                }
+            }
+            missed(le, m.dict,
+                   m.hasCtx() ? &m.ctx : nullptr,
+                   m.msgid,
+                   m.isPlural() ? &m.msgidPlural : nullptr);
+            result.push_back(m.isPlural() && Plural::origFunc(n) ? m.msgidPlural : m.msgid);
+        }
     }
 
-    static const StrIndexArr readStrTable(std::istream& f, uint32_t offset, uint32_t nStrings)
+    const std::string* GotText::findInDicts(const Lang &l, const Message &m, size_t &count)
     {
-        StrIndexArr indexArr;
-        f.seekg(offset);
-        for(uint32_t a=0; a<nStrings; a++)
-            indexArr.emplace_back(a, readInt(f), readInt(f));
-        return indexArr;
+        const DictOne* dictOne = nullptr;
+        const DictNum* dictNum = nullptr;
+        switch(m.dict)
+        {
+            case LookupCounters::One:
+                dictOne = &l.dictOne;
+                break;
+
+            case LookupCounters::Num:
+                dictNum = &l.dictNum;
+                break;
+
+            case LookupCounters::CtxOne:
+            {
+                auto ic = l.dictCtxOne.find(m.ctx);
+                if(ic != l.dictCtxOne.end())
+                    dictOne = &(*ic).second;
+                break;
+            }
+
+            case LookupCounters::CtxNum:
+            {
+                auto ic = l.dictCtxNum.find(m.ctx);
+                if(ic != l.dictCtxNum.end())
+                    dictNum = &(*ic).second;
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        if(dictOne)
+        {
+            auto i = dictOne->find(m.msgid);
+            if(i == dictOne->end())
+                return nullptr;
+            count = 1;
+            return &(*i).second;
+        }
+        if(dictNum)
+        {
+            auto i = dictNum->find(m.msgid);
+            if(i == dictNum->end() || (*i).second.empty())
+                return nullptr;
+            count = (*i).second.size();
+            return (*i).second.data();
+        }
+        return nullptr;
     }
 
-    static std::vector<std::string> readStrings(const StrIndex& strIndex, std::istream& f)
+    time_t GotText::getTimestamp() const
     {
-        f.seekg(strIndex.offset);
-        std::vector<std::string> strings;
-        uint32_t p = strIndex.offset;
-        uint32_t end = p + strIndex.len + 1;
-        do
-        {
-            std::string s;
-            std::getline(f, s, '\0');
-            p = p + s.size() + 1;
-            strings.emplace_back(std::move(s));
-        }while(p != end);
-        return strings;
+        return std::chrono::seconds(std::time(nullptr)).count();
     }
 
-    static const StrDataArr readStrings(StrIndexArr& indexArr, std::istream& f)
+    GotText::GotText():
+        entry(&dummyEntry), // this allows not to check for pointer validity every request
+        generation(dummyEntry.generation)
     {
-        std::sort(indexArr.begin(), indexArr.end());
-        StrDataArr dataArr;
-        for(StrIndex& strIndex : indexArr)
-            dataArr.emplace_back(strIndex.index, readStrings(strIndex, f));
-        std::sort(dataArr.begin(), dataArr.end());
-        return dataArr;
     }
 
-    void GotText::setLang(const std::string& filename, Lang &&other)
+    void GotText::load(const std::string& filename, bool forceReload, bool compact)
     {
-        lang = langStorage.find(filename);
-        if(lang == langStorage.end())
+        if(pendingReloads().hasReady.load(std::memory_order_acquire))
+            applyPendingReloads();
+
+        this->compact = compact;
+        Compact::Use useCompact(compact);
+
+        if(forceReload)
         {
-            lang = langStorage.emplace(
-                filename,
-                std::move(other)
-            ).first;
+            GOTTEXT_WRITE_LOCK
+            loadFile(filename, true);
         }
         else
         {
-            (*lang).second.swap(std::move(other));
+            bool wasCompact;
+            {
+                GOTTEXT_READ_UPGRADE_LOCK
+                LangEntry* e = langStorage.find(filename);
+                if(!e || e->lang.isDummy())
+                {
+                    GOTTEXT_UPGRADE_LOCK_TO_WRITE
+#ifndef GOTTEXT_NO_THREADSAFE
+                    // check again to mitigate a race condition from the previous comparison
+                    e = langStorage.find(filename);
+                    if(!e || e->lang.isDummy())
+                    {
+                        loadFile(filename);
+                        return;
+                    }
+#else
+                    loadFile(filename);
+                    return;
+#endif
+                }
+                // only one thread can hold the upgrade lock, so it's safe to modify the eviction order;
+                // the preloaded entries are not modified to keep their memory pages shared
+                langStorage.use(*e);
+                setEntry(*e);
+
+                if(!isOutdated(*e))
+                    return;
+                // the file is reloaded in the same form
+                wasCompact = e->lang.compact != nullptr;
+                if(canLoadInBackground())
+                {
+                    reloadInBackground(filename, wasCompact);
+                    return;
+                }
+                if(isReloadDeferred())
+                {
+                    deferredReloads()[filename] = wasCompact;
+                    return;
+                }
+            }
+            // isOutdated() has updated Lang::checked, so the other threads do not parse the file again
+            reloadOutdated(filename, wasCompact);
         }
-        (*lang).second.time = getTimestamp();
     }
 
-    void GotText::loadFile(const std::string& filename)
+    void GotText::reloadOutdated(const std::string &filename, bool compact)
     {
-        errno = 0;
-        setLang(filename, loadFromFile(filename));
+        Compact::Use keepCompact(compact);
+        LangDiff diff;
+        try{
+            if(!parseDiffUnlocked(filename, diff))
+            {
+                diff = LangDiff();
+                diff.lang = parseFile(filename);
+                diff.full = true;
+            }
+        }catch(const Exception &e){
+            return; // keep the old version, try again after the next interval
+        }
+
+        GOTTEXT_WRITE_LOCK
+        LangEntry* e = langStorage.find(filename);
+        if(!e || e->lang.isDummy())
+            return;
+        if(!diff.full && e->version != diff.version)
+            return; // replaced while it was being compared, the file will be checked again after the next interval
+        setDiff(*e, std::move(diff));
     }
 
-    void GotText::loadStream(std::istream &s, const std::string& filename)
+    void GotText::reloadDeferred()
     {
-        errno = 0;
-        setLang(filename, loadFromStream(s, filename));
+        std::map<std::string, bool> reloads;
+        std::swap(reloads, deferredReloads());
+        for(const auto& r : reloads)
+            reloadOutdated(r.first, r.second);
     }
 
-    Lang GotText::loadFromFile(const std::string& filename)
+    void GotText::load(const std::string &filename, std::istream &stream, bool compact)
     {
-        std::ifstream f(filename, std::ifstream::binary);
-        if(!f)
-            throw Exception(Exception::ReadError);
-        f.exceptions(std::ifstream::failbit | std::ifstream::badbit | std::ifstream::eofbit);
-        try{
-            return loadFromStream(f, filename);
-        }catch(std::ios_base::failure &e){
-            throw Exception(Exception::ReadError, f);
-        }
+        Compact::Use useCompact(compact);
+        GOTTEXT_WRITE_LOCK
+        loadStream(stream, filename);
     }
 
-    Lang GotText::loadFromStream(std::istream &f, const std::string& /*filename*/)
+    void GotText::loadMany(const std::vector<std::string> &filenames, size_t *failed)
     {
+        struct Loaded {
+            bool skip = false; // already loaded or listed twice
+            Fingerprint fingerprint;
+            bool shared = false; // the same contents are already loaded under another name
+            time_t mtime = 0;
+            uint64_t loadTime = 0;
+            Lang lang;
+            std::exception_ptr error;
+        };
+        std::vector<Loaded> loaded(filenames.size());
+        {
+            std::set<std::string> unique;
+            GOTTEXT_READ_LOCK
+            for(size_t a=0; a<filenames.size(); a++)
+            {
+                LangEntry* e = langStorage.find(filenames[a]);
+                loaded[a].skip = (e && !e->lang.isDummy()) || !unique.insert(filenames[a]).second;
+            }
+        }
+
+        std::atomic<size_t> next {0};
+        auto work = [&]{
+            for(size_t a; (a = next.fetch_add(1, std::memory_order_relaxed)) < filenames.size();)
+            {
+                Loaded& l = loaded[a];
+                if(l.skip)
+                    continue;
+                try{
+                    if(isDedup())
+                    {
+                        l.mtime = getModificationTime(filenames[a]);
+                        auto start = std::chrono::steady_clock::now();
+                        l.fingerprint = fingerprintFile(filenames[a]);
+                        l.loadTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start).count();
+                        GOTTEXT_READ_LOCK
+                        l.shared = langStorage.findSame(l.fingerprint, nullptr) != nullptr;
+                    }
+                    if(!l.shared)
+                        l.lang = parseFile(filenames[a], false, l.fingerprint.isEmpty() ? nullptr : &l.fingerprint);
+                }catch(...){
+                    l.error = std::current_exception();
+                }
+            }
+        };
+
+        // the calling thread is one of the workers
+        std::vector<std::thread> threads;
+        if(canLoadInBackground())
+        {
+            size_t nThreads = std::min<size_t>(filenames.size(), std::thread::hardware_concurrency());
+            try{
+                for(size_t a=1; a<nThreads; a++)
+                    threads.emplace_back(work);
+            }catch(const std::system_error &e){
+                // continue with the threads that were started
+            }
+        }
+        work();
+        for(std::thread& t : threads)
+            t.join();
+
+        for(size_t a=0; a<loaded.size(); a++)
+        {
+            if(loaded[a].error)
+            {
+                if(failed)
+                    *failed = a;
+                std::rethrow_exception(loaded[a].error);
+            }
+        }
+
+        for(;;)
+        {
+            std::vector<size_t> unshared;
+            {
+                GOTTEXT_WRITE_LOCK
+                // the files which translations were unloaded in the meantime are parsed before anything is published
+                for(size_t a=0; a<loaded.size(); a++)
+                {
+                    const Loaded& l = loaded[a];
+                    if(!l.skip && l.shared && !langStorage.findSame(l.fingerprint, nullptr))
+                        unshared.push_back(a);
+                }
+                if(unshared.empty())
+                {
+                    time_t now = getTimestamp();
+                    for(size_t a=0; a<loaded.size(); a++)
+                    {
+                        Loaded& l = loaded[a];
+                        if(l.skip)
+                            continue;
+                        LangEntry* e = langStorage.find(filenames[a]);
+                        if(e && !e->lang.isDummy())
+                            continue; // loaded by another thread in the meantime
+                        // the files with the same contents in the list are shared too
+                        Lang lang;
+                        if(l.shared)
+                            lang = shareLang(*langStorage.findSame(l.fingerprint, e), l.mtime, l.loadTime);
+                        else if(LangEntry* same = langStorage.findSame(l.lang.fingerprint, e))
+                            lang = shareLang(*same, l.lang.mtime, l.lang.loadTime);
+                        else
+                            lang = std::move(l.lang);
+                        LangEntry& loadedEntry = langStorage.set(filenames[a], std::move(lang));
+                        loadedEntry.lang.time = now;
+                        loadedEntry.fromFile = true;
+                        loadedEntry.pinned = false;
+                        langStorage.use(loadedEntry);
+                    }
+                    if(size_t budget = getMemoryBudget())
+                        langStorage.evict(budget, nullptr);
+                    return;
+                }
+            }
+
+            // the storage is not locked while parsing, then the check is repeated;
+            // the parsed files are not shared anymore, so it's done at most once
+            for(size_t a : unshared)
+            {
+                Loaded& l = loaded[a];
+                try{
+                    l.lang = parseFile(filenames[a], false, &l.fingerprint);
+                    l.shared = false;
+                }catch(...){
+                    if(failed)
+                        *failed = a;
+                    throw;
+                }
+            }
+        }
+    }
+
+    void GotText::unload(const std::string &filename)
+    {
+        GOTTEXT_WRITE_LOCK
+        LangEntry* e = langStorage.find(filename);
+        if(!e)
+            return;
+        if(getMemoryBudget())
+            langStorage.remove(*e);
+        else
+            langStorage.clear(*e);
+    }
+
+    void GotText::preload(const std::string &filename)
+    {
+        GotText loader;
+        Lang other = loader.parseFile(filename);
+        if(!other.image)
+        {
+            HotProfile hot = readHotProfile(other.fingerprint);
+            compile(other, filename, hot.isEmpty() ? nullptr : &hot);
+        }
+
+        GOTTEXT_WRITE_LOCK
+        loader.setLang(filename, std::move(other), true);
+        LangEntry* e = langStorage.find(filename);
+        e->pinned = true;
+        langStorage.use(*e);
+    }
+
+    void GotText::setMemoryBudget(size_t bytes)
+    {
+        memoryBudget.store(bytes, std::memory_order_relaxed);
+        if(bytes)
+        {
+            GOTTEXT_WRITE_LOCK
+            langStorage.evict(bytes, nullptr);
+        }
+    }
+
+    size_t GotText::getMemoryBudget()
+    {
+        return memoryBudget.load(std::memory_order_relaxed);
+    }
+
+    void GotText::setColumnar(bool enable)
+    {
+        GOTTEXT_WRITE_LOCK
+        langStorage.setColumnar(enable);
+    }
+
+    bool GotText::isColumnar()
+    {
+        GOTTEXT_READ_LOCK
+        return langStorage.isColumnar();
+    }
+
+    void GotText::setDiffReload(bool enable)
+    {
+        diffReload.store(enable, std::memory_order_relaxed);
+    }
+
+    bool GotText::isDiffReload()
+    {
+        return diffReload.load(std::memory_order_relaxed);
+    }
+
+    void GotText::setDedup(bool enable)
+    {
+        dedup.store(enable, std::memory_order_relaxed);
+    }
+
+    bool GotText::isDedup()
+    {
+        return dedup.load(std::memory_order_relaxed);
+    }
+
+    void GotText::reviveEvicted() const
+    {
+        bool unloaded;
+        {
+            GOTTEXT_READ_LOCK
+            if(entry->generation.load(std::memory_order_relaxed) == generation)
+                return;
+            // the entry may have been reused and evicted several times since then,
+            // so the file is looked up by its name
+            unloaded = langStorage.isUnloaded(filename);
+        }
+        if(!unloaded)
+        {
+            try{
+                // the object is logically the same, only the storage entry is changed
+                const_cast<GotText*>(this)->load(filename, false, compact);
+                return;
+            }catch(const Exception &e){
+            }
+        }
+        entry = &dummyEntry;
+        generation = dummyEntry.generation;
+    }
+
+    void GotText::setReloadInterval(time_t seconds)
+    {
+        reloadInterval.store(seconds, std::memory_order_relaxed);
+    }
+
+    time_t GotText::getReloadInterval()
+    {
+        return reloadInterval.load(std::memory_order_relaxed);
+    }
+
+    void GotText::setSharedDir(const std::string &dir)
+    {
+        std::lock_guard<std::mutex> guard(sharedDirMutex);
+        sharedDir = dir;
+        while(sharedDir.size() > 1 && sharedDir.back() == '/')
+            sharedDir.pop_back();
+    }
+
+    std::string GotText::getSharedDir()
+    {
+        std::lock_guard<std::mutex> guard(sharedDirMutex);
+        return sharedDir;
+    }
+
+    void GotText::setHotProfileDir(const std::string &dir)
+    {
+        std::lock_guard<std::mutex> lock(hotProfileDirMutex);
+        hotProfileDir = dir;
+        HotCounters::setEnabled(!dir.empty());
+    }
+
+    std::string GotText::getHotProfileDir()
+    {
+        std::lock_guard<std::mutex> lock(hotProfileDirMutex);
+        return hotProfileDir;
+    }
+
+    void GotText::setHugePages(bool enable)
+    {
+        Image::setHugePages(enable);
+    }
+
+    bool GotText::isHugePages()
+    {
+        return Image::isHugePages();
+    }
+
+    void GotText::setPrefault(bool enable)
+    {
+        Image::setPrefault(enable);
+    }
+
+    bool GotText::isPrefault()
+    {
+        return Image::isPrefault();
+    }
+
+    void GotText::setCompressValues(bool enable)
+    {
+        Compact::setCompressValues(enable);
+    }
+
+    bool GotText::isCompressValues()
+    {
+        return Compact::isCompressValues();
+    }
+
+    void GotText::setBlockCacheSize(size_t blocks)
+    {
+        Compact::setBlockCacheSize(blocks);
+    }
+
+    size_t GotText::getBlockCacheSize()
+    {
+        return Compact::getBlockCacheSize();
+    }
+
+    size_t GotText::saveHotProfiles()
+    {
+        std::string dir = getHotProfileDir();
+        if(dir.empty())
+            return 0;
+
+        // the files with the same contents share one profile
+        std::vector<std::pair<Fingerprint, HotProfile>> profiles;
+        {
+            GOTTEXT_READ_LOCK
+            for(const auto& i : langStorage.getIndex())
+            {
+                const LangEntry& e = langStorage.getEntry(i.second);
+                if(e.lang.isDummy() || e.lang.fingerprint.isEmpty())
+                    continue;
+                auto p = std::find_if(profiles.begin(), profiles.end(), [&e](const std::pair<Fingerprint, HotProfile>& p){
+                    return p.first == e.lang.fingerprint;
+                });
+                if(p == profiles.end())
+                    p = profiles.emplace(profiles.end(), e.lang.fingerprint, HotProfile());
+                e.hotness.collect((*p).second);
+                e.hotness.reset();
+            }
+        }
+
+        size_t saved = 0;
+        for(const auto& p : profiles)
+        {
+            if(p.second.isEmpty())
+                continue;
+            std::string path = HotProfile::getPath(dir, p.first);
+            HotProfile profile = HotProfile::read(path);
+            profile.merge(p.second);
+            if(profile.write(path))
+                saved++;
+        }
+        return saved;
+    }
+
+    time_t GotText::getModificationTime(const std::string& filename) const
+    {
+        struct stat st;
+        if(::stat(filename.c_str(), &st))
+            return 0;
+        return st.st_mtime;
+    }
+
+    bool GotText::canLoadInBackground() const
+    {
+        return true;
+    }
+
+    bool GotText::isReloadDeferred() const
+    {
+        return false;
+    }
+
+    bool GotText::isOutdated(LangEntry& e) const
+    {
+        time_t interval = getReloadInterval();
+        if(!interval)
+            return false;
+        Lang& l = e.lang;
+        if(!l.mtime)
+            return false;
+        time_t now = std::time(nullptr);
+        if(now - l.checked < interval)
+            return false;
+        // only one thread can hold the upgrade lock, so it's safe to modify this field
+        l.checked = now;
+        time_t mtime = getModificationTime(e.filename);
+        return mtime && mtime != l.mtime;
+    }
+
+    void GotText::reloadInBackground(const std::string& filename, bool compact)
+    {
+        PendingReloads& reloads = pendingReloads();
+        std::lock_guard<std::mutex> guard(reloads.mutex);
+        reloads.joinFinished();
+        if(reloads.stopped || !reloads.inProgress.insert(filename).second)
+            return;
+
+        try{
+            // the thread can't finish before it's added to the list, since it locks the mutex at the end
+            std::thread thread([filename, compact]{
+                PendingReloads& reloads = pendingReloads();
+                Compact::Use useCompact(compact);
+                GotText loader;
+                LangDiff diff;
+                bool ok = true;
+                try{
+                    bool found = false;
+#ifndef GOTTEXT_NO_THREADSAFE
+                    found = loader.parseDiffUnlocked(filename, diff);
+#endif
+                    if(!found)
+                    {
+                        diff = LangDiff();
+                        diff.lang = loader.parseFile(filename);
+                        diff.full = true;
+                    }
+                }catch(...){
+                    ok = false; // keep the old version, try again after the next interval
+                }
+                std::lock_guard<std::mutex> guard(reloads.mutex);
+                reloads.inProgress.erase(filename);
+                reloads.finished.push_back(std::this_thread::get_id());
+                if(ok)
+                {
+                    reloads.ready.emplace_back(filename, std::move(diff));
+                    reloads.hasReady.store(true, std::memory_order_release);
+                }
+            });
+            std::thread::id id = thread.get_id();
+            reloads.threads.emplace(id, std::move(thread));
+        }catch(const std::system_error &e){
+            reloads.inProgress.erase(filename);
+        }
+    }
+
+    void GotText::joinReloads()
+    {
+        PendingReloads& reloads = pendingReloads();
+        std::map<std::thread::id, std::thread> threads;
+        {
+            std::lock_guard<std::mutex> guard(reloads.mutex);
+            reloads.stopped = true;
+            std::swap(threads, reloads.threads);
+        }
+        // the threads lock the mutex at the end, so they're joined without it
+        for(auto& t : threads)
+            t.second.join();
+        std::lock_guard<std::mutex> guard(reloads.mutex);
+        reloads.finished.clear();
+    }
+
+    void GotText::applyPendingReloads()
+    {
+        std::vector<std::pair<std::string, LangDiff>> ready;
+        {
+            PendingReloads& reloads = pendingReloads();
+            std::lock_guard<std::mutex> guard(reloads.mutex);
+            std::swap(ready, reloads.ready);
+            reloads.hasReady.store(false, std::memory_order_relaxed);
+        }
+        if(ready.empty())
+            return;
+
+        time_t now = getTimestamp();
+        GOTTEXT_WRITE_LOCK
+        for(auto& r : ready)
+        {
+            LangEntry* e = langStorage.find(r.first);
+            if(!e || e->lang.isDummy())
+                continue; // unloaded while it was being parsed
+            if(r.second.full)
+                langStorage.set(r.first, std::move(r.second.lang));
+            else if(e->version == r.second.version)
+                langStorage.patch(*e, std::move(r.second));
+            else
+                continue; // replaced while it was being compared, the file will be checked again after the next interval
+            e->lang.time = now;
+            e->pinned = false;
+            langStorage.use(*e);
+        }
+        if(size_t budget = getMemoryBudget())
+            langStorage.evict(budget, nullptr);
+    }
+
+    bool GotText::isLoaded(const std::string& filename)
+    {
+        LangEntry* e = langStorage.find(filename);
+        return e && !e->lang.isDummy();
+    }
+
+    void GotText::collectMissing(bool enable)
+    {
+        MissingCollector::setEnabled(enable);
+    }
+
+    bool GotText::isCollectingMissing()
+    {
+        return MissingCollector::isEnabled();
+    }
+
+    std::string GotText::getMissing(bool clear)
+    {
+        if(clear)
+        {
+            GOTTEXT_WRITE_LOCK
+            std::string pot = MissingCollector::toPot(MissingCollector::getRecords());
+            MissingCollector::clear();
+            return pot;
+        }
+        GOTTEXT_READ_LOCK
+        return MissingCollector::toPot(MissingCollector::getRecords());
+    }
+
+    std::vector<LangStats> GotText::getStats()
+    {
+        std::vector<LangStats> result;
+        GOTTEXT_READ_LOCK
+        for(const auto& i : langStorage.getIndex())
+        {
+            const LangEntry& e = langStorage.getEntry(i.second);
+            LangStats stats;
+            stats.filename = e.filename;
+            stats.locale = e.lang.locale;
+            stats.loaded = !e.lang.isDummy();
+            stats.preloaded = e.pinned;
+            for(size_t d=0; d<LookupCounters::DictCount; d++)
+            {
+                LookupCounters::Dict dict = static_cast<LookupCounters::Dict>(d);
+                stats.hits[d] = e.counters.getHits(dict);
+                stats.misses[d] = e.counters.getMisses(dict);
+                stats.entries[d] = e.lang.countEntries(dict);
+            }
+            stats.loads = e.loads;
+            stats.loadTime = e.loadTime;
+            stats.lastLoadTime = e.lang.loadTime;
+            stats.bytesRead = e.bytesRead;
+            stats.memoryUsage = e.memoryUsage;
+            result.push_back(std::move(stats));
+        }
+        return result;
+    }
+
+    const LangStorage &GotText::getStorage()
+    {
+        return langStorage;
+    }
+
+    static uint32_t readInt(std::istream& f)
+    {
+        uint32_t result = 0;
+        for(size_t a=0; a<sizeof(result); a++)
+            result += f.get() << (a*8);
+        return result;
+    }
+
+    static const StrIndexArr readStrTable(std::istream& f, uint32_t offset, uint32_t nStrings)
+    {
+        StrIndexArr indexArr;
+        f.seekg(offset);
+        for(uint32_t a=0; a<nStrings; a++)
+            indexArr.emplace_back(a, readInt(f), readInt(f));
+        return indexArr;
+    }
+
+    static std::vector<std::string> readStrings(const StrIndex& strIndex, std::istream& f)
+    {
+        f.seekg(strIndex.offset);
+        std::vector<std::string> strings;
+        uint32_t p = strIndex.offset;
+        uint32_t end = p + strIndex.len + 1;
+        do
+        {
+            std::string s;
+            std::getline(f, s, '\0');
+            p = p + s.size() + 1;
+            strings.emplace_back(std::move(s));
+        }while(p != end);
+        return strings;
+    }
+
+    static const StrDataArr readStrings(StrIndexArr& indexArr, std::istream& f)
+    {
+        std::sort(indexArr.begin(), indexArr.end());
+        StrDataArr dataArr;
+        for(StrIndex& strIndex : indexArr)
+            dataArr.emplace_back(strIndex.index, strIndex.offset, readStrings(strIndex, f));
+        std::sort(dataArr.begin(), dataArr.end());
+        return dataArr;
+    }
+
+    /*!
+     * Finds the language and the charset in the header of a MO file.
+     * *charset* is left empty if it's not specified.
+     * Returns false if there's no language.
+     */
+    static bool parseHeader(const std::string& header, std::string& language, std::string& charset)
+    {
+#ifdef GOTTEXT_BOOST_REGEX
+        using namespace boost;
+#else
+        using namespace std;
+#endif
+        smatch m;
+        regex rx("\\nLanguage\\:\\s(\\w+)");
+        if(!regex_search(header, m, rx))
+            return false;
+        language = m[1];
+
+        regex rxCharset("(?:^|\\n)Content-Type\\:[^\\n]*charset=([^\\s;]+)");
+        if(regex_search(header, m, rxCharset))
+            charset = m[1];
+        return true;
+    }
+
+    void GotText::setLang(const std::string& filename, Lang &&other, bool fromFile)
+    {
+        LangEntry& e = langStorage.set(filename, std::move(other));
+        e.lang.time = getTimestamp();
+        e.fromFile = fromFile;
+        e.pinned = false;
+        langStorage.use(e);
+        setEntry(e);
+        if(size_t budget = getMemoryBudget())
+            langStorage.evict(budget, &e);
+    }
+
+    void GotText::setDiff(LangEntry &e, LangDiff &&diff)
+    {
+        if(diff.full)
+        {
+            setLang(e.filename, std::move(diff.lang), true);
+            return;
+        }
+        langStorage.patch(e, std::move(diff));
+        e.lang.time = getTimestamp();
+        e.fromFile = true;
+        e.pinned = false;
+        langStorage.use(e);
+        setEntry(e);
+        if(size_t budget = getMemoryBudget())
+            langStorage.evict(budget, &e);
+    }
+
+    void GotText::setEntry(const LangEntry &e)
+    {
+        entry = &e;
+        generation = e.generation.load(std::memory_order_relaxed);
+        filename = e.filename;
+    }
+
+    void GotText::loadFile(const std::string& filename, bool rebuild)
+    {
+        LangEntry* e = langStorage.find(filename);
+        LangDiff diff;
+        if(e && canDiff(*e) && parseDiff(filename, LangDigest(*e), diff))
+        {
+            findRemoved(e->lang, diff);
+            setDiff(*e, std::move(diff));
+            return;
+        }
+
+        if(!isDedup())
+        {
+            setLang(filename, parseFile(filename, rebuild), true);
+            return;
+        }
+
+        time_t mtime = getModificationTime(filename);
+        auto start = std::chrono::steady_clock::now();
+        Fingerprint fingerprint = fingerprintFile(filename);
+        // the shared image must be rebuilt on request, so it's not reused
+        LangEntry* same = rebuild && !getSharedDir().empty() ? nullptr : langStorage.findSame(fingerprint, e);
+        if(!same)
+        {
+            setLang(filename, parseFile(filename, rebuild, &fingerprint), true);
+            return;
+        }
+        uint64_t loadTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        setLang(filename, shareLang(*same, mtime, loadTime), true);
+    }
+
+    Lang GotText::shareLang(LangEntry &same, time_t mtime, uint64_t loadTime)
+    {
+        Lang other = langStorage.share(same);
+        other.mtime = mtime;
+        other.checked = std::time(nullptr);
+        other.loadTime = loadTime;
+        other.profile = LoadProfile();
+        return other;
+    }
+
+    Lang GotText::parseFile(const std::string& filename, bool rebuild, const Fingerprint* fingerprint)
+    {
+        // get the time before reading the file
+        // so the changes made while reading will be picked up on the next check
+        time_t mtime = getModificationTime(filename);
+        auto start = std::chrono::steady_clock::now();
+        errno = 0;
+        Fingerprint sourceFingerprint;
+        if(fingerprint)
+            sourceFingerprint = *fingerprint;
+        else if(isDedup() || !getHotProfileDir().empty())
+            sourceFingerprint = fingerprintFile(filename);
+        HotProfile hot = readHotProfile(sourceFingerprint);
+        HotProfile::Use useHot(hot.isEmpty() ? nullptr : &hot);
+        Lang other;
+        std::string dir = getSharedDir();
+        std::shared_ptr<const Image> image;
+        if(!dir.empty() && !Compact::isRequested())
+        {
+            image = Image::share(dir, filename, [&]() -> const Lang& {
+                other = loadFromFile(filename);
+                return other;
+            }, rebuild, HotProfile::current());
+        }
+        if(image)
+            other = Image::makeLang(image);
+        else if(other.isDummy()) // not parsed by Image::share()
+            other = loadFromFile(filename);
+        other.mtime = mtime;
+        other.checked = std::time(nullptr);
+        other.fingerprint = sourceFingerprint;
+        if(isHugePages() && !other.image && !other.columns && !other.compact)
+            compile(other, filename, HotProfile::current());
+        other.loadTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        return other;
+    }
+
+    bool GotText::canDiff(const LangEntry& e)
+    {
+        const Lang& base = e.lang;
+        if(!isDiffReload() || base.isDummy() || base.image || base.columns || base.compact || Compact::isRequested() || langStorage.isColumnar())
+            return false;
+        return getSharedDir().empty(); // otherwise the image must be rebuilt anyway
+    }
+
+    bool GotText::parseDiff(const std::string& filename, const LangDigest& base, LangDiff& diff)
+    {
+        time_t mtime = getModificationTime(filename);
+        auto start = std::chrono::steady_clock::now();
+        errno = 0;
+        if(!diffFromFile(filename, base, diff))
+            return false;
+        if(isDedup() || !getHotProfileDir().empty())
+            diff.lang.fingerprint = fingerprintFile(filename);
+        diff.lang.mtime = mtime;
+        diff.lang.checked = std::time(nullptr);
+        diff.lang.loadTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        diff.version = base.version;
+        return true;
+    }
+
+    bool GotText::parseDiffUnlocked(const std::string& filename, LangDiff& diff)
+    {
+        LangDigest base;
+        {
+            GOTTEXT_READ_LOCK
+            LangEntry* e = langStorage.find(filename);
+            if(!e || !canDiff(*e))
+                return false;
+            base = LangDigest(*e);
+        }
+        if(!parseDiff(filename, base, diff))
+            return false;
+        if(!diff.keys.empty())
+        {
+            GOTTEXT_READ_LOCK
+            LangEntry* e = langStorage.find(filename);
+            // otherwise the translations were replaced meanwhile and the changes are not applied anyway
+            if(e && e->version == diff.version)
+                findRemoved(e->lang, diff);
+        }
+        return true;
+    }
+
+    void GotText::loadStream(std::istream &s, const std::string& filename)
+    {
+        auto start = std::chrono::steady_clock::now();
+        errno = 0;
+        Lang other = loadFromStream(s, filename);
+        other.loadTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        setLang(filename, std::move(other), false);
+    }
+
+    Lang GotText::loadFromFile(const std::string& filename)
+    {
+        std::ifstream f(filename, std::ifstream::binary);
+        if(!f)
+            throw Exception(Exception::ReadError);
+        f.exceptions(std::ifstream::failbit | std::ifstream::badbit | std::ifstream::eofbit);
+        try{
+            return loadFromStream(f, filename);
+        }catch(std::ios_base::failure &e){
+            throw Exception(Exception::ReadError, f);
+        }
+    }
+
+    Lang GotText::loadFromStream(std::istream &f, const std::string& /*filename*/)
+    {
+        LoadProfile profile;
+        auto phaseStart = std::chrono::steady_clock::now();
+        auto endPhase = [&phaseStart](uint64_t& phase){
+            auto now = std::chrono::steady_clock::now();
+            phase = std::chrono::duration_cast<std::chrono::nanoseconds>(now - phaseStart).count();
+            phaseStart = now;
+        };
+
         uint32_t magicNum = readInt(f);
         if(magicNum != MO_MAGIC_NUMBER)
             throw Exception(Exception::UnknownMagicNumber, f, nullptr, magicNum);
@@ -310,6 +1564,8 @@ namespace GotText {
 
         uint32_t offsetOrig = readInt(f);
         uint32_t offsetTr = readInt(f);
+        endPhase(profile.header);
+
         StrIndexArr indexArrOrig;
         StrIndexArr indexArrTr;
 
@@ -323,103 +1579,858 @@ namespace GotText {
             indexArrTr = readStrTable(f, offsetTr, nStrings);
             indexArrOrig = readStrTable(f, offsetOrig, nStrings);
         }
+        endPhase(profile.tables);
 
         StrDataArr dataArrOrig = readStrings(indexArrOrig, f);
         StrDataArr dataArrTr = readStrings(indexArrTr, f);
+        endPhase(profile.strings);
 
         Lang thisLang;
-        thisLang.dictOne.reserve(nStrings);
-        thisLang.dictNum.reserve(nStrings);
-
+        const Charset* charset = &Charset::utf8();
         auto trp = dataArrTr.begin();
         for(const StrData& orig : dataArrOrig)
         {
             StrData& tr = *trp;
             if(orig.strings[0].empty())
-            {
-#ifdef GOTTEXT_BOOST_REGEX
-                using namespace boost;
-#else
-                using namespace std;
-#endif
-                smatch m;
-                regex rx("\\nLanguage\\:\\s(\\w+)");
-                if(!regex_search(tr.strings[0], m, rx))
+            {
+                std::string language;
+                std::string charsetName;
+                if(!parseHeader(tr.strings[0], language, charsetName))
                     throw Exception(Exception::NoLanguageHeader, f, std::move(tr.strings[0]));
-                thisLang.pluralInfo = Plural::getInfo(m[1]);
+                thisLang.pluralInfo = Plural::getInfo(language);
                 if(thisLang.pluralInfo.isValid())
-                    thisLang.locale = m[1];
+                    thisLang.locale = language;
+
+                if(!charsetName.empty())
+                {
+                    charset = Charset::find(charsetName);
+                    if(!charset)
+                        throw Exception(Exception::UnsupportedCharset, f, charsetName);
+                }
                 break;
             }
             ++trp;
         }
         if(!thisLang.pluralInfo.isValid())
             throw Exception(Exception::NoHeaders, f);
+        endPhase(profile.plural);
 
-        trp = dataArrTr.begin();
-        for(StrData& orig : dataArrOrig)
+        // the original strings are left as is, like gettext does
+        for(StrData& tr : dataArrTr)
         {
-            StrData& tr = *trp;
+            size_t pos = tr.offset;
+            for(std::string& str : tr.strings)
+            {
+                size_t len = str.size();
+                size_t invalid = charset->toUtf8(str);
+                if(invalid != std::string::npos)
+                {
+                    throw Exception(Exception::InvalidEncoding, pos + invalid, charset->name,
+                                    static_cast<unsigned char>(str[invalid]));
+                }
+                pos += len + 1;
+            }
+        }
+        endPhase(profile.charset);
+
+        auto check = [&thisLang, &f](StrData& orig, StrData& tr){
             if(orig.strings.size() > 2)
                 throw Exception(Exception::TooManySourceForms, f, std::move(tr.strings[0]), tr.strings.size());
-            if(orig.strings.size() == 1)
+            if(orig.strings.size() == 1 && tr.strings.size() != 1)
+                throw Exception(Exception::TooManyNonPluralTranslations, f, std::move(tr.strings[0]), tr.strings.size());
+            if(orig.strings.size() == 2 && tr.strings.size() != thisLang.pluralInfo.count)
+                throw Exception(Exception::InvalidPluralFormsCount, f, std::move(tr.strings[0]), tr.strings.size());
+        };
+
+        const HotProfile* hot = HotProfile::current();
+        // the number of the lookups of the translation in the hotness profile
+        auto getHits = [hot](const StrData& orig) -> uint64_t {
+            if(!hot)
+                return 0;
+            const std::string& s = orig.strings[0];
+            bool plural = orig.strings.size() > 1;
+            size_t p = s.find('\4');
+            uint64_t hash = p == std::string::npos
+                ? Image::hashKey(plural ? Image::Num : Image::One, nullptr, 0, s.data(), s.size())
+                : Image::hashKey(plural ? Image::CtxNum : Image::CtxOne, s.data(), p, s.data() + p + 1, s.size() - p - 1);
+            return hot->getHits(hash);
+        };
+
+        if(Compact::isRequested())
+        {
+            std::shared_ptr<Compact> compact = std::make_shared<Compact>();
+            for(size_t a=0; a<dataArrOrig.size(); a++)
             {
-                if(tr.strings.size() != 1)
-                    throw Exception(Exception::TooManyNonPluralTranslations, f, std::move(tr.strings[0]), tr.strings.size());
+                StrData& orig = dataArrOrig[a];
+                StrData& tr = dataArrTr[a];
+                check(orig, tr);
+                compact->add(orig.strings[0], orig.strings.size() > 1, tr.strings, getHits(orig));
+                // the strings are not needed anymore, so the peak memory usage is lower
+                std::vector<std::string>().swap(orig.strings);
+                std::vector<std::string>().swap(tr.strings);
+            }
+            compact->finish(isCompressValues());
+            thisLang.compact = std::move(compact);
 
-                std::string& s = orig.strings[0];
-                size_t p = s.find('\4');
+            std::streamoff pos = f.tellg();
+            if(pos > 0)
+                thisLang.sourceSize = pos;
+            endPhase(profile.dicts);
+            thisLang.profile = profile;
+            return thisLang;
+        }
 
+        // *copy* is true for the hot translations (see HotProfile),
+        // so their strings are allocated together instead of keeping the buffers scattered over the file order
+        auto insert = [&thisLang, &check](StrData& orig, StrData& tr, bool copy){
+            check(orig, tr);
+            auto take = [copy](std::string& s){return copy ? std::string(s) : std::move(s);};
+            std::string& s = orig.strings[0];
+            size_t p = s.find('\4');
+            if(orig.strings.size() == 1)
+            {
                 if(p == std::string::npos)
                 {
-                    thisLang.dictOne.emplace(
-                        std::move(orig.strings[0]),
-                        std::move(tr.strings[0])
-                    );
+                    thisLang.dictOne.emplace(take(s), take(tr.strings[0]));
                 }
                 else
                 {
                     std::string ctx = s.substr(0, p);
                     s.erase(0, p+1);
-                    thisLang.dictCtxOne[std::move(ctx)][std::move(s)] = std::move(tr.strings[0]);
+                    thisLang.dictCtxOne[std::move(ctx)][take(s)] = take(tr.strings[0]);
                 }
             }
             else
             {
-                if(tr.strings.size() != thisLang.pluralInfo.count)
-                    throw Exception(Exception::InvalidPluralFormsCount, f, std::move(tr.strings[0]), tr.strings.size());
-
-                std::string& s = orig.strings[0];
-                size_t p = s.find('\4');
-
+                std::vector<std::string> forms;
+                if(copy)
+                    forms = tr.strings;
+                else
+                    forms = std::move(tr.strings);
                 if(p == std::string::npos)
                 {
-                    thisLang.dictNum.emplace(
-                        std::move(orig.strings[0]),
-                        std::move(tr.strings)
-                    );
+                    thisLang.dictNum.emplace(take(s), std::move(forms));
                 }
                 else
                 {
                     std::string ctx = s.substr(0, p);
                     s.erase(0, p+1);
-                    thisLang.dictCtxNum[std::move(ctx)][std::move(s)] = std::move(tr.strings);
+                    thisLang.dictCtxNum[std::move(ctx)][take(s)] = std::move(forms);
                 }
             }
-            ++trp;
+        };
+
+        // the hot translations are inserted last,
+        // so their nodes are allocated together and come first in their buckets
+        std::vector<std::pair<uint64_t, size_t>> hotIndexes;
+        thisLang.dictOne.reserve(nStrings);
+        thisLang.dictNum.reserve(nStrings);
+        for(size_t a=0; a<dataArrOrig.size(); a++)
+        {
+            if(uint64_t hits = getHits(dataArrOrig[a]))
+            {
+                hotIndexes.emplace_back(hits, a);
+                continue;
+            }
+            insert(dataArrOrig[a], dataArrTr[a], false);
         }
+        std::sort(hotIndexes.begin(), hotIndexes.end());
+        for(const auto& h : hotIndexes)
+            insert(dataArrOrig[h.second], dataArrTr[h.second], true);
 
+        std::streamoff pos = f.tellg();
+        if(pos > 0)
+            thisLang.sourceSize = pos;
+        endPhase(profile.dicts);
+        thisLang.profile = profile;
         return thisLang;
     }
 
+    Fingerprint GotText::fingerprintFile(const std::string& filename)
+    {
+        std::ifstream f(filename, std::ifstream::binary);
+        if(!f)
+            throw Exception(Exception::ReadError);
+        try{
+            return fingerprintStream(f);
+        }catch(std::ios_base::failure &e){
+            throw Exception(Exception::ReadError, f);
+        }
+    }
+
+    Fingerprint GotText::fingerprintStream(std::istream &f)
+    {
+        f.exceptions(std::istream::badbit);
+        Fingerprint fingerprint;
+        std::vector<char> block(65536);
+        while(f.read(block.data(), block.size()) || f.gcount())
+            fingerprint.update(block.data(), f.gcount());
+        return fingerprint;
+    }
+
+    bool GotText::diffFromFile(const std::string& filename, const LangDigest& base, LangDiff& diff)
+    {
+        std::ifstream f(filename, std::ifstream::binary);
+        if(!f)
+            throw Exception(Exception::ReadError);
+        f.exceptions(std::ifstream::failbit | std::ifstream::badbit | std::ifstream::eofbit);
+        try{
+            return diffFromStream(f, base, diff);
+        }catch(std::ios_base::failure &e){
+            throw Exception(Exception::ReadError, f);
+        }
+    }
+
+    static std::vector<std::string> splitForms(const std::string& joined)
+    {
+        std::vector<std::string> forms;
+        size_t p = 0;
+        for(;;)
+        {
+            size_t end = joined.find('\0', p);
+            if(end == std::string::npos)
+            {
+                forms.emplace_back(joined, p);
+                return forms;
+            }
+            forms.emplace_back(joined, p, end - p);
+            p = end + 1;
+        }
+    }
+
+    template<typename T>
+    static void collectRemoved(const std::unordered_map<std::string, T>& dict, Image::Kind kind, const std::string& ctx,
+                               const std::vector<uint64_t>& hashes, std::vector<std::pair<std::string, std::string>>& removed)
+    {
+        for(const auto& i : dict)
+        {
+            if(!std::binary_search(hashes.begin(), hashes.end(), Image::hashKey(kind, ctx, i.first)))
+                removed.emplace_back(ctx, i.first);
+        }
+    }
+
+    void GotText::findRemoved(const Lang &base, LangDiff &diff)
+    {
+        if(diff.keys.empty())
+            return;
+        // the keys are compared by their hashes, so only the strings of the removed translations are copied
+        collectRemoved(base.dictOne, Image::One, std::string(), diff.keys, diff.removed[LookupCounters::One]);
+        collectRemoved(base.dictNum, Image::Num, std::string(), diff.keys, diff.removed[LookupCounters::Num]);
+        for(const auto& c : base.dictCtxOne)
+            collectRemoved(c.second, Image::CtxOne, c.first, diff.keys, diff.removed[LookupCounters::CtxOne]);
+        for(const auto& c : base.dictCtxNum)
+            collectRemoved(c.second, Image::CtxNum, c.first, diff.keys, diff.removed[LookupCounters::CtxNum]);
+        std::vector<uint64_t>().swap(diff.keys);
+    }
+
+    bool GotText::diffFromStream(std::istream &f, const LangDigest &base, LangDiff &diff)
+    {
+        LoadProfile profile;
+        auto phaseStart = std::chrono::steady_clock::now();
+        auto endPhase = [&phaseStart](uint64_t& phase){
+            auto now = std::chrono::steady_clock::now();
+            phase = std::chrono::duration_cast<std::chrono::nanoseconds>(now - phaseStart).count();
+            phaseStart = now;
+        };
+
+        if(!base.pluralInfo.isValid() || Compact::isRequested())
+            return false;
+        if(readInt(f) != MO_MAGIC_NUMBER)
+            return false;
+        if(readInt(f) > MO_MAX_SUPPORTED_VERSION)
+            return false;
+        uint32_t nStrings = readInt(f);
+        if(!nStrings)
+            return false;
+        uint32_t offsetOrig = readInt(f);
+        uint32_t offsetTr = readInt(f);
+        endPhase(profile.header);
+
+        StrIndexArr indexArrOrig = readStrTable(f, offsetOrig, nStrings);
+        StrIndexArr indexArrTr = readStrTable(f, offsetTr, nStrings);
+        endPhase(profile.tables);
+
+        // read everything up to the end of the last string into one buffer,
+        // so the strings are not allocated until they are known to be changed
+        uint64_t size = 0;
+        for(uint32_t a=0; a<nStrings; a++)
+        {
+            size = std::max(size, static_cast<uint64_t>(indexArrOrig[a].offset) + indexArrOrig[a].len + 1);
+            size = std::max(size, static_cast<uint64_t>(indexArrTr[a].offset) + indexArrTr[a].len + 1);
+        }
+        std::string data;
+        f.seekg(0);
+        while(data.size() < size)
+        {
+            // the offsets are not validated yet, so the buffer grows only as far as the data is actually read
+            size_t p = data.size();
+            size_t n = std::min<uint64_t>(size - p, std::max<size_t>(p, 65536));
+            data.resize(p + n);
+            f.read(&data[p], n);
+        }
+        for(uint32_t a=0; a<nStrings; a++)
+        {
+            if(data[indexArrOrig[a].offset + indexArrOrig[a].len] || data[indexArrTr[a].offset + indexArrTr[a].len])
+                return false;
+        }
+        endPhase(profile.strings);
+
+        const Charset* charset = nullptr;
+        for(uint32_t a=0; a<nStrings; a++)
+        {
+            if(indexArrOrig[a].len)
+                continue;
+            std::string language;
+            std::string charsetName;
+            if(!parseHeader(data.substr(indexArrTr[a].offset, indexArrTr[a].len), language, charsetName))
+                return false;
+            const Plural::Info& info = Plural::getInfo(language);
+            if(language != base.locale || info.func != base.pluralInfo.func || info.count != base.pluralInfo.count)
+                return false;
+            charset = charsetName.empty() ? &Charset::utf8() : Charset::find(charsetName);
+            break;
+        }
+        if(!charset)
+            return false;
+        endPhase(profile.plural);
+
+        Lang& changes = diff.lang;
+        std::vector<uint64_t> hashes;
+        hashes.reserve(nStrings);
+        size_t matched = 0;
+        std::string ctx;
+        std::string key;
+        std::string value;
+        for(uint32_t a=0; a<nStrings; a++)
+        {
+            const char* orig = data.data() + indexArrOrig[a].offset;
+            size_t origLen = indexArrOrig[a].len;
+            size_t keyLen = strlen(orig);
+            bool plural = keyLen != origLen;
+            if(plural && strlen(orig + keyLen + 1) != origLen - keyLen - 1)
+                return false; // too many source forms
+
+            value.assign(data, indexArrTr[a].offset, indexArrTr[a].len);
+            if(charset->toUtf8(value) != std::string::npos)
+                return false;
+            size_t forms = std::count(value.begin(), value.end(), '\0') + 1;
+            if(forms != (plural ? base.pluralInfo.count : 1))
+                return false;
+
+            const char* sep = static_cast<const char*>(memchr(orig, '\4', keyLen));
+            if(sep)
+            {
+                ctx.assign(orig, sep);
+                key.assign(sep + 1, orig + keyLen);
+            }
+            else
+            {
+                ctx.clear();
+                key.assign(orig, keyLen);
+            }
+            Image::Kind kind = sep ? (plural ? Image::CtxNum : Image::CtxOne) : (plural ? Image::Num : Image::One);
+            uint64_t hash = Image::hashKey(kind, ctx, key);
+            hashes.push_back(hash);
+            if(const uint64_t* old = base.find(hash))
+            {
+                matched++;
+                if(*old == LangDigest::hashValue(value.data(), value.size()))
+                {
+                    diff.unchanged++;
+                    continue;
+                }
+            }
+
+            switch(kind)
+            {
+                case Image::One:
+                    changes.dictOne[key] = value;
+                    break;
+
+                case Image::Num:
+                    changes.dictNum[key] = splitForms(value);
+                    break;
+
+                case Image::CtxOne:
+                    changes.dictCtxOne[ctx][key] = value;
+                    break;
+
+                case Image::CtxNum:
+                    changes.dictCtxNum[ctx][key] = splitForms(value);
+                    break;
+
+                default:
+                    break;
+            }
+        }
+
+        if(matched != base.hashes.size())
+        {
+            // the removed translations are found by GotText::findRemoved()
+            std::sort(hashes.begin(), hashes.end());
+            diff.keys = std::move(hashes);
+        }
+
+        changes.sourceSize = size;
+        endPhase(profile.dicts);
+        changes.profile = profile;
+        return true;
+    }
+
+    bool LangDiff::isEmpty() const
+    {
+        for(const auto& r : removed)
+        {
+            if(!r.empty())
+                return false;
+        }
+        return lang.dictOne.empty() && lang.dictNum.empty() && lang.dictCtxOne.empty() && lang.dictCtxNum.empty();
+    }
+
+    /*!
+     * Returns the hash of the plural forms, which is the same as LangDigest::hashValue() of the joined forms.
+     */
+    static uint64_t hashForms(const std::vector<std::string>& forms)
+    {
+        uint64_t hash = 0;
+        for(const std::string& form : forms)
+            hash = hashBytes(form.data(), form.size(), hash);
+        return hash;
+    }
+
+    static void addDigest(const DictOne& dict, Image::Kind kind, const std::string& ctx,
+                          std::vector<std::pair<uint64_t, uint64_t>>& hashes)
+    {
+        for(const auto& i : dict)
+            hashes.emplace_back(Image::hashKey(kind, ctx, i.first), hashBytes(i.second.data(), i.second.size()));
+    }
+
+    static void addDigest(const DictNum& dict, Image::Kind kind, const std::string& ctx,
+                          std::vector<std::pair<uint64_t, uint64_t>>& hashes)
+    {
+        for(const auto& i : dict)
+            hashes.emplace_back(Image::hashKey(kind, ctx, i.first), hashForms(i.second));
+    }
+
+    LangDigest::LangDigest(const LangEntry &e):
+        locale(e.lang.locale),
+        pluralInfo(e.lang.pluralInfo),
+        version(e.version.load(std::memory_order_relaxed))
+    {
+        const Lang& l = e.lang;
+        size_t total = 0;
+        for(size_t d=0; d<LookupCounters::DictCount; d++)
+            total += l.countEntries(static_cast<LookupCounters::Dict>(d));
+        hashes.reserve(total);
+        addDigest(l.dictOne, Image::One, std::string(), hashes);
+        addDigest(l.dictNum, Image::Num, std::string(), hashes);
+        for(const auto& c : l.dictCtxOne)
+            addDigest(c.second, Image::CtxOne, c.first, hashes);
+        for(const auto& c : l.dictCtxNum)
+            addDigest(c.second, Image::CtxNum, c.first, hashes);
+        std::sort(hashes.begin(), hashes.end());
+    }
+
+    const uint64_t* LangDigest::find(uint64_t key) const
+    {
+        auto i = std::lower_bound(hashes.begin(), hashes.end(), std::make_pair(key, static_cast<uint64_t>(0)));
+        if(i == hashes.end() || i->first != key)
+            return nullptr;
+        return &i->second;
+    }
+
+    uint64_t LangDigest::hashValue(const char* value, size_t len)
+    {
+        // the forms are hashed one by one, so the loaded plural forms are hashed without joining them
+        uint64_t hash = 0;
+        const char* end = value + len;
+        for(;;)
+        {
+            const char* form = static_cast<const char*>(memchr(value, '\0', end - value));
+            if(!form)
+                return hashBytes(value, end - value, hash);
+            hash = hashBytes(value, form - value, hash);
+            value = form + 1;
+        }
+    }
+
     void Lang::swap(Lang &&other)
     {
         std::swap(time, other.time);
         std::swap(locale, other.locale);
+        std::swap(mtime, other.mtime);
+        std::swap(checked, other.checked);
+        std::swap(loadTime, other.loadTime);
+        std::swap(profile, other.profile);
+        std::swap(sourceSize, other.sourceSize);
+        std::swap(fingerprint, other.fingerprint);
         std::swap(pluralInfo, other.pluralInfo);
         std::swap(dictOne, other.dictOne);
         std::swap(dictNum, other.dictNum);
         std::swap(dictCtxOne, other.dictCtxOne);
         std::swap(dictCtxNum, other.dictCtxNum);
+        std::swap(image, other.image);
+        std::swap(columns, other.columns);
+        std::swap(compact, other.compact);
+        std::swap(exportCache.ptr, other.exportCache.ptr);
+    }
+
+    template<typename T>
+    static size_t countCtxEntries(const std::unordered_map<std::string, T>& dict)
+    {
+        size_t result = 0;
+        for(const auto& i : dict)
+            result += i.second.size();
+        return result;
+    }
+
+    size_t Lang::countEntries(LookupCounters::Dict d) const
+    {
+        if(image)
+            return image->countEntries(static_cast<Image::Kind>(d));
+        if(columns)
+            return columns->countEntries(d);
+        if(compact)
+            return compact->countEntries(d);
+        switch(d)
+        {
+            case LookupCounters::One:
+                return dictOne.size();
+            case LookupCounters::Num:
+                return dictNum.size();
+            case LookupCounters::CtxOne:
+                return countCtxEntries(dictCtxOne);
+            case LookupCounters::CtxNum:
+                return countCtxEntries(dictCtxNum);
+            default:
+                return 0;
+        }
+    }
+
+    template<typename T>
+    static void dictMemoryUsage(const std::unordered_map<std::string, T>& dict, MemoryUsage& m)
+    {
+        m.tables += tableMemoryUsage(dict);
+        for(const auto& i : dict)
+        {
+            m.keys += strMemoryUsage(i.first);
+            m.values += strMemoryUsage(i.second);
+        }
+    }
+
+    template<typename T>
+    static void dictMemoryUsage(const std::unordered_map<std::string, std::unordered_map<std::string, T>>& dict, MemoryUsage& m)
+    {
+        m.contexts += tableMemoryUsage(dict);
+        for(const auto& i : dict)
+        {
+            m.contexts += strMemoryUsage(i.first) + sizeof(i.second);
+            dictMemoryUsage(i.second, m);
+        }
+    }
+
+    MemoryUsage Lang::calcMemoryBreakdown() const
+    {
+        MemoryUsage m;
+        m.other = sizeof(*this) + strMemoryUsage(locale) - sizeof(locale);
+        dictMemoryUsage(dictOne, m);
+        dictMemoryUsage(dictNum, m);
+        dictMemoryUsage(dictCtxOne, m);
+        dictMemoryUsage(dictCtxNum, m);
+        if(image)
+            m.image = image->getSize();
+        if(columns)
+            columns->calcMemoryBreakdown(m);
+        if(compact)
+            compact->calcMemoryBreakdown(m);
+        return m;
+    }
+
+    LangEntry* LangStorage::find(const std::string &filename)
+    {
+        auto i = index.find(filename);
+        if(i == index.end())
+            return nullptr;
+        return &entries[(*i).second];
+    }
+
+    LangEntry& LangStorage::set(const std::string &filename, Lang &&lang)
+    {
+        LangEntry* e = find(filename);
+        if(!e)
+        {
+            if(freeIds.empty())
+            {
+                entries.emplace_back();
+                e = &entries.back();
+                e->id = entries.size() - 1;
+            }
+            else
+            {
+                e = &entries[freeIds.back()];
+                freeIds.pop_back();
+            }
+            e->filename = filename;
+            index.emplace(filename, e->id);
+            unloaded.erase(filename);
+        }
+        if(columnar && !lang.image && !lang.columns && !lang.compact && !lang.isDummy())
+            lang.columns = Columns::build(lang, ids);
+        unaccount(*e);
+        e->lang.swap(std::move(lang));
+        e->version++;
+        e->loads++;
+        e->loadTime += e->lang.loadTime;
+        e->bytesRead += e->lang.sourceSize;
+        e->memoryUsage = e->lang.calcMemoryUsage();
+        account(*e);
+        release(lang);
+        return *e;
+    }
+
+    template<typename T>
+    static void patchDict(std::unordered_map<std::string, T>& dict, std::unordered_map<std::string, T>& changes,
+                          const std::vector<std::pair<std::string, std::string>>& removed)
+    {
+        for(const auto& r : removed)
+            dict.erase(r.second);
+        for(auto& i : changes)
+            dict[i.first] = std::move(i.second);
+    }
+
+    template<typename T>
+    static void patchDict(std::unordered_map<std::string, std::unordered_map<std::string, T>>& dict,
+                          std::unordered_map<std::string, std::unordered_map<std::string, T>>& changes,
+                          const std::vector<std::pair<std::string, std::string>>& removed)
+    {
+        for(const auto& r : removed)
+        {
+            auto c = dict.find(r.first);
+            if(c == dict.end())
+                continue;
+            c->second.erase(r.second);
+            if(c->second.empty())
+                dict.erase(c);
+        }
+        for(auto& c : changes)
+        {
+            auto& d = dict[c.first];
+            for(auto& i : c.second)
+                d[i.first] = std::move(i.second);
+        }
+    }
+
+    void LangStorage::patch(LangEntry &entry, LangDiff &&diff)
+    {
+        Lang& l = entry.lang;
+        Lang& changes = diff.lang;
+        unaccount(entry);
+        if(!diff.isEmpty())
+        {
+            patchDict(l.dictOne, changes.dictOne, diff.removed[LookupCounters::One]);
+            patchDict(l.dictNum, changes.dictNum, diff.removed[LookupCounters::Num]);
+            patchDict(l.dictCtxOne, changes.dictCtxOne, diff.removed[LookupCounters::CtxOne]);
+            patchDict(l.dictCtxNum, changes.dictCtxNum, diff.removed[LookupCounters::CtxNum]);
+            l.exportCache.ptr.reset();
+            entry.version++;
+        }
+        l.mtime = changes.mtime;
+        l.checked = changes.checked;
+        l.loadTime = changes.loadTime;
+        l.profile = changes.profile;
+        l.sourceSize = changes.sourceSize;
+        l.fingerprint = changes.fingerprint;
+        entry.loads++;
+        entry.loadTime += l.loadTime;
+        entry.bytesRead += l.sourceSize;
+        entry.memoryUsage = l.calcMemoryUsage();
+        account(entry);
+    }
+
+    LangEntry* LangStorage::findSame(const Fingerprint &fingerprint, const LangEntry *except)
+    {
+        if(fingerprint.isEmpty())
+            return nullptr;
+        auto range = fingerprints.equal_range(fingerprint);
+        for(auto i = range.first; i != range.second; ++i)
+        {
+            LangEntry& e = entries[i->second];
+            // the translations are shared only in the requested form
+            if(&e != except && (e.lang.compact != nullptr) == Compact::isRequested())
+                return &e;
+        }
+        return nullptr;
+    }
+
+    Lang LangStorage::share(const LangEntry &entry) const
+    {
+        // the dictionaries are empty, so only the pointers are copied
+        return entry.lang;
+    }
+
+    // only the first part is shared, see share()
+    static const void* sharedPart(const Lang& l)
+    {
+        if(l.image)
+            return l.image.get();
+        if(l.columns)
+            return l.columns.get();
+        if(l.compact)
+            return l.compact.get();
+        return nullptr;
+    }
+
+    static size_t sharedPartSize(const Lang& l)
+    {
+        if(l.image)
+            return l.image->getSize();
+        MemoryUsage m;
+        if(l.columns)
+            l.columns->calcMemoryBreakdown(m);
+        else
+            l.compact->calcMemoryBreakdown(m);
+        return m.total();
+    }
+
+    void LangStorage::account(const LangEntry &entry)
+    {
+        memoryUsage += entry.memoryUsage;
+        if(const void* part = sharedPart(entry.lang))
+        {
+            SharedPart& p = shared[part];
+            if(p.refs++)
+                memoryUsage -= p.size;
+            else
+                p.size = sharedPartSize(entry.lang);
+            if(!entry.lang.fingerprint.isEmpty())
+                fingerprints.emplace(entry.lang.fingerprint, entry.id);
+        }
+    }
+
+    void LangStorage::release(const Lang &lang)
+    {
+        if(lang.columns && !shared.count(lang.columns.get()))
+            lang.columns->release(ids);
+    }
+
+    void LangStorage::unaccount(const LangEntry &entry)
+    {
+        memoryUsage -= entry.memoryUsage;
+        if(const void* part = sharedPart(entry.lang))
+        {
+            auto p = shared.find(part);
+            if(--p->second.refs)
+                memoryUsage += p->second.size;
+            else
+                shared.erase(p);
+            auto range = fingerprints.equal_range(entry.lang.fingerprint);
+            for(auto i = range.first; i != range.second; ++i)
+            {
+                if(i->second == entry.id)
+                {
+                    fingerprints.erase(i);
+                    break;
+                }
+            }
+        }
+    }
+
+    void LangStorage::clear(LangEntry &entry)
+    {
+        unlink(entry);
+        unaccount(entry);
+        release(entry.lang);
+        Lang().swap(std::move(entry.lang));
+        entry.version++;
+        entry.memoryUsage = 0;
+    }
+
+    void LangStorage::remove(LangEntry &entry, bool evicted)
+    {
+        clear(entry);
+        index.erase(entry.filename);
+        if(!evicted)
+            unloaded.insert(entry.filename);
+        std::string().swap(entry.filename);
+        entry.generation.store(entry.generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        entry.fromFile = false;
+        entry.pinned = false;
+        entry.counters.reset();
+        entry.hotness.reset();
+        entry.loads = 0;
+        entry.loadTime = 0;
+        entry.bytesRead = 0;
+        freeIds.push_back(entry.id);
+    }
+
+    std::atomic<uint64_t> LangStorage::clock {0};
+
+    void LangStorage::use(LangEntry &entry)
+    {
+        if(entry.pinned || !entry.fromFile || entry.isFree() || entry.lang.isDummy())
+        {
+            unlink(entry);
+            return;
+        }
+        // the lookups made before this call don't count anymore
+        uint64_t tick = clock.load(std::memory_order_relaxed) + 1;
+        clock.store(tick, std::memory_order_relaxed);
+        place(entry, tick);
+    }
+
+    void LangStorage::place(LangEntry &entry, uint64_t tick)
+    {
+        unlink(entry);
+        entry.lruTick = tick;
+        LangEntry* prev = lruLast;
+        while(prev && prev->lruTick > tick)
+            prev = prev->lruPrev;
+        entry.lruPrev = prev;
+        entry.lruNext = prev ? prev->lruNext : lruFirst;
+        if(entry.lruNext)
+            entry.lruNext->lruPrev = &entry;
+        else
+            lruLast = &entry;
+        if(prev)
+            prev->lruNext = &entry;
+        else
+            lruFirst = &entry;
+    }
+
+    void LangStorage::unlink(LangEntry &entry)
+    {
+        if(!entry.lruPrev && lruFirst != &entry)
+            return; // not in the list
+        if(entry.lruPrev)
+            entry.lruPrev->lruNext = entry.lruNext;
+        else
+            lruFirst = entry.lruNext;
+        if(entry.lruNext)
+            entry.lruNext->lruPrev = entry.lruPrev;
+        else
+            lruLast = entry.lruPrev;
+        entry.lruPrev = nullptr;
+        entry.lruNext = nullptr;
+    }
+
+    void LangStorage::evict(size_t budget, const LangEntry *keep)
+    {
+        LangEntry* e = lruFirst;
+        while(e && memoryUsage > budget)
+        {
+            uint64_t lookupTick = e->lookupTick.load(std::memory_order_relaxed);
+            if(lookupTick > e->lruTick)
+            {
+                // looked up after the other entries were used, so it's placed after them;
+                // the lookups are blocked, so each entry is moved at most once
+                place(*e, lookupTick);
+                e = lruFirst;
+                continue;
+            }
+            LangEntry* next = e->lruNext;
+            if(e != keep)
+                remove(*e, true);
+            e = next;
+        }
     }
 }
@@ -24,12 +24,22 @@
 
 #pragma once
 
+#include <atomic>
+#include <deque>
 #include <map>
+#include <memory>
+#include <set>
 #include <unordered_map>
 #include <vector>
 
 #include "plural.h"
+#include "columns.h"
+#include "compact.h"
 #include "exception.h"
+#include "hash.h"
+#include "hotness.h"
+#include "missing.h"
+#include "stats.h"
 
 // Specify the following directive to disable thread-safety.
 #ifndef GOTTEXT_NO_THREADSAFE
@@ -52,11 +62,55 @@ namespace GotText {
     static const uint32_t MO_MAX_SUPPORTED_VERSION = 0; /*!< Maximum supported *.mo files version. */
     static const uint32_t MO_MAGIC_NUMBER = 0x950412de; /*!< Magic number for *.mo files. */
 
+    class Image;
+    class LangExport;
+
     using DictOne = std::unordered_map<std::string, std::string>;
     using DictNum = std::unordered_map<std::string, std::vector<std::string>>;
     using DictCtxOne = std::unordered_map<std::string, DictOne>;
     using DictCtxNum = std::unordered_map<std::string, DictNum>;
 
+    /*!
+     * Time spent on each phase of GotText::loadFromStream(), in nanoseconds.
+     */
+    struct LoadProfile {
+        uint64_t header = 0; /*!< Reading the file header. */
+        uint64_t tables = 0; /*!< Reading the string tables. */
+        uint64_t strings = 0; /*!< Extracting the strings. */
+        uint64_t plural = 0; /*!< Parsing the translation headers and choosing the plural rules. */
+        uint64_t charset = 0; /*!< Validating the translations and converting them to UTF-8. */
+        uint64_t dicts = 0; /*!< Building the dictionaries. */
+    };
+
+    /*!
+     * Memory occupied by the translations, in bytes, see Lang::calcMemoryBreakdown().
+     */
+    struct MemoryUsage {
+        size_t keys = 0; /*!< The original strings. */
+        size_t values = 0; /*!< The translations including the arrays of plural forms. */
+        size_t tables = 0; /*!< The hash tables of the dictionaries: buckets and nodes. */
+        size_t contexts = 0; /*!< The context strings and the hash tables of DictCtxOne and DictCtxNum (excluding nested dictionaries). */
+        size_t image = 0; /*!< Size of Lang::image. */
+        size_t other = 0; /*!< The Lang object itself and the locale string. */
+
+        inline size_t total() const {return keys + values + tables + contexts + image + other;}
+    };
+
+    /*!
+     * Holds the LangExport built for a Lang, see Lang::getExport().
+     * The export refers to the strings of the Lang,
+     * so copying a Lang does not copy the export, but moving it does.
+     */
+    struct LangExportCache {
+        std::shared_ptr<const LangExport> ptr;
+
+        LangExportCache() = default;
+        LangExportCache(const LangExportCache&) {}
+        LangExportCache(LangExportCache&&) = default;
+        LangExportCache& operator=(const LangExportCache&) {ptr.reset(); return *this;}
+        LangExportCache& operator=(LangExportCache&&) = default;
+    };
+
     /*!
      * Translations and other info for a single language/locale.
      */
@@ -71,14 +125,74 @@ namespace GotText {
             The default GotText implementation does not use this field internally
             after assigning a value to it.
         */
+        time_t mtime = 0; /*!<
+            Modification time of the source file provided by GotText::getModificationTime()
+            at the moment the file was loaded.
+            Zero if the translations were loaded from a stream
+            or the modification time is unknown.
+        */
+        time_t checked = 0; /*!<
+            The last time (UNIX timestamp) the source file was checked for modifications.
+            Used by the automatic reloading, see GotText::setReloadInterval().
+        */
+        uint64_t loadTime = 0; /*!< The time spent on loading the translations, in nanoseconds. */
+        LoadProfile profile; /*!< Provided by GotText::loadFromStream(). */
+        size_t sourceSize = 0; /*!<
+            Size of the source data in bytes.
+            Zero if the implementation of GotText::loadFromStream() does not provide it.
+        */
+        Fingerprint fingerprint; /*!<
+            The fingerprint of the source file, see GotText::setDedup().
+            Empty if the translations were loaded from a stream or the deduplication is disabled.
+        */
         Plural::Info pluralInfo; /*!< see Plural::Info. */
         DictOne dictOne; /*!< A dictionary for GotText::_(). */
         DictNum dictNum; /*!< A dictionary for GotText::_n(). */
         DictCtxOne dictCtxOne; /*!< A dictionary for GotText::_p(). */
         DictCtxNum dictCtxNum; /*!< A dictionary for GotText::_np(). */
+        std::shared_ptr<const Image> image; /*!<
+            The shared compiled translations, see GotText::setSharedDir().
+            If set, then all dictionaries are empty and the lookups are performed in the image.
+        */
+        std::shared_ptr<const Columns> columns; /*!<
+            The translations in the columnar form, see GotText::setColumnar().
+            If set, then all dictionaries are empty and the lookups are performed in the columns.
+        */
+        std::shared_ptr<const Compact> compact; /*!<
+            The translations in the compact form, see GotText::load().
+            If set, then all dictionaries are empty and the lookups are performed in this object.
+        */
+
+        mutable LangExportCache exportCache; /*!< see getExport() */
 
         void swap(Lang &&other); /*!< Swap two translation objects. */
 
+        /*!
+         * Returns the export of the translations (see LangExport).
+         * It's built on the first call and then reused until this object is destroyed or swapped.
+         * MUST be called under GOTTEXT_READ_LOCK.
+         */
+        std::shared_ptr<const LangExport> getExport() const;
+
+        /*!
+         * Returns the number of bytes occupied by the translations
+         * split into categories.
+         * The numbers are calculated from the sizes of the strings and the standard containers
+         * and do not include the overhead of the memory allocator.
+         */
+        MemoryUsage calcMemoryBreakdown() const;
+
+        /*!
+         * Returns the total number of bytes occupied by the translations,
+         * see calcMemoryBreakdown().
+         */
+        inline size_t calcMemoryUsage() const {return calcMemoryBreakdown().total();}
+
+        /*!
+         * Returns the number of translations in the dictionary *d*.
+         */
+        size_t countEntries(LookupCounters::Dict d) const;
+
         /*!
          * Returns true if it's a dummy/invalid Lang object.
          * The object is a dummy object if it contains no translation data.
@@ -87,7 +201,358 @@ namespace GotText {
         inline bool isDummy() const {return !pluralInfo.isValid();}
     };
 
-    using LangStorage = std::map<std::string, Lang>;
+    /*!
+     * A new version of the translations loaded from a file,
+     * either complete or as the changes against the loaded version,
+     * see GotText::setDiffReload().
+     */
+    struct LangDiff {
+        Lang lang; /*!<
+            The new and the changed translations (or all translations if *full* == true)
+            along with the information about the new version, i.e. mtime, checked, loadTime, profile and sourceSize.
+        */
+        std::vector<std::pair<std::string, std::string>> removed[LookupCounters::DictCount]; /*!<
+            The contexts and the original strings of the removed translations, per dictionary.
+        */
+        std::vector<uint64_t> keys; /*!<
+            The sorted hashes of all keys of the new version (see Image::hashKey()).
+            Set only if some of the loaded translations are missing in the new version,
+            then GotText::findRemoved() puts them into *removed*.
+        */
+        bool full = false; /*!< True if *lang* replaces the loaded translations completely. */
+        uint32_t version = 0; /*!< LangEntry::version of the translations the changes were found against. */
+        size_t unchanged = 0; /*!< Number of translations that are the same in both versions. */
+
+        /*!
+         * Returns true if there are no changes.
+         */
+        bool isEmpty() const;
+    };
+
+    /*!
+     * An entry of the global storage, i.e. translations loaded from a single resource.
+     * Entries are never moved in memory, so pointers to them always remain valid.
+     * However, an entry can be removed from the storage and reused later for another resource.
+     * Every removal increments the entry's *generation*,
+     * so a pointer to the entry must be accompanied with the generation it was taken at.
+     */
+    struct LangEntry {
+        uint32_t id = 0; /*!< Index of the entry in the storage. */
+        std::atomic<uint32_t> generation {1}; /*!< Incremented each time the entry is removed from the storage. */
+        std::string filename; /*!< A filename the translations were loaded from. Empty if the entry is free. */
+        Lang lang; /*!< The translations. */
+        size_t memoryUsage = 0; /*!< The value of Lang::calcMemoryUsage() for *lang*. */
+        LangEntry* lruPrev = nullptr; /*!< The previously used entry, see LangStorage::use(). */
+        LangEntry* lruNext = nullptr; /*!< The next used entry, see LangStorage::use(). */
+        uint64_t lruTick = 0; /*!< LangStorage::getClock() when the entry was last used by LangStorage::use(). */
+        mutable std::atomic<uint64_t> lookupTick {0}; /*!< LangStorage::getClock() at the last lookup, see LangStorage::touch(). */
+        bool fromFile = false; /*!< True if the translations can be reloaded from *filename*. */
+        mutable LookupCounters counters; /*!< Lookups performed in *lang*. */
+        mutable HotCounters hotness; /*!< Lookups of the individual translations, see GotText::setHotProfileDir(). */
+        uint64_t loads = 0; /*!< How many times the translations were loaded. */
+        uint64_t loadTime = 0; /*!< Total time spent on loading, in nanoseconds. */
+        uint64_t bytesRead = 0; /*!< Total size of the loaded source data. */
+        bool pinned = false; /*!<
+            True if the translations were preloaded, see GotText::preload().
+            Such entries are never evicted, and load() does not modify them,
+            so their memory pages stay shared between forked processes.
+        */
+        std::atomic<uint32_t> version {0}; /*!<
+            Incremented each time *lang* is replaced or cleared, never reset.
+            Used to revalidate the cached lookups, see Message.
+            The caches that own their copies of the translations may read it without the lock.
+        */
+
+        inline bool isFree() const {return filename.empty();}
+    };
+
+    /*!
+     * The hashes of the loaded translations that a changed file is compared with, see GotText::setDiffReload().
+     * The digest is taken under the lock, so the file is read and compared without locking the storage.
+     * A changed translation is not noticed only in case of a hash collision, which chance is negligible.
+     */
+    struct LangDigest {
+        std::string locale; /*!< Lang::locale */
+        Plural::Info pluralInfo; /*!< Lang::pluralInfo */
+        std::vector<std::pair<uint64_t, uint64_t>> hashes; /*!<
+            The hashes of the keys (see Image::hashKey()) and the hashes of the translations
+            (all plural forms), sorted by the key.
+        */
+        uint32_t version = 0; /*!< LangEntry::version of the translations. */
+
+        LangDigest() = default;
+
+        /*!
+         * Takes the digest of the translations of the storage entry *e*,
+         * which MUST be stored in the hash tables.
+         * MUST be called under any GOTTEXT_*_LOCK.
+         */
+        explicit LangDigest(const LangEntry& e);
+
+        /*!
+         * Returns the hash of the translation with the key hash *key*
+         * or nullptr if there's no such translation.
+         */
+        const uint64_t* find(uint64_t key) const;
+
+        /*!
+         * Returns the hash of the translation (all plural forms joined with zero bytes).
+         */
+        static uint64_t hashValue(const char* value, size_t len);
+    };
+
+    /*!
+     * Statistics of a single storage entry, see GotText::getStats().
+     */
+    struct LangStats {
+        std::string filename; /*!< LangEntry::filename */
+        std::string locale; /*!< Lang::locale */
+        bool loaded = false; /*!< False if the translations are unloaded. */
+        bool preloaded = false; /*!< LangEntry::pinned */
+        uint64_t hits[LookupCounters::DictCount] = {}; /*!< Successful lookups per dictionary. */
+        uint64_t misses[LookupCounters::DictCount] = {}; /*!< Failed lookups per dictionary. */
+        size_t entries[LookupCounters::DictCount] = {}; /*!< Number of translations per dictionary. */
+        uint64_t loads = 0; /*!< LangEntry::loads */
+        uint64_t loadTime = 0; /*!< LangEntry::loadTime */
+        uint64_t lastLoadTime = 0; /*!< Lang::loadTime */
+        uint64_t bytesRead = 0; /*!< LangEntry::bytesRead */
+        size_t memoryUsage = 0; /*!< LangEntry::memoryUsage */
+    };
+
+    /*!
+     * The global storage for all loaded translations.
+     * This class is NOT thread-safe. Use GOTTEXT_*_LOCK.
+     */
+    class LangStorage
+    {
+    public:
+        using Index = std::map<std::string, uint32_t>;
+
+        /*!
+         * Returns the entry for *filename* or nullptr if there's no such entry.
+         */
+        LangEntry* find(const std::string& filename);
+
+        /*!
+         * Puts the translations for *filename* into the storage
+         * replacing the previous translations if there are any.
+         * The old translations are moved to *lang*.
+         */
+        LangEntry& set(const std::string& filename, Lang &&lang);
+
+        /*!
+         * Applies the changes (see LangDiff) to the translations of the *entry*.
+         * Only the added and the changed translations are allocated,
+         * and only the removed and the replaced ones are freed.
+         * The *diff* MUST be made against the current version of the translations.
+         */
+        void patch(LangEntry& entry, LangDiff&& diff);
+
+        /*!
+         * Returns a loaded entry which translations have the *fingerprint*, can be shared (see share())
+         * and are stored in the form requested in the current thread (see Compact::isRequested()),
+         * or nullptr if there's no such entry. The *except* entry is skipped.
+         */
+        LangEntry* findSame(const Fingerprint& fingerprint, const LangEntry* except);
+
+        /*!
+         * Returns a copy of the translations of the *entry* that shares all data with them.
+         * Only the translations compiled into an Image, stored in the columnar form or in the compact form
+         * can be shared, the dictionaries are not copied.
+         */
+        Lang share(const LangEntry& entry) const;
+
+        /*!
+         * Replaces the translations of the *entry* with a dummy translation object,
+         * but keeps the entry in the storage.
+         */
+        void clear(LangEntry& entry);
+
+        /*!
+         * Completely removes the *entry* from the storage.
+         * If *evicted* == false then the file is marked as unloaded (see isUnloaded())
+         * until it's put into the storage again.
+         */
+        void remove(LangEntry& entry, bool evicted = false);
+
+        /*!
+         * Returns true if *filename* was removed from the storage by GotText::unload().
+         * The GotText objects that refer to an evicted file reload it on next use,
+         * and the objects that refer to an unloaded file become dummy objects.
+         */
+        inline bool isUnloaded(const std::string& filename) const {return unloaded.count(filename) != 0;}
+
+        /*!
+         * Marks the *entry* as the most recently used one for evict().
+         * Only the loaded entries that can be reloaded from files and that are not pinned can be evicted,
+         * any other entry is taken out of the eviction order and is not modified otherwise.
+         * Must be called after any of these conditions has changed.
+         */
+        void use(LangEntry& entry);
+
+        /*!
+         * Marks the *entry* as looked up, so evict() treats it as used at the last use() of any entry.
+         * Writes to the entry only once after each use() of any entry,
+         * so the threads translating with the same entry don't contend for its cache line.
+         * Only the atomic variables are used, so the lock is not required.
+         */
+        static inline void touch(const LangEntry& entry) {
+            uint64_t now = clock.load(std::memory_order_relaxed);
+            if(entry.lookupTick.load(std::memory_order_relaxed) != now)
+                entry.lookupTick.store(now, std::memory_order_relaxed);
+        }
+
+        /*!
+         * Returns the number of use() calls so far.
+         */
+        static inline uint64_t getClock() {return clock.load(std::memory_order_relaxed);}
+
+        /*!
+         * Evicts the least recently used entries (see use() and touch())
+         * until the total memory usage is not greater than *budget*.
+         * The entries are taken in the order of use(), but an entry looked up since then
+         * is moved after the entries used before that lookup instead of being evicted.
+         * The *keep* entry is never evicted.
+         */
+        void evict(size_t budget, const LangEntry* keep);
+
+        /*!
+         * Returns the mapping of filenames to the entries' ids.
+         */
+        inline const Index& getIndex() const {return index;}
+
+        /*!
+         * Returns the entry by its id.
+         */
+        inline const LangEntry& getEntry(uint32_t id) const {return entries[id];}
+
+        /*!
+         * Returns the total memory usage of all entries.
+         * The images, the columns and the compact translations shared by several entries (see share()) are counted once.
+         * The memory of the message ids is not included, see getIds().
+         */
+        inline size_t getMemoryUsage() const {return memoryUsage;}
+
+        /*!
+         * Enables or disables storing the translations in the columnar form,
+         * see GotText::setColumnar().
+         */
+        inline void setColumnar(bool enable) {columnar = enable;}
+        inline bool isColumnar() const {return columnar;}
+
+        /*!
+         * Returns the global ids of the original strings of the translations stored in the columnar form.
+         */
+        inline const MessageIds& getIds() const {return ids;}
+
+    protected:
+        /*!
+         * An image, columns or compact translations shared by several entries, see share().
+         */
+        struct SharedPart {
+            size_t refs = 0; /*!< Number of entries that use this part. */
+            size_t size = 0; /*!< Memory usage of this part, it's counted in *memoryUsage* only once. */
+        };
+
+        /*!
+         * Adds the memory usage of the *entry* to *memoryUsage*
+         * and puts its fingerprint into *fingerprints* if the translations can be shared.
+         * Must be called after the translations of the *entry* are changed.
+         */
+        void account(const LangEntry& entry);
+
+        /*!
+         * Reverts account().
+         * Must be called before the translations of the *entry* are changed.
+         */
+        void unaccount(const LangEntry& entry);
+
+        /*!
+         * Releases the message ids of the columns of *lang* (see Columns::release())
+         * if no entry uses these columns anymore.
+         * Must be called after unaccount() when the *lang* is taken out of its entry.
+         */
+        void release(const Lang& lang);
+
+        /*!
+         * Takes the *entry* out of the eviction order, see use().
+         */
+        void unlink(LangEntry& entry);
+
+        /*!
+         * Puts the *entry* into the eviction order after all entries used at or before *tick*,
+         * see LangEntry::lruTick.
+         */
+        void place(LangEntry& entry, uint64_t tick);
+
+        std::deque<LangEntry> entries; /*!< All entries including free ones. Deque never moves its elements. */
+        std::vector<uint32_t> freeIds; /*!< Ids of the free entries. */
+        Index index; /*!< Non-free entries. */
+        std::set<std::string> unloaded; /*!< see isUnloaded() */
+        size_t memoryUsage = 0; /*!< The sum of all LangEntry::memoryUsage. */
+        std::unordered_map<const void*, SharedPart> shared; /*!< The parts shared by the entries, see account(). */
+        std::unordered_multimap<Fingerprint, uint32_t, Fingerprint::Hash> fingerprints; /*!<
+            Ids of the entries that can be shared, by Lang::fingerprint, see findSame().
+        */
+        LangEntry* lruFirst = nullptr; /*!< The least recently used entry that can be evicted. */
+        LangEntry* lruLast = nullptr; /*!< The most recently used entry that can be evicted. */
+        static std::atomic<uint64_t> clock; /*!< see getClock() */
+        bool columnar = false; /*!< see setColumnar() */
+        MessageIds ids; /*!< see getIds() */
+    };
+
+    /*!
+     * A message prepared for repeated lookups, see GotText::translate().
+     * The first lookup stores the found translation in this object,
+     * and the following lookups return it without searching the dictionaries again,
+     * until the translations of the GotText object are reloaded or unloaded (see LangEntry::version).
+     * A Message must not be used by several threads at the same time.
+     */
+    class Message
+    {
+    public:
+        /*!
+         * *d* defines the lookup: GotText::_(), GotText::_n(), GotText::_p() or GotText::_np().
+         * *ctx* and *msgidPlural* are ignored if the lookup does not use them.
+         */
+        Message(
+            LookupCounters::Dict d,
+            const std::string& ctx,
+            const std::string& msgid,
+            const std::string& msgidPlural = std::string());
+
+        inline LookupCounters::Dict getDict() const {return dict;}
+        inline const std::string& getCtx() const {return ctx;}
+        inline const std::string& getMsgid() const {return msgid;}
+        inline const std::string& getMsgidPlural() const {return msgidPlural;}
+        inline bool hasCtx() const {return dict == LookupCounters::CtxOne || dict == LookupCounters::CtxNum;}
+        inline bool isPlural() const {return dict == LookupCounters::Num || dict == LookupCounters::CtxNum;}
+
+        /*!
+         * The result of the last lookup, see GotText::translate().
+         * The translation (or all plural forms) were found in the storage *entry* of the *version*
+         * and they are chosen with the *pluralInfo*.
+         */
+        inline const LangEntry* getEntry() const {return entry;}
+        inline uint32_t getVersion() const {return version;}
+        inline bool isFound() const {return found;}
+        inline const std::vector<std::string>& getValues() const {return values;}
+        inline const Plural::Info& getPluralInfo() const {return pluralInfo;}
+
+    protected:
+        friend class GotText;
+
+        LookupCounters::Dict dict;
+        std::string ctx;
+        std::string msgid;
+        std::string msgidPlural;
+
+        mutable const LangEntry* entry = nullptr; /*!< The entry the translation was looked up in. */
+        mutable uint32_t version = 0; /*!< LangEntry::version at the moment of the lookup. */
+        mutable bool found = false;
+        mutable std::vector<std::string> values; /*!< The translation or all plural forms. */
+        mutable Plural::Info pluralInfo; /*!< Lang::pluralInfo at the moment of the lookup. */
+    };
 
     /*!
      * Core class providing all base functionality:
@@ -101,10 +566,19 @@ namespace GotText {
     class GotText
     {
     protected:
-        LangStorage::iterator lang; /*!<
-            Iterator to the currently loaded language.
-            MUST always be valid, i.e. MUST point to a dummy object if the translation is not loaded.
+        mutable const LangEntry* entry; /*!<
+            The global storage entry of the currently loaded language.
+            MUST always be valid, i.e. MUST point to a dummy entry if the translation is not loaded.
+        */
+        mutable uint32_t generation; /*!<
+            The generation of *entry* at the moment it was assigned.
+            If it does not match the current generation of the *entry*
+            then the translations were removed from the storage.
         */
+        std::string filename; /*!< The filename passed to load(). */
+        bool compact = false; /*!< The *compact* argument of load(), used to load the evicted translations again. */
+
+        static const LangEntry dummyEntry; /*!< The entry with a dummy translation object. */
 
     public:
 #ifndef GOTTEXT_NO_THREADSAFE
@@ -116,7 +590,12 @@ namespace GotText {
 
         explicit GotText();
         virtual ~GotText() = default;
-        GotText(const GotText& that);
+        /*!
+         * The copies do not lock the storage: they refer to the same entry and generation,
+         * which are checked on each use (see revive()).
+         */
+        GotText(const GotText& that) = default;
+        GotText& operator=(const GotText& that) = default;
 
         /*!
          * Load translations from a resource identified by *filename*.
@@ -125,46 +604,341 @@ namespace GotText {
          * Throws Exception on error.
          * If the translations are (re)loaded successfully
          * then they will be stored in the global storage.
+         * If *compact* == true, then the file is stored in the compact form (see Compact)
+         * instead of the hash tables: it takes a few bytes per translation besides the strings themselves,
+         * but the lookups are binary searches, which are several times slower.
+         * The form is kept when the file is reloaded.
+         * The compact translations are never shared via setSharedDir(),
+         * and are deduplicated (see setDedup()) only with the other compact translations.
+         * They are not compiled for the huge pages (see setHugePages()),
+         * not stored in the columnar form (see setColumnar()) and are always reloaded completely (see setDiffReload()).
+         * All files are loaded in the compact form if setCompressValues() is enabled.
          */
-        void load(const std::string &filename, bool forceReload = false);
-        void load(const std::string &filename, std::istream &stream);
+        void load(const std::string &filename, bool forceReload = false, bool compact = false);
+        void load(const std::string &filename, std::istream &stream, bool compact = false);
 
         /*!
-         * All GotText objects contain a global storage iterator
-         * that contains a reference to a current language.
-         * To prevent unnecessary validation and thread locks
-         * this iterator must always remain valid.
-         * Therefore the Lang objects cannot be completely removed from storage,
-         * because it will invalidate all global storage iterators.
+         * Waits until all files that are being reloaded in background (see canLoadInBackground()) are parsed,
+         * and doesn't let the automatic reloading start new threads afterwards.
+         * Call it before the code of this library is unloaded or the process exits.
+         * MUST be called without any locks.
+         */
+        static void joinReloads();
+
+        /*!
+         * Reloads the changed files that were noticed by load() in the current thread, see isReloadDeferred().
+         * Call it when the thread doesn't serve a request, e.g. at the end of each request.
+         * MUST be called without any locks.
+         */
+        void reloadDeferred();
+
+        /*!
+         * Loads several files at once.
+         * The files that are already loaded are skipped.
+         * The files are parsed concurrently by a pool of threads (see canLoadInBackground())
+         * and then all of them are put into the global storage at once,
+         * so the other threads see either none or all of the new translations.
+         * Uses the virtual functions of this object for loading,
+         * but doesn't change the translations this object refers to.
+         * If any file can't be loaded, then no file is put into the storage,
+         * and the Exception of the first such file is rethrown.
+         * If *failed* is not nullptr, then it receives the index of that file in *filenames*.
+         */
+        void loadMany(const std::vector<std::string>& filenames, size_t* failed = nullptr);
+
+        /*!
+         * Unloads the translations that were loaded from the resource identified by *filename*.
+         * All memory occupied by that translations is released.
+         *
+         * By default, the storage entry is not completely removed.
          * Instead, this function replaces the existing translations (Lang object)
-         * that was loaded from the resource identified by *filename*
          * with a dummy translation object.
-         * All memory occupied by that old translations is released.
-         * However, the dummy object and the filename string will still be in memory.
+         * It means that the dummy object and the filename string will still be in memory,
+         * and all GotText objects that refer to these translations become dummy objects.
+         *
+         * If the memory budget is set (see setMemoryBudget())
+         * then the storage entry is removed completely.
+         *
          * If there are no translations associated with *filename*
          * then the function does nothing.
          */
         static void unload(const std::string &filename);
 
+        /*!
+         * Loads the translations from the file *filename* into the global storage
+         * so that all subsequent load() calls with the same *filename* just use them.
+         * Call this function before forking the worker processes.
+         * The translations are compiled into a read-only image (see Image),
+         * which is never written to afterwards (neither by the lookups nor by load()),
+         * so the forked processes share its memory pages instead of copying them.
+         * The preloaded translations are never evicted (see setMemoryBudget()).
+         * They can still be reloaded or unloaded explicitly, or reloaded automatically
+         * (see setReloadInterval()), but after that they become private to the process.
+         * The file is read via the default implementation of loadFromFile().
+         * Throws Exception on error.
+         */
+        static void preload(const std::string& filename);
+
+        /*!
+         * Sets the maximum total memory usage (in bytes) of all translations in the global storage
+         * (see Lang::calcMemoryUsage()).
+         * When the budget is exceeded, the least recently used translations (loaded or looked up)
+         * are evicted from the storage, see LangStorage::evict().
+         * The GotText objects that refer to the evicted translations will transparently reload them on next use.
+         * Only the translations loaded from files can be evicted.
+         * Zero (default) means no limit.
+         */
+        static void setMemoryBudget(size_t bytes);
+
+        /*!
+         * Returns the value set by setMemoryBudget().
+         */
+        static size_t getMemoryBudget();
+
+        /*!
+         * Enables or disables the columnar form of the translations loaded after this call.
+         * In the columnar form the original strings are stored only once for all files
+         * and each original string gets a global id (see MessageIds).
+         * Each file only stores an array of translations indexed by these ids (see Columns).
+         * This saves memory when the same strings are translated into many languages.
+         * A lookup costs one hash table search in the ids and an array access.
+         * The ids of the strings that are no longer used by any loaded file are reused.
+         * The compiled translations (see preload() and setSharedDir()) are not affected.
+         * Disabled by default.
+         */
+        static void setColumnar(bool enable);
+
+        /*!
+         * Returns the value set by setColumnar().
+         */
+        static bool isColumnar();
+
+        /*!
+         * Enables or disables the differential reloading.
+         * When a loaded file is reloaded (manually or automatically),
+         * its new version is compared with the loaded translations,
+         * and only the added, changed and removed translations are updated in place,
+         * while the unchanged ones are neither copied nor reallocated.
+         * The file is still read completely, but a reload that changes a few strings
+         * takes much less time and memory than parsing the whole file.
+         * The full reload is performed if the plural rules have changed,
+         * the translations are compiled or stored in the columnar form (see setSharedDir(), preload() and setColumnar()),
+         * or the file has errors.
+         * Enabled by default.
+         */
+        static void setDiffReload(bool enable);
+
+        /*!
+         * Returns the value set by setDiffReload().
+         */
+        static bool isDiffReload();
+
+        /*!
+         * Enables or disables the deduplication of the files loaded under different names.
+         * When a file is loaded, its fingerprint is calculated (see fingerprintFile()).
+         * If the same contents were already loaded from another file
+         * and compiled into an Image, stored in the columnar or in the compact form,
+         * then both files share the same translations in memory (see LangStorage::share())
+         * and the new file is not parsed.
+         * The translations stored in the hash tables are not shared, since they are modified on reload (see setDiffReload()).
+         * This costs an additional read of each loaded file.
+         * Disabled by default.
+         */
+        static void setDedup(bool enable);
+
+        /*!
+         * Returns the value set by setDedup().
+         */
+        static bool isDedup();
+
+        /*!
+         * Reloads the translations if they were evicted from the global storage
+         * (see setMemoryBudget()).
+         * Translation functions call it automatically.
+         */
+        inline void revive() const {
+            if(entry->generation.load(std::memory_order_relaxed) != generation)
+                reviveEvicted();
+        }
+
+        /*!
+         * Returns the global storage entry of the currently loaded translations.
+         * If no translation is loaded then the function returns the dummy entry.
+         */
+        inline const LangEntry& getEntry() const {
+            return entry->generation.load(std::memory_order_relaxed) == generation ? *entry : dummyEntry;
+        }
+
         /*!
          * Returns the currently loaded translations.
          * If no translation is loaded then the function returns the dummy translation object.
          * The returned object is dummy if its pluralInfo.count == 0.
          */
-        inline const Lang& getLang() const {return (*lang).second;}
+        inline const Lang& getLang() const {return getEntry().lang;}
+
+        /*!
+         * Sets the minimum number of seconds between two checks
+         * of the modification time of a loaded file.
+         * If the file has been changed since it was loaded,
+         * then load() will reload it automatically.
+         * The new version is parsed in background (see canLoadInBackground())
+         * or by reloadDeferred() (see isReloadDeferred())
+         * and replaces the old one atomically on one of the next load() calls,
+         * so the requests that use the old version are never blocked.
+         * Zero (default) disables the automatic reloading.
+         */
+        static void setReloadInterval(time_t seconds);
+
+        /*!
+         * Returns the value set by setReloadInterval().
+         */
+        static time_t getReloadInterval();
+
+        /*!
+         * Sets the directory for the shared compiled translations.
+         * If set, then each loaded file is compiled into an image (see Image)
+         * and stored in this directory.
+         * All processes that load the same file attach to this image read-only
+         * instead of parsing the file, so the operating system keeps only one copy of the translations
+         * in the physical memory.
+         * The image is rebuilt when the file is changed or when the file is force-reloaded.
+         * The processes that still use the older image are not affected.
+         * Files that can't be shared (e.g. non-local files) are loaded as usual.
+         * Empty string (default) disables the sharing.
+         */
+        static void setSharedDir(const std::string& dir);
+
+        /*!
+         * Returns the value set by setSharedDir().
+         */
+        static std::string getSharedDir();
+
+        /*!
+         * Sets the directory for the hotness profiles (see HotProfile).
+         * If set, then a random sample of the successful lookups is counted per translation (see HotCounters),
+         * and saveHotProfiles() writes the counts into this directory.
+         * When a file with the same contents is parsed later,
+         * the hot translations are placed together in memory and ahead of the others in the hash tables
+         * (see loadFromStream() and Image::build()), so their lookups touch less memory.
+         * The profiles are keyed by the fingerprint of the file (see fingerprintFile()),
+         * so a changed file is not affected by the profile of its previous version.
+         * Empty string (default) disables the profiling.
+         */
+        static void setHotProfileDir(const std::string& dir);
+
+        /*!
+         * Returns the value set by setHotProfileDir().
+         */
+        static std::string getHotProfileDir();
+
+        /*!
+         * Enables or disables the huge pages for the translations loaded after this call.
+         * When enabled, each file loaded by parseFile() is compiled into a private image (like preload() does),
+         * and the images bigger than Image::HUGE_PAGE_SIZE are placed into the memory
+         * eligible for the transparent huge pages (see Image::setHugePages()),
+         * so the random lookups in a big file cause fewer TLB misses.
+         * The shared images (see setSharedDir()) are mapped with the same hint.
+         * If the transparent huge pages are not available, the regular pages are used.
+         * The translations compiled this way are always reloaded completely (see setDiffReload()).
+         * The columnar translations (see setColumnar()) are not affected.
+         * Disabled by default.
+         */
+        static void setHugePages(bool enable);
+
+        /*!
+         * Returns the value set by setHugePages().
+         */
+        static bool isHugePages();
+
+        /*!
+         * Enables or disables prefaulting of the shared images (see setSharedDir()) loaded after this call.
+         * When enabled, the whole image is read into memory when it is loaded (see Image::setPrefault()),
+         * so the first lookups do not wait for the page faults.
+         * Disabled by default.
+         */
+        static void setPrefault(bool enable);
+
+        /*!
+         * Returns the value set by setPrefault().
+         */
+        static bool isPrefault();
+
+        /*!
+         * Enables or disables the compression of the translations loaded after this call.
+         * When enabled, all files are loaded in the compact form (see load()),
+         * and their translations are compressed in blocks of Compact::BLOCK_SIZE bytes.
+         * The original strings are not compressed, so the missing strings are found without decompressing anything,
+         * but the first lookup of a translation from a block that is not in the cache (see setBlockCacheSize())
+         * has to decompress the whole block.
+         * The files are not shared via setSharedDir() in this mode.
+         * Disabled by default.
+         */
+        static void setCompressValues(bool enable);
+
+        /*!
+         * Returns the value set by setCompressValues().
+         */
+        static bool isCompressValues();
+
+        /*!
+         * Sets the maximum number of the decompressed blocks of translations (see setCompressValues())
+         * kept by each thread, see Compact::setBlockCacheSize().
+         * Default: 64.
+         */
+        static void setBlockCacheSize(size_t blocks);
+
+        /*!
+         * Returns the value set by setBlockCacheSize().
+         */
+        static size_t getBlockCacheSize();
+
+        /*!
+         * Adds the lookups counted since the previous call to the hotness profiles
+         * of all loaded files in the directory set by setHotProfileDir(),
+         * and resets the counters.
+         * Returns the number of written profiles.
+         */
+        static size_t saveHotProfiles();
 
         /*!
          * Returns all current languages and their corresponsing translations
          * stored in the global storage
          * including unloaded (dummy) translations.
+         *
+         * This function is NOT thread-safe! Use GOTTEXT_READ_LOCK.
          */
         static const LangStorage& getStorage();
 
+        /*!
+         * Returns the statistics of all entries of the global storage
+         * including unloaded (dummy) translations.
+         * The lookup counters are not available if GOTTEXT_NO_STATS directive is specified.
+         */
+        static std::vector<LangStats> getStats();
+
+        /*!
+         * Enables or disables collecting of the strings that were not found
+         * by the translation functions, see MissingCollector.
+         * Disabled by default.
+         */
+        static void collectMissing(bool enable);
+
+        /*!
+         * Returns true if the missing strings are being collected.
+         */
+        static bool isCollectingMissing();
+
+        /*!
+         * Returns the collected missing strings in the gettext template (*.pot) format.
+         * If *clear* == true then all collected strings are removed afterwards.
+         */
+        static std::string getMissing(bool clear = false);
+
         /*!
          * Returns a filename of the currenly loaded file.
          * Returns an empty string if no translation is loaded.
          */
-        inline std::string getFilename() const {return (*lang).first;}
+        inline std::string getFilename() const {return filename;}
 
         /*!
          * Returns a translation of *msgid*.
@@ -192,6 +966,28 @@ namespace GotText {
          */
         std::string _np(const std::string &msgid_ctxt, const std::string &msgid, const std::string &msgid_plural, int n) const;
 
+        /*!
+         * Returns the translation of the prepared message *m*,
+         * i.e. the same as _(), _n(), _p() or _np() would return.
+         * *n* is only used for the plural messages.
+         */
+        std::string translate(const Message &m, int n = 1) const;
+
+        /*!
+         * Translates the message *m* with each of the *objects*
+         * and appends the translations to *result* in the same order.
+         * Same as calling translate() for each object, but the lock is taken only once,
+         * and the key is hashed only once for all compiled (see preload()) translations
+         * and once for all columnar (see setColumnar()) translations.
+         * Each object uses its own plural rules to choose the plural form for *n*.
+         * The translation cached in *m* is neither used nor changed.
+         */
+        static void translateMany(
+            const std::vector<const GotText*>& objects,
+            const Message& m,
+            int n,
+            std::vector<std::string>& result);
+
         /*!
          * Returns true if the file/stream with a specified *filename* is loaded.
          * Returns false if the file/stream was never loaded or
@@ -211,6 +1007,70 @@ namespace GotText {
         inline bool isDummy() const {return getLang().isDummy();}
 
     protected:
+        /*!
+         * Looks up the message *m* in the entry *le* and stores the result in *m*.
+         * MUST be called under GOTTEXT_READ_LOCK.
+         */
+        static void resolve(const Message& m, const LangEntry& le);
+
+        /*!
+         * Finds the translation of the message *m* in the dictionaries of *l*.
+         * Returns the first plural form (or the only translation) and sets *count* to the number of forms.
+         * Returns nullptr if there's no translation.
+         */
+        static const std::string* findInDicts(const Lang& l, const Message& m, size_t& count);
+
+        /*!
+         * Updates the statistics when the translation of *msgid* is found.
+         * *ctx* is nullptr if the lookup did not use it.
+         */
+        static inline void hit(
+                const LangEntry& e,
+                LookupCounters::Dict d,
+                const std::string* ctx,
+                const std::string& msgid)
+        {
+            e.counters.hit(d);
+            LangStorage::touch(e);
+            if(HotCounters::isEnabled())
+                e.hotness.hit(d, ctx, msgid);
+        }
+
+        /*!
+         * Same as above, but the strings are not required to be std::string.
+         * *ctx* is ignored if the lookup did not use it.
+         */
+        static inline void hit(
+                const LangEntry& e,
+                LookupCounters::Dict d,
+                const char* ctx,
+                size_t ctxLen,
+                const char* msgid,
+                size_t msgidLen)
+        {
+            e.counters.hit(d);
+            LangStorage::touch(e);
+            if(HotCounters::isEnabled())
+                e.hotness.hit(d, ctx, ctxLen, msgid, msgidLen);
+        }
+
+        /*!
+         * Updates the statistics when the translation is not found.
+         * *ctx* and *msgidPlural* are nullptr if the lookup did not use them.
+         */
+        static inline void missed(
+                const LangEntry& e,
+                LookupCounters::Dict d,
+                const std::string* ctx,
+                const std::string& msgid,
+                const std::string* msgidPlural)
+        {
+            e.counters.miss(d);
+            LangStorage::touch(e);
+            if(MissingCollector::isEnabled())
+                MissingCollector::add(ctx, msgid, msgidPlural);
+        }
+
         /*!
          * Returns a timestamp, which will be stored in getLang().time.
          * Override to provide consistent timestamps for underlying implementation.
@@ -219,13 +1079,42 @@ namespace GotText {
          */
         virtual time_t getTimestamp() const;
 
+        /*!
+         * Returns the modification time of a file identified by *filename*.
+         * Returns zero if the modification time can not be retrieved,
+         * which disables the automatic reloading for that file.
+         * The default implementation uses stat().
+         */
+        virtual time_t getModificationTime(const std::string& filename) const;
+
+        /*!
+         * Returns true if the automatic reloading may parse the files in a separate thread.
+         * The background thread uses the default implementation of loadFromFile(),
+         * so override this function to return false
+         * if the reimplemented loadFromFile() is not thread-safe.
+         * In this case the file will be parsed in the calling thread,
+         * but the other threads still won't be blocked while parsing.
+         * loadMany() also parses the files in several threads only if this function returns true,
+         * but it uses the reimplemented functions of the object.
+         */
+        virtual bool canLoadInBackground() const;
+
+        /*!
+         * Returns true if the automatic reloading that can't parse the files in background
+         * (see canLoadInBackground()) must leave them to reloadDeferred()
+         * instead of parsing them in the load() call that noticed the change.
+         * The default implementation returns false.
+         */
+        virtual bool isReloadDeferred() const;
+
         /*!
          * Loads a file from a specified location.
          * Throws Exception on error.
          * On success, updates global storage
          * and points *lang* to the loaded Lang struct.
+         * If *rebuild* == true then the shared image is rebuilt (see setSharedDir()).
          */
-        void loadFile(const std::string& filename);
+        void loadFile(const std::string& filename, bool rebuild = false);
 
         /*!
          * Loads a file from a specified stream.
@@ -237,8 +1126,103 @@ namespace GotText {
 
         /*!
          * Sets translations and updates the global storage.
+         * *fromFile* must be true if the translations can be reloaded from *filename*.
+         */
+        void setLang(const std::string& filename, Lang &&other, bool fromFile);
+
+        /*!
+         * Applies the changes to the translations of the storage entry *e*
+         * and points this object to it, see setDiffReload().
+         * If *diff* is complete, then it's the same as setLang().
          */
-        void setLang(const std::string& filename, Lang &&other);
+        void setDiff(LangEntry& e, LangDiff&& diff);
+
+        /*!
+         * Returns the translations of the storage entry *same* for a file with the same contents,
+         * see setDedup().
+         * *mtime* and *loadTime* are the modification time of that file and the time spent on loading it.
+         */
+        Lang shareLang(LangEntry& same, time_t mtime, uint64_t loadTime);
+
+        /*!
+         * Points this object to the storage entry.
+         */
+        void setEntry(const LangEntry& e);
+
+        /*!
+         * Reloads the evicted translations, or makes this object a dummy object
+         * if the translations were unloaded or can't be reloaded.
+         */
+        void reviveEvicted() const;
+
+        /*!
+         * Loads translations from a file via loadFromFile()
+         * or from the shared image (see setSharedDir())
+         * and sets their modification time and fingerprint (see setDedup()).
+         * If *fingerprint* is not nullptr then it's used instead of reading the file again.
+         */
+        Lang parseFile(const std::string& filename, bool rebuild = false, const Fingerprint* fingerprint = nullptr);
+
+        /*!
+         * Returns true if a changed file can be compared with the translations of the storage entry *e*
+         * (see setDiffReload()) instead of being parsed completely.
+         * MUST be called under any GOTTEXT_*_LOCK.
+         */
+        static bool canDiff(const LangEntry& e);
+
+        /*!
+         * Compares a file with the *base* translations via diffFromFile()
+         * and puts the changes into *diff*.
+         * Returns false if the changes can't be found (see setDiffReload()),
+         * then the file must be loaded with parseFile().
+         * The removed translations are not put into *diff*, see findRemoved().
+         */
+        bool parseDiff(const std::string& filename, const LangDigest& base, LangDiff& diff);
+
+        /*!
+         * Compares a file with the translations of the storage entry for *filename*
+         * like parseDiff() and puts all changes into *diff*.
+         * The storage is locked only while the digest of the loaded translations is taken
+         * and while the removed translations are collected.
+         * MUST be called without any locks.
+         */
+        bool parseDiffUnlocked(const std::string& filename, LangDiff& diff);
+
+        /*!
+         * Puts the *base* translations which keys are missing in LangDiff::keys into LangDiff::removed.
+         * MUST be called under any GOTTEXT_*_LOCK.
+         */
+        static void findRemoved(const Lang& base, LangDiff& diff);
+
+        /*!
+         * Returns true if the file for the storage entry *e* needs to be reloaded.
+         * Checks the file at most once per GotText::getReloadInterval() seconds.
+         * MUST be called under GOTTEXT_READ_UPGRADE_LOCK.
+         */
+        bool isOutdated(LangEntry& e) const;
+
+        /*!
+         * Parses the changed file in the current thread and replaces the loaded translations.
+         * The storage is not locked while the file is being parsed or compared
+         * with the loaded translations (see parseDiffUnlocked()).
+         * Keeps the loaded translations if the file can't be parsed.
+         * If *compact* == true, then the file is stored in the compact form (see load()).
+         * MUST be called without any locks.
+         */
+        void reloadOutdated(const std::string& filename, bool compact);
+
+        /*!
+         * Starts parsing the file in a separate thread.
+         * The result will be put into the global storage by applyPendingReloads().
+         * Does nothing if the file is already being reloaded.
+         * If *compact* == true, then the file is stored in the compact form (see load()).
+         */
+        static void reloadInBackground(const std::string& filename, bool compact);
+
+        /*!
+         * Puts the translations that were reloaded in background into the global storage.
+         */
+        void applyPendingReloads();
 
         /*!
          * Loads translations from a file.
@@ -257,6 +1241,39 @@ namespace GotText {
          * This function SHOULD NOT set the *time* field.
          */
         virtual Lang loadFromStream(std::istream& f, const std::string& filename);
+
+        /*!
+         * Returns the fingerprint of a file, see setDedup().
+         * This function SHOULD raise Exception on read errors.
+         */
+        virtual Fingerprint fingerprintFile(const std::string& filename);
+
+        /*!
+         * Reads the stream till the end and returns the fingerprint of the data.
+         * The data is always added to the fingerprint in blocks of the same size,
+         * so the result does not depend on how the stream is read.
+         */
+        static Fingerprint fingerprintStream(std::istream& f);
+
+        /*!
+         * Compares a file with the *base* translations, see diffFromStream().
+         * This function SHOULD raise Exception on read errors.
+         */
+        virtual bool diffFromFile(const std::string& filename, const LangDigest& base, LangDiff& diff);
+
+        /*!
+         * Compares the translations in a stream with the *base* translations
+         * and puts the new and the changed translations into *diff*.
+         * If some of the *base* translations are missing in the stream,
+         * then the keys of the stream are put into LangDiff::keys.
+         * Returns false if the changes can't be applied to *base*
+         * or the data is not valid. In this case the stream must be parsed with loadFromStream(),
+         * which will report the errors.
+         * If thread-safety is enabled, then this function is already thread-safe.
+         * Therefore you MUST NOT use any GOTTEXT_*_LOCK in it.
+         * This function SHOULD NOT set the *time* field.
+         */
+        virtual bool diffFromStream(std::istream& f, const LangDigest& base, LangDiff& diff);
     };
 
 }
@@ -0,0 +1,112 @@
+/*************************************************************************}
+{ hash.h - fast non-cryptographic hashing                                 }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace GotText {
+
+    /*!
+     * Multiplies two numbers and folds the 128-bit result into 64 bits.
+     */
+    inline uint64_t hashMix(uint64_t a, uint64_t b)
+    {
+        __uint128_t r = static_cast<__uint128_t>(a) * b;
+        return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+    }
+
+    /*!
+     * Returns a 64-bit hash of *len* bytes at *data*.
+     * Different *seed* values produce independent hashes.
+     * The result depends on the byte order of the machine,
+     * so it must not be stored anywhere that can be read on another architecture.
+     */
+    inline uint64_t hashBytes(const char* data, size_t len, uint64_t seed = 0)
+    {
+        static const uint64_t K0 = 0xa0761d6478bd642full;
+        static const uint64_t K1 = 0xe7037ed1a0b428dbull;
+        static const uint64_t K2 = 0x8ebc6af09c88c6e3ull;
+
+        uint64_t h = hashMix(seed ^ K0, len ^ K1);
+        while(len >= 16)
+        {
+            uint64_t a, b;
+            memcpy(&a, data, 8);
+            memcpy(&b, data + 8, 8);
+            h = hashMix(a ^ K1, b ^ h);
+            data += 16;
+            len -= 16;
+        }
+        uint64_t a = 0, b = 0;
+        if(len > 8)
+        {
+            memcpy(&a, data, 8);
+            memcpy(&b, data + 8, len - 8);
+        }
+        else
+        {
+            memcpy(&a, data, len);
+        }
+        return hashMix(hashMix(a ^ K1, b ^ h), K2);
+    }
+
+    /*!
+     * A 128-bit fingerprint of the contents of a file.
+     * Two fingerprints are equal only if the contents are the same
+     * (except for a negligible chance of a collision).
+     * Like hashBytes(), the fingerprints must not be stored anywhere.
+     */
+    struct Fingerprint {
+        uint64_t lo = 0;
+        uint64_t hi = 0;
+        uint64_t size = 0; /*!< Size of the data in bytes. Zero if the fingerprint is unknown. */
+
+        /*!
+         * Adds the next *len* bytes of the data.
+         * The data must always be added in blocks of the same size,
+         * otherwise the same data gets different fingerprints.
+         */
+        inline void update(const char* data, size_t len) {
+            lo = hashBytes(data, len, lo);
+            hi = hashBytes(data, len, hi ^ 0x9e3779b97f4a7c15ull);
+            size += len;
+        }
+
+        inline bool isEmpty() const {return !size;}
+
+        inline bool operator==(const Fingerprint& other) const {
+            return lo == other.lo && hi == other.hi && size == other.size;
+        }
+
+        /*!
+         * A hash function for the unordered containers.
+         */
+        struct Hash {
+            inline size_t operator()(const Fingerprint& f) const {return static_cast<size_t>(f.lo);}
+        };
+    };
+
+}
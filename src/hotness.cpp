@@ -0,0 +1,207 @@
+/*************************************************************************}
+{ hotness.cpp - lookup hotness profiles                                   }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#include "hotness.h"
+#include "image.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#include <unistd.h>
+
+namespace GotText {
+
+    /*!
+     * The header of a profile file. It's followed by *nKeys* pairs of the key hash and the number of lookups.
+     */
+    struct HotProfileHeader {
+        uint32_t magic; /*!< HotProfile::MAGIC_NUMBER */
+        uint32_t version; /*!< HotProfile::VERSION */
+        uint64_t nKeys;
+    };
+
+    static thread_local const HotProfile* currentProfile = nullptr;
+
+    void HotProfile::merge(const HotProfile &other)
+    {
+        for(const auto& i : other.hits)
+            hits[i.first] += i.second;
+    }
+
+    std::string HotProfile::getPath(const std::string &dir, const Fingerprint &fingerprint)
+    {
+        char name[80];
+        snprintf(name, sizeof(name), "gottext-%016llx%016llx-%llu.hot",
+            static_cast<unsigned long long>(fingerprint.hi),
+            static_cast<unsigned long long>(fingerprint.lo),
+            static_cast<unsigned long long>(fingerprint.size));
+        return dir + "/" + name;
+    }
+
+    HotProfile HotProfile::read(const std::string &path)
+    {
+        HotProfile profile;
+        std::ifstream f(path, std::ifstream::binary);
+        HotProfileHeader h;
+        if(!f.read(reinterpret_cast<char*>(&h), sizeof(h))
+            || h.magic != MAGIC_NUMBER
+            || h.version != VERSION
+            || h.nKeys > MAX_KEYS)
+        {
+            return profile;
+        }
+        std::vector<std::pair<uint64_t, uint64_t>> keys(h.nKeys);
+        if(!f.read(reinterpret_cast<char*>(keys.data()), keys.size() * sizeof(keys[0])))
+            return profile;
+        profile.hits.reserve(keys.size());
+        for(const auto& k : keys)
+            profile.hits.emplace(k.first, k.second);
+        return profile;
+    }
+
+    bool HotProfile::write(const std::string &path) const
+    {
+        std::vector<std::pair<uint64_t, uint64_t>> keys(hits.begin(), hits.end());
+        std::sort(keys.begin(), keys.end(), [](const std::pair<uint64_t, uint64_t>& a, const std::pair<uint64_t, uint64_t>& b){
+            return a.second > b.second;
+        });
+        if(keys.size() > MAX_KEYS)
+            keys.resize(MAX_KEYS);
+
+        // several threads of the same process may write the same profile
+        std::string tmpPath = path + ".tmp." + std::to_string(getpid())
+            + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        {
+            std::ofstream f(tmpPath, std::ofstream::binary | std::ofstream::trunc);
+            HotProfileHeader h {MAGIC_NUMBER, VERSION, keys.size()};
+            f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            f.write(reinterpret_cast<const char*>(keys.data()), keys.size() * sizeof(keys[0]));
+            if(!f.flush())
+            {
+                unlink(tmpPath.c_str());
+                return false;
+            }
+        }
+        if(rename(tmpPath.c_str(), path.c_str()))
+        {
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    const HotProfile *HotProfile::current()
+    {
+        return currentProfile;
+    }
+
+    HotProfile::Use::Use(const HotProfile *profile):
+        prev(currentProfile)
+    {
+        currentProfile = profile;
+    }
+
+    HotProfile::Use::~Use()
+    {
+        currentProfile = prev;
+    }
+
+    std::atomic<bool> HotCounters::enabled {false};
+
+    HotCounters::~HotCounters()
+    {
+        delete[] slots.load(std::memory_order_relaxed);
+    }
+
+    void HotCounters::setEnabled(bool enable)
+    {
+        enabled.store(enable, std::memory_order_relaxed);
+    }
+
+    void HotCounters::add(LookupCounters::Dict d, const char *ctx, size_t ctxLen, const char *key, size_t keyLen)
+    {
+        Slot* table = slots.load(std::memory_order_acquire);
+        if(!table)
+        {
+            Slot* fresh = new Slot[CAPACITY];
+            for(size_t a=0; a<CAPACITY; a++)
+            {
+                fresh[a].hash.store(0, std::memory_order_relaxed);
+                fresh[a].count.store(0, std::memory_order_relaxed);
+            }
+            if(slots.compare_exchange_strong(table, fresh, std::memory_order_acq_rel))
+                table = fresh;
+            else
+                delete[] fresh; // another thread has just allocated the table, it's in *table* now
+        }
+
+        uint64_t hash = Image::hashKey(static_cast<Image::Kind>(d), ctx, ctxLen, key, keyLen);
+        if(!hash)
+            hash = 1;
+        for(size_t probe=0; probe<MAX_PROBES; probe++)
+        {
+            Slot& slot = table[(hash + probe) & (CAPACITY - 1)];
+            uint64_t slotHash = slot.hash.load(std::memory_order_relaxed);
+            if(!slotHash && slot.hash.compare_exchange_strong(slotHash, hash, std::memory_order_relaxed))
+                slotHash = hash;
+            if(slotHash == hash)
+            {
+                slot.count.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        // the table is full, the hot translations have claimed their slots long before
+    }
+
+    void HotCounters::collect(HotProfile &profile) const
+    {
+        const Slot* table = slots.load(std::memory_order_acquire);
+        if(!table)
+            return;
+        for(size_t a=0; a<CAPACITY; a++)
+        {
+            uint64_t hash = table[a].hash.load(std::memory_order_relaxed);
+            uint64_t count = table[a].count.load(std::memory_order_relaxed);
+            if(hash && count)
+                profile.add(hash, count);
+        }
+    }
+
+    void HotCounters::reset()
+    {
+        Slot* table = slots.load(std::memory_order_acquire);
+        if(!table)
+            return;
+        // the slots are freed too, so the table does not fill up with the translations that are not used anymore
+        for(size_t a=0; a<CAPACITY; a++)
+        {
+            table[a].hash.store(0, std::memory_order_relaxed);
+            table[a].count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+}
@@ -0,0 +1,201 @@
+/*************************************************************************}
+{ hotness.h - lookup hotness profiles                                     }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hash.h"
+#include "stats.h"
+
+namespace GotText {
+
+    /*!
+     * The number of lookups of the most used translations of a single file,
+     * see GotText::setHotProfileDir().
+     * The translations are identified by the hashes of their keys (see Image::hashKey()),
+     * so the profile does not contain any strings.
+     * Like the hashes, the profile files can only be read on the same architecture.
+     */
+    class HotProfile
+    {
+    public:
+        static const uint32_t MAGIC_NUMBER = 0x50485447; /*!< "GTHP" */
+        static const uint32_t VERSION = 1; /*!< Increment on every change of the file format. */
+        static const size_t MAX_KEYS = 4096; /*!< Maximum number of translations kept in a profile. */
+
+        inline bool isEmpty() const {return hits.empty();}
+        inline size_t size() const {return hits.size();}
+
+        /*!
+         * Returns the number of lookups of the translation with the key *hash*,
+         * zero if the translation is cold.
+         */
+        inline uint64_t getHits(uint64_t hash) const {
+            auto i = hits.find(hash);
+            return i == hits.end() ? 0 : (*i).second;
+        }
+
+        /*!
+         * Adds *n* lookups of the translation with the key *hash*.
+         */
+        inline void add(uint64_t hash, uint64_t n) {hits[hash] += n;}
+
+        /*!
+         * Adds all lookups from the *other* profile.
+         */
+        void merge(const HotProfile& other);
+
+        /*!
+         * Returns the path of the profile file for the translations with the *fingerprint* inside the directory *dir*.
+         */
+        static std::string getPath(const std::string& dir, const Fingerprint& fingerprint);
+
+        /*!
+         * Reads the profile file.
+         * Returns an empty profile if the file does not exist or it's not a valid profile.
+         */
+        static HotProfile read(const std::string& path);
+
+        /*!
+         * Writes the MAX_KEYS hottest translations to the file.
+         * The file is written to a temporary file and then atomically renamed,
+         * so the readers never see a partially written profile.
+         * Returns false on error.
+         */
+        bool write(const std::string& path) const;
+
+        /*!
+         * Returns the profile used for the translations that are being loaded in the current thread,
+         * see Use, or nullptr if there's none.
+         */
+        static const HotProfile* current();
+
+        /*!
+         * Makes the profile current for the current thread until this object is destroyed.
+         * GotText::loadFromStream() can't receive the profile as an argument,
+         * because it can be reimplemented.
+         */
+        class Use
+        {
+        public:
+            explicit Use(const HotProfile* profile);
+            ~Use();
+            Use(const Use&) = delete;
+            Use& operator=(const Use&) = delete;
+
+        protected:
+            const HotProfile* prev;
+        };
+
+    protected:
+        std::unordered_map<uint64_t, uint64_t> hits;
+    };
+
+    /*!
+     * Counts the lookups of the individual translations of a single storage entry.
+     * Only a random sample of the lookups (one of SAMPLE_RATE on average) is counted,
+     * so the hashes of the keys are calculated rarely.
+     * The counts are stored in a fixed-size lock-free hash table,
+     * which is allocated on the first counted lookup.
+     * When the counting is disabled, the lookups only perform a relaxed atomic check.
+     */
+    class HotCounters
+    {
+    public:
+        static const size_t CAPACITY = 8192; /*!< Maximum number of distinct translations. MUST be a power of two. */
+        static const size_t MAX_PROBES = 16; /*!< Maximum number of slots checked for a single translation. */
+        static const uint32_t SAMPLE_RATE = 16; /*!< MUST be a power of two. */
+
+        HotCounters() = default;
+        ~HotCounters();
+        HotCounters(const HotCounters&) = delete;
+        HotCounters& operator=(const HotCounters&) = delete;
+
+        static inline bool isEnabled() {return enabled.load(std::memory_order_relaxed);}
+        static void setEnabled(bool enable);
+
+        /*!
+         * Counts a successful lookup of *key* in the dictionary *d* if it gets into the sample.
+         * *ctx* is nullptr if the lookup did not use it.
+         * Thread-safe and lock-free.
+         */
+        inline void hit(LookupCounters::Dict d, const std::string* ctx, const std::string& key) {
+            if(sample())
+                add(d, ctx ? ctx->data() : nullptr, ctx ? ctx->size() : 0, key.data(), key.size());
+        }
+
+        /*!
+         * Same as above, but the strings are not required to be std::string.
+         * *ctx* is ignored for the dictionaries without the context.
+         */
+        inline void hit(LookupCounters::Dict d, const char* ctx, size_t ctxLen, const char* key, size_t keyLen) {
+            if(sample())
+                add(d, ctx, ctxLen, key, keyLen);
+        }
+
+        /*!
+         * Adds the counted lookups to the *profile*.
+         */
+        void collect(HotProfile& profile) const;
+
+        /*!
+         * Resets all counters to zero and frees all slots.
+         * Lookups that are performed at the same time may be lost or counted for another translation.
+         */
+        void reset();
+
+    protected:
+        /*!
+         * A hash table slot.
+         * The slot is claimed by setting *hash*, then *count* is incremented.
+         */
+        struct Slot {
+            std::atomic<uint64_t> hash; /*!< Zero if the slot is free. */
+            std::atomic<uint64_t> count;
+        };
+
+        std::atomic<Slot*> slots {nullptr};
+
+        static std::atomic<bool> enabled;
+
+        /*!
+         * Returns true for a random lookup out of SAMPLE_RATE.
+         */
+        static inline bool sample() {
+            static thread_local uint32_t state = 0x9e3779b9;
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return !(state & (SAMPLE_RATE - 1));
+        }
+
+        void add(LookupCounters::Dict d, const char* ctx, size_t ctxLen, const char* key, size_t keyLen);
+    };
+
+}
@@ -0,0 +1,566 @@
+/*************************************************************************}
+{ image.cpp - compiled position-independent translations                  }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#include "image.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace GotText {
+
+    static size_t align(size_t n, size_t a)
+    {
+        return (n + a - 1) / a * a;
+    }
+
+    /*!
+     * Appends the data to the image being built.
+     */
+    class ImageWriter
+    {
+    public:
+        std::string out;
+
+        Image::Str add(const char* s, size_t len)
+        {
+            Image::Str result {static_cast<uint32_t>(out.size()), static_cast<uint32_t>(len)};
+            out.append(s, len);
+            return result;
+        }
+
+        Image::Str add(const std::string& s)
+        {
+            return add(s.data(), s.size());
+        }
+
+        Image::Str add(const std::vector<std::string>& forms)
+        {
+            std::vector<Image::Str> strs;
+            for(const std::string& s : forms)
+                strs.push_back(add(s));
+            out.resize(align(out.size(), alignof(Image::Str)));
+            Image::Str result {static_cast<uint32_t>(out.size()), static_cast<uint32_t>(forms.size())};
+            out.append(reinterpret_cast<const char*>(strs.data()), strs.size() * sizeof(Image::Str));
+            return result;
+        }
+    };
+
+    Image::Image(std::shared_ptr<const char> memory, size_t size):
+        memory(std::move(memory)),
+        size(size)
+    {
+        data = this->memory.get();
+    }
+
+    bool Image::isValid() const
+    {
+        if(size < sizeof(Header))
+            return false;
+        const Header& h = getHeader();
+        if(h.magic != MAGIC_NUMBER
+            || h.version != VERSION
+            || h.size != size
+            || !h.nBuckets
+            || (h.nBuckets & (h.nBuckets - 1))
+            || h.nEntries >= h.nBuckets // there's always a free bucket, so the lookups stop
+            || h.entriesOffset % alignof(Entry)
+            || h.bucketsOffset % alignof(Bucket)
+            || h.entriesOffset + static_cast<uint64_t>(h.nEntries) * sizeof(Entry) > size
+            || h.bucketsOffset + static_cast<uint64_t>(h.nBuckets) * sizeof(Bucket) > size)
+        {
+            return false;
+        }
+        return isInside(h.locale, 1) && isInside(h.filename, 1);
+    }
+
+    bool Image::isValidEntry(const Entry &e) const
+    {
+        if(e.kind > CtxNum || !isInside(e.key, 1))
+            return false;
+        if((e.kind == CtxOne || e.kind == CtxNum) && !isInside(e.ctx, 1))
+            return false;
+        if(e.kind == One || e.kind == CtxOne)
+            return isInside(e.value, 1);
+        if(e.value.offset % alignof(Str) || !isInside(e.value, sizeof(Str)))
+            return false;
+        const Str* forms = reinterpret_cast<const Str*>(data + e.value.offset);
+        for(uint32_t f=0; f<e.value.len; f++)
+        {
+            if(!isInside(forms[f], 1))
+                return false;
+        }
+        return true;
+    }
+
+    uint64_t Image::hashKey(Kind kind, const char *ctx, size_t ctxLen, const char *key, size_t keyLen)
+    {
+        uint64_t seed = kind;
+        if(kind == CtxOne || kind == CtxNum)
+            seed = hashBytes(ctx, ctxLen, seed);
+        return hashBytes(key, keyLen, seed);
+    }
+
+    const Image::Entry* Image::find(Kind kind, const std::string &ctx, const std::string &key, uint64_t hash) const
+    {
+        const Header& h = getHeader();
+        const Entry* entries = reinterpret_cast<const Entry*>(data + h.entriesOffset);
+        const Bucket* buckets = reinterpret_cast<const Bucket*>(data + h.bucketsOffset);
+        bool hasCtx = kind == CtxOne || kind == CtxNum;
+
+        uint32_t hashHi = static_cast<uint32_t>(hash >> 32);
+        uint32_t mask = h.nBuckets - 1;
+        for(uint32_t i = static_cast<uint32_t>(hash) & mask; ; i = (i + 1) & mask)
+        {
+            const Bucket& b = buckets[i];
+            if(!b.entry)
+                return nullptr;
+            // a broken entry is skipped, see isValidEntry()
+            if(b.hash != hashHi || b.entry > h.nEntries)
+                continue;
+            const Entry& e = entries[b.entry - 1];
+            if(e.kind == kind
+                && isValidEntry(e)
+                && e.key.len == key.size()
+                && !memcmp(data + e.key.offset, key.data(), key.size())
+                && (!hasCtx || (e.ctx.len == ctx.size() && !memcmp(data + e.ctx.offset, ctx.data(), ctx.size()))))
+            {
+                return &e;
+            }
+        }
+    }
+
+    std::string Image::getValue(const Entry &entry, size_t form) const
+    {
+        if(entry.kind == One || entry.kind == CtxOne)
+            return getString(entry.value);
+        const Str* forms = reinterpret_cast<const Str*>(data + entry.value.offset);
+        return getString(forms[form]);
+    }
+
+    size_t Image::countEntries(Kind kind) const
+    {
+        const Header& h = getHeader();
+        const Entry* entries = reinterpret_cast<const Entry*>(data + h.entriesOffset);
+        size_t result = 0;
+        for(uint32_t a=0; a<h.nEntries; a++)
+        {
+            if(entries[a].kind == kind)
+                result++;
+        }
+        return result;
+    }
+
+    void Image::unpack(Lang &lang) const
+    {
+        const Header& h = getHeader();
+        const Entry* entries = reinterpret_cast<const Entry*>(data + h.entriesOffset);
+        for(uint32_t a=0; a<h.nEntries; a++)
+        {
+            const Entry& e = entries[a];
+            if(!isValidEntry(e))
+                continue;
+            std::vector<std::string> forms;
+            if(e.kind == Num || e.kind == CtxNum)
+            {
+                for(uint32_t f=0; f<e.value.len; f++)
+                    forms.emplace_back(getValue(e, f));
+            }
+            switch(e.kind)
+            {
+                case One:
+                    lang.dictOne.emplace(getString(e.key), getString(e.value));
+                    break;
+
+                case Num:
+                    lang.dictNum.emplace(getString(e.key), std::move(forms));
+                    break;
+
+                case CtxOne:
+                    lang.dictCtxOne[getString(e.ctx)].emplace(getString(e.key), getString(e.value));
+                    break;
+
+                case CtxNum:
+                    lang.dictCtxNum[getString(e.ctx)].emplace(getString(e.key), std::move(forms));
+                    break;
+            }
+        }
+    }
+
+    std::string Image::build(
+            const Lang &lang,
+            const std::string& filename,
+            time_t sourceMtime,
+            size_t sourceSize,
+            const HotProfile* hot)
+    {
+        // the translations are collected first, so the hot ones can be placed before the others
+        struct Item {
+            Kind kind;
+            const std::string* ctx;
+            const std::string* key;
+            const std::string* value; // One and CtxOne
+            const std::vector<std::string>* forms; // Num and CtxNum
+            uint64_t hash;
+            uint64_t hits;
+        };
+        std::vector<Item> items;
+        auto addItem = [&items, hot](Kind kind, const std::string* ctx, const std::string& key,
+                                     const std::string* value, const std::vector<std::string>* forms){
+            uint64_t hash = ctx ? hashKey(kind, *ctx, key) : hashKey(kind, nullptr, 0, key.data(), key.size());
+            items.push_back({kind, ctx, &key, value, forms, hash, hot ? hot->getHits(hash) : 0});
+        };
+        for(const auto& i : lang.dictOne)
+            addItem(One, nullptr, i.first, &i.second, nullptr);
+        for(const auto& i : lang.dictNum)
+            addItem(Num, nullptr, i.first, nullptr, &i.second);
+        for(const auto& ic : lang.dictCtxOne)
+        {
+            for(const auto& i : ic.second)
+                addItem(CtxOne, &ic.first, i.first, &i.second, nullptr);
+        }
+        for(const auto& ic : lang.dictCtxNum)
+        {
+            for(const auto& i : ic.second)
+                addItem(CtxNum, &ic.first, i.first, nullptr, &i.second);
+        }
+        if(hot)
+        {
+            std::stable_sort(items.begin(), items.end(), [](const Item& a, const Item& b){
+                return a.hits > b.hits;
+            });
+        }
+
+        size_t nEntries = items.size();
+        size_t nBuckets = 1;
+        while(nBuckets < nEntries * 2) // the load factor is at most 0.5
+            nBuckets <<= 1;
+        size_t entriesOffset = align(sizeof(Header), alignof(Entry));
+        size_t bucketsOffset = align(entriesOffset + nEntries * sizeof(Entry), alignof(Bucket));
+        // the offsets inside the image are 32-bit
+        if(bucketsOffset + nBuckets * sizeof(Bucket) > UINT32_MAX)
+            return std::string();
+
+        Header h {};
+        h.magic = MAGIC_NUMBER;
+        h.version = VERSION;
+        h.sourceMtime = sourceMtime;
+        h.sourceSize = sourceSize;
+        h.published = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        h.nEntries = static_cast<uint32_t>(nEntries);
+        h.nBuckets = static_cast<uint32_t>(nBuckets);
+        h.entriesOffset = static_cast<uint32_t>(entriesOffset);
+        h.bucketsOffset = static_cast<uint32_t>(bucketsOffset);
+
+        ImageWriter w;
+        w.out.resize(h.bucketsOffset + nBuckets * sizeof(Bucket));
+        h.locale = w.add(lang.locale);
+        h.filename = w.add(filename);
+
+        // each context is stored once
+        std::unordered_map<const std::string*, Str> ctxs;
+        std::vector<Entry> entries;
+        std::vector<Bucket> buckets(nBuckets, Bucket {0, 0});
+        entries.reserve(nEntries);
+        for(const Item& item : items)
+        {
+            Str ctx {};
+            if(item.ctx)
+            {
+                auto ic = ctxs.find(item.ctx);
+                if(ic == ctxs.end())
+                    ic = ctxs.emplace(item.ctx, w.add(*item.ctx)).first;
+                ctx = (*ic).second;
+            }
+            Str key = w.add(*item.key);
+            entries.push_back({item.kind, ctx, key, item.forms ? w.add(*item.forms) : w.add(*item.value)});
+
+            uint32_t i = static_cast<uint32_t>(item.hash) & (nBuckets - 1);
+            while(buckets[i].entry)
+                i = (i + 1) & (nBuckets - 1);
+            buckets[i] = {static_cast<uint32_t>(item.hash >> 32), static_cast<uint32_t>(entries.size())};
+        }
+        if(w.out.size() > UINT32_MAX)
+            return std::string();
+
+        h.size = w.out.size();
+        memcpy(&w.out[0], &h, sizeof(h));
+        if(!entries.empty())
+            memcpy(&w.out[h.entriesOffset], entries.data(), entries.size() * sizeof(Entry));
+        memcpy(&w.out[h.bucketsOffset], buckets.data(), buckets.size() * sizeof(Bucket));
+        return std::move(w.out);
+    }
+
+    Lang Image::makeLang(const std::shared_ptr<const Image> &image)
+    {
+        Lang lang;
+        lang.locale = image->getString(image->getHeader().locale);
+        lang.pluralInfo = Plural::getInfo(lang.locale);
+        lang.sourceSize = image->getHeader().sourceSize;
+        lang.image = image;
+        return lang;
+    }
+
+    static std::atomic<bool> hugePages {false};
+    static std::atomic<bool> prefault {false};
+
+    void Image::setHugePages(bool enable)
+    {
+        hugePages.store(enable, std::memory_order_relaxed);
+    }
+
+    bool Image::isHugePages()
+    {
+        return hugePages.load(std::memory_order_relaxed);
+    }
+
+    void Image::setPrefault(bool enable)
+    {
+        prefault.store(enable, std::memory_order_relaxed);
+    }
+
+    bool Image::isPrefault()
+    {
+        return prefault.load(std::memory_order_relaxed);
+    }
+
+    /*!
+     * Maps *size* bytes of private anonymous memory, see Image::setHugePages().
+     * Returns nullptr on error.
+     */
+    static void* allocate(size_t size)
+    {
+        const size_t hugeSize = Image::HUGE_PAGE_SIZE;
+        if(Image::isHugePages() && size >= hugeSize)
+        {
+            // reserve more to cut an aligned block out of it
+            size_t reserved = size + hugeSize;
+            void* p = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(p != MAP_FAILED)
+            {
+                uintptr_t start = reinterpret_cast<uintptr_t>(p);
+                uintptr_t aligned = align(start, hugeSize);
+                uintptr_t end = align(aligned + size, sysconf(_SC_PAGESIZE));
+                if(aligned != start)
+                    munmap(p, aligned - start);
+                if(end != start + reserved)
+                    munmap(reinterpret_cast<void*>(end), start + reserved - end);
+                p = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+                // fails if the transparent huge pages are not supported, the regular pages are used then
+                madvise(p, size, MADV_HUGEPAGE);
+#endif
+                return p;
+            }
+        }
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    std::shared_ptr<const Image> Image::create(const std::string &data)
+    {
+        size_t size = data.size();
+        void* p = allocate(size);
+        if(!p)
+            return nullptr;
+        memcpy(p, data.data(), size);
+        mprotect(p, size, PROT_READ);
+        std::shared_ptr<const char> memory(static_cast<const char*>(p), [size](const char* p){
+            munmap(const_cast<char*>(p), size);
+        });
+        std::shared_ptr<const Image> image = std::make_shared<Image>(std::move(memory), size);
+        if(!image->isValid())
+            return nullptr;
+        return image;
+    }
+
+    std::shared_ptr<const Image> Image::map(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd == -1)
+            return nullptr;
+        struct stat st;
+        if(fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(Header))
+        {
+            close(fd);
+            return nullptr;
+        }
+        size_t size = st.st_size;
+        int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+        if(isPrefault())
+            flags |= MAP_POPULATE;
+#endif
+        void* p = mmap(nullptr, size, PROT_READ, flags, fd, 0);
+        close(fd);
+        if(p == MAP_FAILED)
+            return nullptr;
+#ifdef MADV_HUGEPAGE
+        if(isHugePages() && size >= HUGE_PAGE_SIZE)
+            madvise(p, size, MADV_HUGEPAGE); // usually not supported for files, ignore the errors
+#endif
+        std::shared_ptr<const char> memory(static_cast<const char*>(p), [size](const char* p){
+            munmap(const_cast<char*>(p), size);
+        });
+        std::shared_ptr<const Image> image = std::make_shared<Image>(std::move(memory), size);
+        if(!image->isValid())
+            return nullptr;
+        return image;
+    }
+
+    /*!
+     * Writes *data* to *path* atomically.
+     */
+    static bool publish(const std::string& path, const std::string& data)
+    {
+        std::string tmpPath = path + ".tmp." + std::to_string(getpid());
+        int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd == -1)
+            return false;
+        const char* p = data.data();
+        size_t left = data.size();
+        while(left)
+        {
+            ssize_t n = write(fd, p, left);
+            if(n <= 0)
+            {
+                close(fd);
+                unlink(tmpPath.c_str());
+                return false;
+            }
+            p += n;
+            left -= n;
+        }
+        close(fd);
+        if(rename(tmpPath.c_str(), path.c_str()))
+        {
+            unlink(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /*!
+     * Removes all images in *dir* that start with *prefix* except *keep*.
+     */
+    static void removeOldImages(const std::string& dir, const std::string& prefix, const std::string& keep)
+    {
+        DIR* d = opendir(dir.c_str());
+        if(!d)
+            return;
+        while(dirent* ent = readdir(d))
+        {
+            // the lock file and the images that are being written are kept
+            std::string name(ent->d_name);
+            static const std::string suffix = ".img";
+            if(name.compare(0, prefix.size(), prefix) || name == keep
+                    || name.size() < suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix))
+                continue;
+            unlinkat(dirfd(d), ent->d_name, 0);
+        }
+        closedir(d);
+    }
+
+    std::shared_ptr<const Image> Image::share(
+            const std::string &dir,
+            const std::string &filename,
+            const std::function<const Lang& ()> &load,
+            bool rebuild,
+            const HotProfile* hot)
+    {
+        struct stat st;
+        if(::stat(filename.c_str(), &st) || !S_ISREG(st.st_mode))
+            return nullptr;
+
+        char prefix[32];
+        snprintf(prefix, sizeof(prefix), "gottext-%016llx-",
+            static_cast<unsigned long long>(hashBytes(filename.data(), filename.size())));
+        // the file may be changed several times per second
+        std::string name = prefix;
+        name.append(std::to_string(st.st_mtime));
+        name.append(".");
+        name.append(std::to_string(st.st_mtim.tv_nsec));
+        name.append("-");
+        name.append(std::to_string(st.st_size));
+        name.append(".img");
+        std::string path = dir + "/" + name;
+
+        auto isSame = [&](const std::shared_ptr<const Image>& image){
+            return image && image->getString(image->getHeader().filename) == filename;
+        };
+
+        std::shared_ptr<const Image> image;
+        if(!rebuild)
+        {
+            image = map(path);
+            if(isSame(image))
+                return image;
+        }
+
+        // only one process builds the image, the others wait and then use it;
+        // the lock file is not removed, otherwise a process could lock a new file
+        // while another one still holds the lock of the removed file
+        std::string lockPath = dir + "/" + prefix + "lock";
+        int lockFd = open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if(lockFd == -1)
+            return nullptr;
+        flock(lockFd, LOCK_EX);
+        struct Unlock {
+            int fd;
+            ~Unlock() {close(fd);}
+        } unlock {lockFd};
+
+        if(!rebuild)
+        {
+            image = map(path);
+            if(isSame(image))
+                return image;
+        }
+
+        const Lang& lang = load();
+        std::string data = build(lang, filename, st.st_mtime, st.st_size, hot);
+        if(data.empty() || !publish(path, data))
+            return nullptr;
+        removeOldImages(dir, prefix, name);
+
+        image = map(path);
+        if(!isSame(image))
+            return nullptr;
+        return image;
+    }
+
+}
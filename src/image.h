@@ -0,0 +1,275 @@
+/*************************************************************************}
+{ image.h - compiled position-independent translations                    }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "gottext.h"
+
+namespace GotText {
+
+    /*!
+     * Translations compiled into a single read-only block of memory.
+     * The block contains only offsets, no pointers,
+     * so it can be written to a file and then mapped into memory of any process.
+     * When such file is mapped by several processes, they all share the same physical memory.
+     * Lookups never write to the block.
+     */
+    class Image
+    {
+    public:
+        static const uint32_t MAGIC_NUMBER = 0x4d495447; /*!< "GTIM" */
+        static const uint32_t VERSION = 1; /*!< Increment on every change of the layout. */
+        static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024; /*!< Size of a transparent huge page, see setHugePages(). */
+
+        /*!
+         * Dictionary types, see Lang.
+         */
+        enum Kind : uint32_t {
+            One, /*!< Lang::dictOne */
+            Num, /*!< Lang::dictNum */
+            CtxOne, /*!< Lang::dictCtxOne */
+            CtxNum /*!< Lang::dictCtxNum */
+        };
+
+        /*!
+         * A string inside the image.
+         */
+        struct Str {
+            uint32_t offset;
+            uint32_t len;
+        };
+
+        /*!
+         * The header at the start of the image.
+         */
+        struct Header {
+            uint32_t magic; /*!< MAGIC_NUMBER */
+            uint32_t version; /*!< VERSION */
+            uint64_t size; /*!< The size of the whole image in bytes. */
+            int64_t sourceMtime; /*!< Modification time of the source file. */
+            uint64_t sourceSize; /*!< Size of the source file. */
+            uint64_t published; /*!< The time the image was built, in nanoseconds since the epoch. */
+            Str locale; /*!< Lang::locale */
+            Str filename; /*!< The source file name. */
+            uint32_t nEntries; /*!< Number of entries. */
+            uint32_t nBuckets; /*!< Number of hash table buckets, always a power of two. */
+            uint32_t entriesOffset; /*!< Offset of the Entry array. */
+            uint32_t bucketsOffset; /*!< Offset of the Bucket array. */
+        };
+
+        /*!
+         * A single translation.
+         */
+        struct Entry {
+            uint32_t kind; /*!< Kind */
+            Str ctx; /*!< The context for CtxOne and CtxNum entries. */
+            Str key; /*!< The original string. */
+            Str value; /*!<
+                The translation for One and CtxOne entries.
+                For Num and CtxNum entries *offset* points to an array of Str (one per plural form)
+                and *len* is the number of plural forms.
+            */
+        };
+
+        /*!
+         * A hash table bucket. Collisions are resolved by linear probing.
+         */
+        struct Bucket {
+            uint32_t hash; /*!< The higher 32 bits of the key hash. */
+            uint32_t entry; /*!< The entry index + 1, zero if the bucket is empty. */
+        };
+
+        /*!
+         * Creates the image from a memory block of *size* bytes.
+         * The memory must stay valid until *memory* is destroyed.
+         * The image data is not validated, see isValid().
+         */
+        Image(std::shared_ptr<const char> memory, size_t size);
+
+        /*!
+         * Returns true if the memory block contains a valid image of the current version,
+         * and its header strings and tables are inside the block.
+         * Takes constant time, so mapping an image does not read all of it;
+         * the entries are checked when they are used, see isValidEntry().
+         */
+        bool isValid() const;
+
+        /*!
+         * Returns true if all strings the *entry* refers to are inside the block.
+         * find() and unpack() skip the entries that are not valid.
+         */
+        bool isValidEntry(const Entry& entry) const;
+
+        inline const Header& getHeader() const {return *reinterpret_cast<const Header*>(data);}
+        inline const char* getData() const {return data;}
+        inline size_t getSize() const {return size;}
+
+        /*!
+         * Returns the string stored in the image.
+         */
+        inline std::string getString(const Str& s) const {return std::string(data + s.offset, s.len);}
+
+        /*!
+         * Returns the translation from the *entry*.
+         * *form* is a plural form index for Num and CtxNum entries.
+         */
+        std::string getValue(const Entry& entry, size_t form = 0) const;
+
+        /*!
+         * Finds the entry of the *kind* with the original string *key* and the context *ctx*.
+         * The context is ignored for One and Num entries.
+         * Returns nullptr if there's no such entry.
+         */
+        inline const Entry* find(Kind kind, const std::string& ctx, const std::string& key) const {
+            return find(kind, ctx, key, hashKey(kind, ctx, key));
+        }
+
+        /*!
+         * Same as find(), but uses the *hash* of the key returned by hashKey(),
+         * so the same hash can be used for many images.
+         */
+        const Entry* find(Kind kind, const std::string& ctx, const std::string& key, uint64_t hash) const;
+
+        /*!
+         * Returns the hash of the key. The context is ignored for One and Num entries.
+         */
+        static inline uint64_t hashKey(Kind kind, const std::string& ctx, const std::string& key) {
+            return hashKey(kind, ctx.data(), ctx.size(), key.data(), key.size());
+        }
+        static uint64_t hashKey(Kind kind, const char* ctx, size_t ctxLen, const char* key, size_t keyLen);
+
+        /*!
+         * Returns the number of entries of the *kind*.
+         */
+        size_t countEntries(Kind kind) const;
+
+        /*!
+         * Fills the dictionaries of *lang* with all translations from the image.
+         */
+        void unpack(Lang& lang) const;
+
+        /*!
+         * Compiles the translations into an image.
+         * If the *hot* profile is given, the hot translations are placed at the start of the image
+         * in the order of their hotness, and they take the hash table buckets first,
+         * so the lookups of the hot translations touch fewer cache lines and never probe other buckets.
+         * Returns an empty string if the image would be bigger than 4 GB, since the offsets inside the image are 32-bit.
+         */
+        static std::string build(
+            const Lang& lang,
+            const std::string& filename,
+            time_t sourceMtime,
+            size_t sourceSize,
+            const HotProfile* hot = nullptr);
+
+        /*!
+         * Returns Lang object that refers to the *image*.
+         */
+        static Lang makeLang(const std::shared_ptr<const Image>& image);
+
+        /*!
+         * Copies the image *data* into a new private memory mapping and makes it read-only.
+         * The mapping is page-aligned and contains nothing else,
+         * so its pages are never touched after that
+         * and stay shared between the processes forked after this call.
+         * Returns nullptr if the memory can't be allocated or *data* is not a valid image.
+         */
+        static std::shared_ptr<const Image> create(const std::string& data);
+
+        /*!
+         * Maps the image file into memory (read-only).
+         * Returns nullptr if the file does not exist or it's not a valid image.
+         */
+        static std::shared_ptr<const Image> map(const std::string& path);
+
+        /*!
+         * Enables or disables the huge pages for the images created after this call.
+         * The memory of the images created by create() that are bigger than HUGE_PAGE_SIZE
+         * is aligned to HUGE_PAGE_SIZE and marked as eligible for the transparent huge pages,
+         * so the random lookups in a big image need fewer TLB entries.
+         * The mappings made by map() are marked too, but the kernel only backs them with huge pages
+         * if it supports huge pages for the read-only files.
+         * If the transparent huge pages are not available, the regular pages are used.
+         * Disabled by default.
+         */
+        static void setHugePages(bool enable);
+
+        /*!
+         * Returns the value set by setHugePages().
+         */
+        static bool isHugePages();
+
+        /*!
+         * Enables or disables prefaulting of the images mapped after this call.
+         * When enabled, map() reads all pages of the image file into memory and maps them at once,
+         * so the first lookups do not take page faults.
+         * The images created by create() are always fully in memory.
+         * Disabled by default.
+         */
+        static void setPrefault(bool enable);
+
+        /*!
+         * Returns the value set by setPrefault().
+         */
+        static bool isPrefault();
+
+        /*!
+         * Returns the shared image for the file *filename* from the directory *dir*.
+         * The image file name is based on *filename* and its modification time (with nanoseconds) and size.
+         * If there's no such image yet or *rebuild* == true,
+         * then the translations are loaded via *load* and the new image is published
+         * (written to a temporary file and then atomically renamed).
+         * Only one process builds the image of the same file at a time, the others wait for it and then map it.
+         * The lock file (one per *filename*) is never removed, so all processes always lock the same file.
+         * Images of the older versions of the same file are removed after that,
+         * but the processes that still use them are not affected.
+         * Returns nullptr if the file can not be shared (e.g. it's not a local file or it's too big, see build()).
+         * Exceptions thrown by *load* are passed through.
+         * The *hot* profile is passed to build().
+         */
+        static std::shared_ptr<const Image> share(
+            const std::string& dir,
+            const std::string& filename,
+            const std::function<const Lang&()>& load,
+            bool rebuild,
+            const HotProfile* hot = nullptr);
+
+    protected:
+        std::shared_ptr<const char> memory; /*!< Keeps the memory alive. */
+        const char* data; /*!< The start of the image. */
+        size_t size; /*!< Size of the image in bytes. */
+
+        /*!
+         * Returns true if *s* refers to *s.len* items of *itemSize* bytes inside the block.
+         */
+        inline bool isInside(const Str& s, size_t itemSize) const {
+            return s.offset + static_cast<uint64_t>(s.len) * itemSize <= size;
+        }
+    };
+
+}
@@ -0,0 +1,67 @@
+/*************************************************************************}
+{ memusage.h - memory usage of the standard containers                    }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace GotText {
+
+    /*!
+     * Returns the number of bytes occupied by the string including the object itself.
+     */
+    inline size_t strMemoryUsage(const std::string& s)
+    {
+        const char* p = s.data();
+        const char* self = reinterpret_cast<const char*>(&s);
+        bool isLocal = p >= self && p < self + sizeof(s); // small string optimization
+        return sizeof(s) + (isLocal ? 0 : s.capacity() + 1);
+    }
+
+    /*!
+     * Returns the number of bytes occupied by the vector and all its strings.
+     */
+    inline size_t strMemoryUsage(const std::vector<std::string>& v)
+    {
+        size_t result = sizeof(v);
+        for(const std::string& s : v)
+            result += strMemoryUsage(s);
+        return result + (v.capacity() - v.size()) * sizeof(std::string);
+    }
+
+    /*!
+     * Returns the number of bytes occupied by the buckets and the nodes of the hash table
+     * excluding the keys and the values.
+     */
+    template<typename T>
+    size_t tableMemoryUsage(const std::unordered_map<std::string, T>& dict)
+    {
+        // each node contains the "next" pointer and the cached hash besides the value
+        return dict.bucket_count() * sizeof(void*)
+            + dict.size() * (sizeof(void*) + sizeof(size_t));
+    }
+
+}
@@ -0,0 +1,160 @@
+/*************************************************************************}
+{ missing.cpp - missing translations collector                            }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#include "missing.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <functional>
+#include <tuple>
+
+namespace GotText {
+
+    std::atomic<bool> MissingCollector::enabled {false};
+    std::atomic<size_t> MissingCollector::dropped {0};
+    MissingCollector::Slot MissingCollector::slots[MissingCollector::CAPACITY];
+
+    void MissingCollector::setEnabled(bool enable)
+    {
+        enabled.store(enable, std::memory_order_relaxed);
+    }
+
+    void MissingCollector::add(const std::string *ctx, const std::string &msgid, const std::string *msgidPlural)
+    {
+        uint64_t hash = (ctx ? 2 : 0) | (msgidPlural ? 1 : 0);
+        if(ctx)
+            hash = hashBytes(ctx->data(), ctx->size(), hash);
+        hash = hashBytes(msgid.data(), msgid.size(), hash);
+        if(!hash)
+            hash = 1;
+
+        for(size_t probe=0; probe<MAX_PROBES; probe++)
+        {
+            Slot& slot = slots[(hash + probe) & (CAPACITY - 1)];
+            uint64_t slotHash = slot.hash.load(std::memory_order_relaxed);
+            if(!slotHash)
+            {
+                if(slot.hash.compare_exchange_strong(slotHash, hash, std::memory_order_relaxed))
+                {
+                    Record* r = new Record {ctx != nullptr, msgidPlural != nullptr, ctx ? *ctx : std::string(), msgid,
+                        msgidPlural ? *msgidPlural : std::string()};
+                    slot.record.store(r, std::memory_order_release);
+                    return;
+                }
+                // another thread has just claimed this slot, slotHash contains its hash now
+            }
+            if(slotHash == hash)
+                return; // treat hash collisions as duplicates
+        }
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::vector<const MissingCollector::Record *> MissingCollector::getRecords()
+    {
+        std::vector<const Record*> records;
+        for(const Slot& slot : slots)
+        {
+            if(const Record* r = slot.record.load(std::memory_order_acquire))
+                records.push_back(r);
+        }
+        std::sort(records.begin(), records.end(), [](const Record* a, const Record* b){
+            // plural records go first for the same msgid, see toPot()
+            return std::make_tuple(a->hasCtx, std::cref(a->ctx), std::cref(a->msgid), !a->plural)
+                < std::make_tuple(b->hasCtx, std::cref(b->ctx), std::cref(b->msgid), !b->plural);
+        });
+        return records;
+    }
+
+    size_t MissingCollector::getDropped()
+    {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    void MissingCollector::clear()
+    {
+        for(Slot& slot : slots)
+        {
+            delete slot.record.load(std::memory_order_relaxed);
+            slot.record.store(nullptr, std::memory_order_relaxed);
+            slot.hash.store(0, std::memory_order_relaxed);
+        }
+        dropped.store(0, std::memory_order_relaxed);
+    }
+
+    /*!
+     * Appends a quoted PO string.
+     */
+    static void appendPoString(std::string& s, const std::string& str)
+    {
+        s.push_back('"');
+        for(char c : str)
+        {
+            switch(c)
+            {
+                case '"': s.append("\\\""); break;
+                case '\\': s.append("\\\\"); break;
+                case '\n': s.append("\\n"); break;
+                case '\r': s.append("\\r"); break;
+                case '\t': s.append("\\t"); break;
+                default: s.push_back(c);
+            }
+        }
+        s.append("\"\n");
+    }
+
+    std::string MissingCollector::toPot(const std::vector<const Record *> &records)
+    {
+        std::string s;
+        const Record* prev = nullptr;
+        for(const Record* r : records)
+        {
+            // msgid must be unique within its context, so a singular record is skipped
+            // if the same string was also looked up with a plural form
+            if(prev && prev->hasCtx == r->hasCtx && prev->ctx == r->ctx && prev->msgid == r->msgid)
+                continue;
+            prev = r;
+            if(!s.empty())
+                s.push_back('\n');
+            if(r->hasCtx)
+            {
+                s.append("msgctxt ");
+                appendPoString(s, r->ctx);
+            }
+            s.append("msgid ");
+            appendPoString(s, r->msgid);
+            if(r->plural)
+            {
+                s.append("msgid_plural ");
+                appendPoString(s, r->msgidPlural);
+                s.append("msgstr[0] \"\"\nmsgstr[1] \"\"\n");
+            }
+            else
+            {
+                s.append("msgstr \"\"\n");
+            }
+        }
+        return s;
+    }
+
+}
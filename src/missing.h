@@ -0,0 +1,105 @@
+/*************************************************************************}
+{ missing.h - missing translations collector                              }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace GotText {
+
+    /*!
+     * Collects distinct strings that were not found by the translation functions.
+     * The strings are stored in a fixed-size lock-free hash table,
+     * so the collector never blocks the lookups and never grows beyond its capacity.
+     * When the collector is disabled, the lookups only perform a relaxed atomic check.
+     */
+    class MissingCollector
+    {
+    public:
+        static const size_t CAPACITY = 8192; /*!< Maximum number of distinct strings. MUST be a power of two. */
+        static const size_t MAX_PROBES = 64; /*!< Maximum number of slots checked for a single string. */
+
+        /*!
+         * A single missing string.
+         */
+        struct Record {
+            bool hasCtx; /*!< True if the string was looked up with a context. */
+            bool plural; /*!< True if the string was looked up with a plural form. */
+            std::string ctx; /*!< msgctxt */
+            std::string msgid; /*!< msgid */
+            std::string msgidPlural; /*!< msgid_plural */
+        };
+
+        static inline bool isEnabled() {return enabled.load(std::memory_order_relaxed);}
+        static void setEnabled(bool enable);
+
+        /*!
+         * Records the missing string unless it's already recorded.
+         * *ctx* and *msgidPlural* are nullptr if the lookup did not use them.
+         * The string is dropped if the table is full.
+         * Thread-safe and lock-free.
+         */
+        static void add(const std::string* ctx, const std::string& msgid, const std::string* msgidPlural);
+
+        /*!
+         * Returns all recorded strings sorted by context and msgid.
+         * The strings that are being added at the moment may be omitted.
+         * The returned pointers are valid until clear() is called.
+         */
+        static std::vector<const Record*> getRecords();
+
+        /*!
+         * Returns the number of strings that were dropped because the table was full.
+         */
+        static size_t getDropped();
+
+        /*!
+         * Removes all recorded strings.
+         * MUST NOT be called while add() or getRecords() is running, i.e. use GOTTEXT_WRITE_LOCK.
+         */
+        static void clear();
+
+        /*!
+         * Formats the records returned by getRecords() as entries of a gettext template (*.pot) file.
+         */
+        static std::string toPot(const std::vector<const Record*>& records);
+
+    protected:
+        /*!
+         * A hash table slot.
+         * The slot is claimed by setting *hash*, then *record* is published.
+         */
+        struct Slot {
+            std::atomic<uint64_t> hash; /*!< Zero if the slot is free. */
+            std::atomic<Record*> record;
+        };
+
+        static std::atomic<bool> enabled;
+        static std::atomic<size_t> dropped;
+        static Slot slots[CAPACITY];
+    };
+
+}
@@ -0,0 +1,101 @@
+/*************************************************************************}
+{ stats.cpp - lookup statistics                                           }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#include "stats.h"
+
+namespace GotText {
+
+    uint64_t LookupCounters::getHits(Dict d) const
+    {
+        uint64_t result = 0;
+#ifndef GOTTEXT_NO_STATS
+        for(const Shard& s : shards)
+            result += s.hits[d].load(std::memory_order_relaxed);
+#endif
+        return result;
+    }
+
+    uint64_t LookupCounters::getMisses(Dict d) const
+    {
+        uint64_t result = 0;
+#ifndef GOTTEXT_NO_STATS
+        for(const Shard& s : shards)
+            result += s.misses[d].load(std::memory_order_relaxed);
+#endif
+        return result;
+    }
+
+    void LookupCounters::reset()
+    {
+#ifndef GOTTEXT_NO_STATS
+        for(Shard& s : shards)
+        {
+            for(size_t d=0; d<DictCount; d++)
+            {
+                s.hits[d].store(0, std::memory_order_relaxed);
+                s.misses[d].store(0, std::memory_order_relaxed);
+            }
+        }
+#endif
+    }
+
+#ifndef GOTTEXT_NO_STATS
+    /*!
+     * The shards owned by the running threads, one bit per shard.
+     */
+    static std::atomic<uint32_t> ownedShards {0};
+
+    LookupCounters::ThreadShard::ThreadShard()
+    {
+        // the acquire pairs with the release in the destructor,
+        // so the new owner continues from the counters left by the previous one
+        uint32_t owned = ownedShards.load(std::memory_order_relaxed);
+        for(;;)
+        {
+            uint32_t free = ~owned & ((1u << SHARED_SHARD) - 1);
+            if(!free)
+                return;
+            uint32_t bit = free & (~free + 1);
+            if(ownedShards.compare_exchange_weak(owned, owned | bit, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                index = __builtin_ctz(bit);
+                return;
+            }
+        }
+    }
+
+    LookupCounters::ThreadShard::~ThreadShard()
+    {
+        if(index != SHARED_SHARD)
+            ownedShards.fetch_and(~(1u << index), std::memory_order_release);
+    }
+
+    size_t LookupCounters::getThreadShard()
+    {
+        static thread_local ThreadShard shard;
+        return shard.index;
+    }
+#endif
+
+}
@@ -0,0 +1,144 @@
+/*************************************************************************}
+{ stats.h - lookup statistics                                             }
+{                                                                         }
+{ This file is a part of the project                                      }
+{   GotText - translation engine with gettext-like features               }
+{                                                                         }
+{ (c) Alexey Parfenov, 2016                                               }
+{                                                                         }
+{ e-mail: zxed@alkatrazstudio.net                                         }
+{                                                                         }
+{ This library is free software; you can redistribute it and/or           }
+{ modify it under the terms of the GNU General Public License             }
+{ as published by the Free Software Foundation; either version 3 of       }
+{ the License, or (at your option) any later version.                     }
+{                                                                         }
+{ This library is distributed in the hope that it will be useful,         }
+{ but WITHOUT ANY WARRANTY; without even the implied warranty of          }
+{ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU        }
+{ General Public License for more details.                                }
+{                                                                         }
+{ You may read GNU General Public License at:                             }
+{   http://www.gnu.org/copyleft/gpl.html                                  }
+{*************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace GotText {
+
+    /*!
+     * Lookup counters of a single translation resource.
+     * The counters are split into shards, and each thread writes only to its own shard,
+     * so the threads don't contend for the same cache line.
+     * A shard is owned by a single thread until that thread exits, so its counters are incremented
+     * with a plain relaxed load and store. If more threads are running than there are shards,
+     * then the extra threads share the last shard and increment it with an atomic addition.
+     * Specify GOTTEXT_NO_STATS directive to compile the counters out.
+     */
+    class LookupCounters
+    {
+    public:
+        /*!
+         * Dictionary types, see Lang.
+         */
+        enum Dict {
+            One, /*!< Lang::dictOne */
+            Num, /*!< Lang::dictNum */
+            CtxOne, /*!< Lang::dictCtxOne */
+            CtxNum, /*!< Lang::dictCtxNum */
+            DictCount
+        };
+
+        LookupCounters() {reset();}
+
+#ifndef GOTTEXT_NO_STATS
+        inline void hit(Dict d) {size_t i = getShard(); inc(shards[i].hits[d], i);}
+        inline void miss(Dict d) {size_t i = getShard(); inc(shards[i].misses[d], i);}
+#else
+        inline void hit(Dict) {}
+        inline void miss(Dict) {}
+#endif
+
+        /*!
+         * Returns the number of successful lookups in the dictionary *d*.
+         */
+        uint64_t getHits(Dict d) const;
+
+        /*!
+         * Returns the number of failed lookups in the dictionary *d*.
+         */
+        uint64_t getMisses(Dict d) const;
+
+        /*!
+         * Resets all counters to zero.
+         * Lookups that are performed at the same time may be lost.
+         */
+        void reset();
+
+    protected:
+#ifndef GOTTEXT_NO_STATS
+        static const size_t SHARDS = 16; /*!< MUST NOT be greater than 32. */
+        static const size_t SHARED_SHARD = SHARDS - 1; /*!< The shard of the threads that didn't get their own shard. */
+
+        /*!
+         * The counters of one shard.
+         * The counters occupy 64 bytes and they're followed by 64 bytes of padding,
+         * so the counters of two shards never share a cache line
+         * regardless of the alignment of the whole object.
+         */
+        struct Shard {
+            std::atomic<uint64_t> hits[DictCount];
+            std::atomic<uint64_t> misses[DictCount];
+            char padding[64];
+        };
+
+        Shard shards[SHARDS];
+
+        /*!
+         * Increments the *counter* of the shard with the index *shard*.
+         */
+        static inline void inc(std::atomic<uint64_t>& counter, size_t shard) {
+#ifndef GOTTEXT_NO_THREADSAFE
+            if(shard == SHARED_SHARD)
+            {
+                counter.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+#endif
+            // the shard has a single writer
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        /*!
+         * Returns the shard index of the current thread.
+         */
+        static inline size_t getShard() {
+#ifdef GOTTEXT_NO_THREADSAFE
+            return 0;
+#else
+            return getThreadShard();
+#endif
+        }
+
+        /*!
+         * Returns the shard index owned by the current thread,
+         * or SHARED_SHARD if all other shards are owned by the other threads.
+         */
+        static size_t getThreadShard();
+
+        /*!
+         * Owns a shard while the thread is running, see getThreadShard().
+         */
+        struct ThreadShard {
+            size_t index = SHARED_SHARD;
+            ThreadShard();
+            ~ThreadShard();
+        };
+#endif
+    };
+
+}
@@ -0,0 +1,258 @@
+#!/usr/bin/env bash
+# Runs the cases that need different gottext.* settings, each one in a separate PHP process.
+# Usage: ini-test.sh [path/to/gottext.so]
+set -e
+THIS_DIR="$(dirname -- "$(readlink -f -- "$0")")"
+cd "$THIS_DIR"
+
+PHP_BIN="${PHP_BIN:-$(which php-cgi || which php)}"
+PHP_ARGS=(-dzend.assertions=1 -dassert.exception=1 -q)
+if [[ -n $1 ]]
+then
+    PHP_ARGS+=(-dextension="$(readlink -f -- "$1")")
+fi
+
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf -- "$WORK_DIR"' EXIT
+
+# php-cgi does not support -r, so the scripts are put into files
+# Usage: run_case name [-dsetting=value...] <<PHP ... PHP
+function run_case
+{
+    local NAME="$1"
+    shift
+    {
+        echo "<?php"
+        echo "chdir(\"$WORK_DIR\");"
+        cat
+    } > "$WORK_DIR/$NAME.php"
+    if ! "$PHP_BIN" "${PHP_ARGS[@]}" "$@" "$WORK_DIR/$NAME.php"
+    then
+        echo "Failed: $NAME"
+        exit 1
+    fi
+}
+
+# writes a MO file with the translations *strings* (original => translation) and the Russian plural forms
+WRITE_MO=$(cat <<'PHP'
+function writeMo($path, $strings)
+{
+    $strings[""] = "Content-Type: text/plain; charset=UTF-8\nLanguage: ru_RU\n"
+        ."Plural-Forms: nplurals=3; plural=(n%10==1 && n%100!=11 ? 0 : n%10>=2 && n%10<=4 && (n%100<10 || n%100>=20) ? 1 : 2);\n";
+    ksort($strings, SORT_STRING);
+    // the header, the tables of the original strings and the translations, then the strings
+    $n = count($strings);
+    $offset = 28 + $n * 16;
+    $origs = "";
+    $trs = "";
+    $data = "";
+    foreach(array_keys($strings) as $s)
+    {
+        $origs .= pack("VV", strlen($s), $offset + strlen($data));
+        $data .= $s."\0";
+    }
+    foreach($strings as $s)
+    {
+        $trs .= pack("VV", strlen($s), $offset + strlen($data));
+        $data .= $s."\0";
+    }
+    assert(file_put_contents($path, pack("V7", 0x950412de, 0, $n, 28, 28 + $n * 8, 0, 0).$origs.$trs.$data));
+}
+PHP
+)
+
+# a changed file is parsed again after gottext.reload_interval seconds
+run_case reload -dgottext.reload_interval=1 <<PHP
+assert(copy("$THIS_DIR/ru_RU.mo.1", "./ru_RU.mo"));
+\$t = new GotText("./ru_RU.mo");
+assert(\$t->_("Hello") === "Привет");
+sleep(2);
+assert(copy("$THIS_DIR/ru_RU.mo.2", "./ru_RU.mo"));
+if(GotText::getInfo()["native_file"])
+{
+    // the file is parsed in background, so the next loads will pick up the new version
+    for(\$i = 0; \$i < 50 && \$t->_("Hello") !== "Здравствуйте"; \$i++)
+    {
+        assert(GotText::get("./ru_RU.mo"));
+        usleep(100000);
+    }
+    assert(\$t->_("Hello") === "Здравствуйте");
+}
+else
+{
+    // the file is parsed at the end of the request that noticed the change
+    assert(GotText::get("./ru_RU.mo"));
+    assert(\$t->_("Hello") === "Привет");
+}
+assert(\$t->_("Title") === "Название");
+PHP
+
+# the least recently used files are evicted and reloaded on next use, unless they were unloaded explicitly
+run_case budget -dgottext.memory_budget=1 -dgottext.dedup=0 <<PHP
+foreach(array("a", "b", "c") as \$name)
+    assert(copy("$THIS_DIR/ru_RU.mo.1", "./\$name.mo"));
+\$a = new GotText("./a.mo");
+\$b = new GotText("./b.mo");
+assert(GotText::get("./a.mo") === false);
+// c takes the place of a, b is evicted
+\$c = new GotText("./c.mo");
+assert(GotText::get("./b.mo") === false);
+assert(\$b->_("Title") === "Название");
+// a was evicted from the same place twice
+assert(\$a->_("Title") === "Название");
+assert(GotText::get("./a.mo") !== false);
+assert(\$c->_p("Person", "Title") === "Титул");
+GotText::unload("./c.mo");
+assert(\$c->_("Title") === "Title");
+assert(GotText::get("./c.mo") === false);
+PHP
+
+# the files are loaded on startup without calling load()
+mkdir "$WORK_DIR/preload"
+cp ru_RU.mo.1 "$WORK_DIR/preload/a.mo"
+cp ru_RU.mo.2 "$WORK_DIR/preload/b.mo"
+run_case preload -dgottext.preload="$WORK_DIR/preload/*.mo:$WORK_DIR/nonexistent/*.mo" <<PHP
+\$stats = GotText::getStats();
+assert(array_keys(\$stats) === array("$WORK_DIR/preload/a.mo", "$WORK_DIR/preload/b.mo"));
+foreach(\$stats as \$s)
+{
+    assert(\$s["loaded"] === true);
+    assert(\$s["preloaded"] === true);
+    assert(\$s["loads"] === 1);
+}
+// only the filenames found by the pattern are preloaded
+assert(GotText::get("./preload/a.mo") === false);
+\$a = GotText::get("$WORK_DIR/preload/a.mo");
+assert(\$a->_("Hello") === "Привет");
+\$b = GotText::get("$WORK_DIR/preload/b.mo");
+assert(\$b->_("Hello") === "Здравствуйте");
+assert(\$b->getMemoryUsage()["image"] > 0);
+assert(GotText::getStats()["$WORK_DIR/preload/b.mo"]["loads"] === 1);
+PHP
+
+# the original strings are stored once and get the same ids in all files
+run_case columnar -dgottext.columnar=1 <<PHP
+assert(copy("$THIS_DIR/ru_RU.mo.1", "./a.mo"));
+assert(copy("$THIS_DIR/ru_RU.mo.2", "./b.mo"));
+\$a = new GotText("./a.mo");
+\$b = new GotText("./b.mo");
+assert(\$a->_("Hello") === "Привет");
+assert(\$b->_("Hello") === "Здравствуйте");
+foreach(array(\$a, \$b) as \$t)
+{
+    assert(\$t->_("Title") === "Название");
+    assert(\$t->_p("Person", "Title") === "Титул");
+    assert(\$t->_n("%d site", "%d sites", 5) === "%d мест");
+    assert(\$t->_np("Web", "%d site", "%d sites", 22) === "%d сайта");
+    assert(\$t->_("Not found") === "Not found");
+    assert(\$t->getMemoryUsage()["keys"] === 0);
+}
+// the translations are indexed by the ids, so both files would have bigger tables if the ids were different
+assert(\$b->getMemoryUsage()["tables"] === \$a->getMemoryUsage()["tables"]);
+\$strings = \$a->getStrings();
+\$strings["singular"]["Hello"] = "Здравствуйте";
+assert(\$b->getStrings() == \$strings);
+PHP
+
+# a big file is compiled into an image aligned for the huge pages,
+# and it works the same way if the transparent huge pages are not available
+run_case huge_pages -dgottext.huge_pages=1 <<PHP
+$WRITE_MO
+\$strings = array();
+for(\$i = 0; \$i < 40000; \$i++)
+    \$strings["Message number \$i"] = "Перевод сообщения номер \$i";
+writeMo("./big.mo", \$strings);
+
+\$t = new GotText("./big.mo");
+assert(\$t->getMemoryUsage()["image"] > 2 * 1024 * 1024);
+foreach(array(0, 1, 20000, 39999) as \$i)
+    assert(\$t->_("Message number \$i") === "Перевод сообщения номер \$i");
+assert(\$t->_("Message number 40000") === "Message number 40000");
+assert(\$t->getPluralsCount() === 3);
+GotText::reload("./big.mo");
+assert(\$t->_("Message number 12345") === "Перевод сообщения номер 12345");
+PHP
+
+# the translations are decompressed block by block into a cache that holds a single block
+run_case compress_values -dgottext.compress_values=1 -dgottext.block_cache=1 <<PHP
+$WRITE_MO
+\$strings = array();
+for(\$i = 0; \$i < 5000; \$i++)
+    \$strings["Message number \$i"] = "Перевод сообщения номер \$i";
+writeMo("./compressed.mo", \$strings);
+\$t = new GotText("./compressed.mo");
+assert(\$t->getMemoryUsage()["values"] < strlen(implode("", \$strings)) / 2);
+// the blocks of the neighbouring lookups are far from each other, so each lookup evicts the cached block
+for(\$n = 0; \$n < 3; \$n++)
+{
+    foreach(array(0, 4999, 1, 2500, 4998, 17, 3333) as \$i)
+        assert(\$t->_("Message number \$i") === "Перевод сообщения номер \$i");
+}
+assert(\$t->_("Message number 5000") === "Message number 5000");
+PHP
+
+# the files with the same contents share the translations that are not modified on reload
+run_case dedup -dgottext.dedup=1 <<PHP
+foreach(array("a", "b", "c", "d") as \$name)
+    assert(copy("$THIS_DIR/ru_RU.mo.1", "./\$name.mo"));
+\$a = new GotText("./a.mo", null, true);
+\$b = new GotText("./b.mo", null, true);
+assert(\$a->getLoadProfile()["header"] > 0);
+assert(\$b->getLoadProfile()["header"] == 0); // not parsed
+assert(\$b->getStrings() === \$a->getStrings());
+assert(\$b->_p("Person", "Title") === "Титул");
+GotText::unload("./a.mo");
+assert(\$b->_("Title") === "Название");
+// the hash tables are not shared
+\$c = new GotText("./c.mo");
+\$d = new GotText("./d.mo");
+assert(\$d->getLoadProfile()["header"] > 0);
+assert(\$d->getStrings() === \$c->getStrings());
+PHP
+
+# the lookups are counted in the hotness profiles, the hottest translations come first
+mkdir "$WORK_DIR/hot"
+run_case hot -dgottext.hot_profile_dir="$WORK_DIR/hot" <<PHP
+function readCounts()
+{
+    \$files = glob("./hot/gottext-*.hot");
+    assert(count(\$files) === 1);
+    // the header (magic, version, number of keys) is followed by the pairs of the key hash and the number of lookups
+    \$data = file_get_contents(\$files[0]);
+    \$h = unpack("Vmagic/Vversion/Pkeys", \$data);
+    \$pairs = array_values(unpack("P*", substr(\$data, 16)));
+    assert(count(\$pairs) === \$h["keys"] * 2);
+    \$counts = array();
+    for(\$i = 1; \$i < count(\$pairs); \$i += 2)
+        \$counts[] = \$pairs[\$i];
+    return \$counts;
+}
+
+assert(copy("$THIS_DIR/ru_RU.mo.1", "./hot.mo"));
+\$t = new GotText("./hot.mo");
+// about one of 16 lookups is counted
+for(\$i = 0; \$i < 16000; \$i++)
+    \$t->_("Title");
+for(\$i = 0; \$i < 1600; \$i++)
+    \$t->_p("Person", "Title");
+assert(GotText::saveHotProfiles() === 1);
+\$counts = readCounts();
+assert(count(\$counts) === 2);
+assert(\$counts[0] > \$counts[1] && \$counts[1] > 0);
+
+// the file is laid out according to the profile
+GotText::unload("./hot.mo");
+\$t = new GotText("./hot.mo");
+assert(\$t->_("Title") === "Название");
+assert(\$t->_p("Person", "Title") === "Титул");
+for(\$i = 0; \$i < 64000; \$i++)
+    \$t->_("Hello");
+// the new lookups are added to the saved ones
+assert(GotText::saveHotProfiles() === 1);
+\$newCounts = readCounts();
+assert(count(\$newCounts) === 3);
+assert(\$newCounts[0] > \$newCounts[1] && \$newCounts[1] >= \$newCounts[2]);
+assert(\$newCounts[1] >= \$counts[0]);
+PHP
+
+echo "OK"
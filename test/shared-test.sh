@@ -0,0 +1,71 @@
+#!/usr/bin/env bash
+# Loads the same file from several PHP processes at once with gottext.shared_dir set
+# and checks that all of them use a single shared image.
+# Usage: shared-test.sh [path/to/gottext.so]
+set -e
+THIS_DIR="$(dirname -- "$(readlink -f -- "$0")")"
+cd "$THIS_DIR"
+
+PHP_BIN="${PHP_BIN:-$(which php-cgi || which php)}"
+PHP_ARGS=(-dzend.assertions=1 -dassert.exception=1)
+if [[ -n $1 ]]
+then
+    PHP_ARGS+=(-dextension="$(readlink -f -- "$1")")
+fi
+
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf -- "$WORK_DIR"' EXIT
+SHARED_DIR="$WORK_DIR/shared"
+mkdir "$SHARED_DIR"
+PHP_ARGS+=(-dgottext.shared_dir="$SHARED_DIR" -q)
+
+cp ru_RU.mo.1 ru_RU.mo
+
+# php-cgi does not support -r, so the scripts are put into files
+cat > "$WORK_DIR/load.php" <<PHP
+<?php
+chdir("$THIS_DIR");
+\$t = new GotText("./ru_RU.mo");
+assert(\$t->_("Title") === "Название");
+assert(\$t->_np("Web", "%d site", "%d sites", 22) === "%d сайта");
+assert(count(\$t->getStrings()["singular"]) > 0);
+PHP
+
+cat > "$WORK_DIR/reload.php" <<PHP
+<?php
+chdir("$THIS_DIR");
+\$t = new GotText("./ru_RU.mo");
+assert(\$t->_("Hello") === "Здравствуйте");
+PHP
+
+PIDS=()
+for i in $(seq 1 8)
+do
+    "$PHP_BIN" "${PHP_ARGS[@]}" "$WORK_DIR/load.php" > /dev/null &
+    PIDS+=($!)
+done
+for p in "${PIDS[@]}"
+do
+    wait "$p"
+done
+
+IMAGES=("$SHARED_DIR"/gottext-*.img)
+if [[ ${#IMAGES[@]} != 1 || ! -f ${IMAGES[0]} ]]
+then
+    echo "Expected one shared image, found: ${IMAGES[*]}"
+    exit 1
+fi
+
+# a changed file gets a new image, the old one is removed
+sleep 1
+cp ru_RU.mo.2 ru_RU.mo
+"$PHP_BIN" "${PHP_ARGS[@]}" "$WORK_DIR/reload.php" > /dev/null
+NEW_IMAGES=("$SHARED_DIR"/gottext-*.img)
+if [[ ${#NEW_IMAGES[@]} != 1 || ${NEW_IMAGES[0]} == "${IMAGES[0]}" ]]
+then
+    echo "Expected one new shared image, found: ${NEW_IMAGES[*]}"
+    exit 1
+fi
+
+rm ru_RU.mo
+echo "OK"
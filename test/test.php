@@ -87,12 +87,80 @@ assert(copy("./ru_RU.mo.2", "./ru_RU.mo"));
 assert($gotTextNew = new GotText("./ru_RU.mo"));
 assert($gotTextNew->getStrings() === $gotText->getStrings());
 assert($gotText->_("Hello") === "Привет");
+$msgHello = $gotText->msg("Hello");
+assert($msgHello->get() === "Привет");
 GotText::reload("./ru_RU.mo");
+assert($msgHello->get() === "Здравствуйте");
+assert((string)$msgHello === "Здравствуйте");
+$msgSites = $gotText->msg("%d site", "%d sites", "Web");
+assert($msgSites->get(22) === "%d сайта");
+assert($msgSites->get(11) === "%d сайтов");
+assert($gotText->msg("Not found", "Not found plural")->get(2) === "Not found plural");
+assert(GotText::translateMany(array("ru" => $gotText, 5 => $gotTextEmpty), "%d site", "%d sites", "Web", 22)
+    === array("ru" => "%d сайта", 5 => "%d sites"));
+assert(GotText::translateMany(array($gotText, $gotTextEmpty), "Title") === array("Название", "Title"));
 assert($gotTextNew->getStrings() === $gotText->getStrings());
 assert($gotTextNew->getStrings() !== $gotTextData->getStrings());
 assert($gotText->_("Hello") === "Здравствуйте");
 assert($gotText->getTimeCached() > $timeFirstCached);
 
+assert(json_decode($gotText->getStringsJson(), true) == $gotText->getStrings());
+assert($gotTextEmpty->getStringsJson() === '{"singular":{},"plural":{},"singular_context":{},"plural_context":{}}');
+$slice = $gotText->getStringsSlice("singular", 1, 1);
+assert($slice === array("total" => 3, "strings" => array(array("key" => "Hello", "value" => "Здравствуйте"))));
+$slice = $gotText->getStringsSlice("plural_context", 0, 0, "%d", "Web");
+assert($slice["total"] === 1 && $slice["strings"][0]["value"] === array("%d сайт", "%d сайта", "%d сайтов"));
+assert($gotText->getStringsSlice("singular_context", 0, 0, "", "Web")["total"] === 0);
+
+assert(gottext_get_default() === null);
+gottext_set_default($gotText);
+assert(gottext_get_default()->_("Hello") === "Здравствуйте");
+if(function_exists("__"))
+{
+    assert(__("Hello") === "Здравствуйте");
+    assert(_np("Web", "%d site", "%d sites", 22) === "%d сайта");
+}
+gottext_set_default(null);
+assert(gottext_get_default() === null);
+
+$stats = GotText::getStats();
+assert(array_keys($stats) === array("./ru_RU.mo", "ru_RU"));
+assert($stats["./ru_RU.mo"]["loaded"] === true);
+assert($stats["./ru_RU.mo"]["loads"] === 2);
+assert($stats["./ru_RU.mo"]["entries"]["singular"] > 0);
+assert($stats["ru_RU"]["loaded"] === false);
+if(GotText::getInfo()["stats"])
+{
+    // "Title" twice and "Hello" six times above, plus __("Hello") if the global functions are enabled;
+    // the counters are kept on reload
+    assert($stats["./ru_RU.mo"]["hits"]["singular"] === (function_exists("__") ? 9 : 8));
+    assert($stats["./ru_RU.mo"]["misses"]["singular"] === 0);
+}
+
+$profile = $gotText->getLoadProfile();
+assert(array_keys($profile) === array("header", "tables", "strings", "plural", "charset", "dictionaries", "total"));
+assert($profile["total"] > 0);
+assert($profile["total"] >= $profile["strings"]);
+$memory = $gotText->getMemoryUsage();
+assert($memory["total"] === $stats["./ru_RU.mo"]["memory_usage"]);
+assert($memory["total"] === $memory["keys"] + $memory["values"] + $memory["tables"] + $memory["contexts"] + $memory["image"] + $memory["other"]);
+assert($gotTextEmpty->getMemoryUsage()["total"] === 0);
+
+assert(GotText::getMissing() === "");
+assert(GotText::saveHotProfiles() === 0);
+GotText::collectMissing();
+assert($gotText->_("Hello") === "Здравствуйте");
+assert($gotText->_p("ctx", "Not \"found\"") === "Not \"found\"");
+assert($gotText->_p("ctx", "Not \"found\"") === "Not \"found\"");
+GotText::collectMissing(false);
+assert($gotText->_("Not found either") === "Not found either");
+assert(GotText::getMissing(true) === "msgctxt \"ctx\"\nmsgid \"Not \\\"found\\\"\"\nmsgstr \"\"\n");
+assert(GotText::getMissing() === "");
+
+assert($gotTextSame = new GotText("./ru_RU.mo.2"));
+assert($gotTextSame->getStrings() === $gotText->getStrings());
+GotText::unload("./ru_RU.mo.2");
+
 assert(unlink("./ru_RU.mo"));
 
 try{
@@ -103,6 +171,38 @@ try{
 }
 assert(strlen($msg), "invalid file");
 
+try{
+    GotText::loadMany(array("./ru_RU.mo.koi8", "./ru_RU.mo.invalid"));
+    $msg = "";
+}catch(Exception $e){
+    $msg = $e->getMessage();
+}
+assert(strpos($msg, "./ru_RU.mo.invalid") === 0);
+assert(GotText::get("./ru_RU.mo.koi8") === false);
+
+$gotTexts = GotText::loadMany(array("koi8" => "./ru_RU.mo.koi8"));
+assert(array_keys($gotTexts) === array("koi8"));
+assert($gotTexts["koi8"]->_("Title") === "Название");
+
+assert($gotTextKoi8 = new GotText("./ru_RU.mo.koi8"));
+assert($gotTextKoi8->_("Title") === "Название");
+assert($gotTextKoi8->_n("%d site", "%d sites", 5) === "%d мест");
+
+assert($gotTextCompact = new GotText("./ru_RU.mo.1", null, true));
+assert($gotTextCompact->_("Title") === "Название");
+assert($gotTextCompact->_p("Person", "Title") === "Титул");
+assert($gotTextCompact->_np("Web", "%d site", "%d sites", 22) === "%d сайта");
+assert($gotTextCompact->_n("Title", "Titles", 2) === "Titles");
+assert($gotTextCompact->getStringsSlice("plural_context", 0, 0, "%d", "Web")["total"] === 1);
+
+try{
+    $gotTextInvalid = new GotText("./ru_RU.mo.badutf8");
+    $msg = "";
+}catch(Exception $e){
+    $msg = $e->getMessage();
+}
+assert(strpos($msg, "Invalid UTF-8 byte") !== false && strpos($msg, "Stream pos: 249") !== false, "invalid UTF-8");
+
 try{
     @$gotTextInvalid = new GotText("./ru_RU.mo.nonexistent");
     $msg = "";
@@ -120,7 +220,7 @@ foreach(array("major", "minor", "patch", "timestamp") as $key)
     assert($info[$key] >= 0);
 }
 assert($info["timestamp"] == strtotime(date("Y-m-d H:i:s", $info["timestamp"])));
-foreach(array("thread_safe", "native_file", "debug", "boost_regex", "standalone") as $key)
+foreach(array("thread_safe", "native_file", "debug", "boost_regex", "standalone", "stats") as $key)
 {
     assert(isset($info[$key]));
     assert(is_bool($info[$key]));